@@ -0,0 +1,935 @@
+/* *********************************************************************
+ *
+ * Scriptable benchmark of the i2c_flash driver: sequential and random
+ * read/write/erase workloads, throughput and latency percentiles as
+ * text or JSON, and a check of the EEPROM contents after every run
+ *
+ * Program Name:        I2cFlashBench
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+
+/* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/* ***************** PREPROCESSOR DIRECTIVES **************************/
+/*
+ * Macros required to identify requests in ioctl
+ */
+#define FLASHERASERANGE  _IO('F',4)
+#define FLASHCACHE       _IO('F',5)
+#define FLASHWAIT        _IO('F',6)
+#define CACHEDISABLE      0
+#define CACHEENABLE       1
+#define CACHEINVALIDATE   2
+#define FLASHPRIORITY    _IO('F',9)
+#define PRIORITYHIGH    1
+#define FLASHDEADLINE    _IO('F',10)
+/*
+ * Module parameter giving the bytes of one sequential read transfer
+ */
+#define READ_CHUNK_PARAM "/sys/module/i2c_flash/parameters/read_chunk"
+/*
+ * Most threads of one run
+ */
+#define MAX_THREADS 16
+/*
+ * Most devices of one run, one per chip of the module
+ */
+#define MAX_DEVICES 8
+
+/*
+ * Workloads
+ */
+typedef enum BenchWorkloadTag
+{
+	SEQREAD,
+	RANDREAD,
+	SEQWRITE,
+	RANDWRITE,
+	ERASE
+}BenchWorkloadType;
+
+static const char *BenchWorkloadNames[] = { "seqread", "randread", "seqwrite", "randwrite", "erase" };
+
+/*
+ * Parameters of a run, from the command line
+ */
+typedef struct BenchConfigTag
+{
+	const char *Device; /* device nodes as given, separated by commas */
+	BenchWorkloadType Workload; /* what every operation does */
+	unsigned int Bytes; /* bytes of one request, rounded up to pages for erase */
+	unsigned int PageSize; /* bytes of a page of the part */
+	unsigned int FirstPage; /* first page of the range used */
+	unsigned int PageCount; /* pages of the range on every device, split evenly over its threads */
+	double Seconds; /* duration of the run */
+	unsigned int Threads; /* threads, each with its own file and its own part of the range */
+	int Blocking; /* 1: the files sleep in the driver, 0: O_NONBLOCK files, requests are pipelined with poll */
+	int NoCache; /* 1: the shadow image is switched off during the run */
+	int Json; /* 1: results as JSON */
+	int HighPriority; /* 1: the files of the threads ask for high priority reads */
+	unsigned int EraseFirst; /* first page erased over and over in the background during the run */
+	unsigned int EraseCount; /* pages of that erase, 0 for no background erase */
+	unsigned int DeadlineMs; /* deadline of every request of the threads in ms, 0 for none */
+	int Processes; /* 1: every thread is a process of its own, like independent writers */
+	unsigned int ReadChunk; /* bytes of a read transfer set for the run, 0 to leave read_chunk as it is */
+	char *Devices[MAX_DEVICES]; /* device nodes, the threads are dealt over them in turn */
+	unsigned int DeviceCount; /* device nodes in Devices */
+}BenchConfigType;
+
+/*
+ * State and results of one thread
+ */
+typedef struct BenchThreadTag
+{
+	const BenchConfigType *Config;
+	pthread_t Thread;
+	const char *Device; /* device node of the thread */
+	unsigned int Base; /* first byte of the part of the range of this thread */
+	unsigned int Size; /* bytes of the part */
+	unsigned char *Model; /* expected contents of the part */
+	unsigned int Seed; /* for rand_r */
+	double *Latency; /* latency of every operation in micro seconds */
+	unsigned long Ops; /* operations done */
+	unsigned long Capacity; /* entries allocated in Latency */
+	unsigned long long BytesDone; /* bytes read, written or erased */
+	unsigned long Mismatches; /* reads not matching the expected contents */
+	unsigned long Misses; /* reads given up by the driver on their deadline */
+	int Error; /* errno of a failed operation, 0 if none */
+	pid_t Pid; /* process running the thread with -F, 0 otherwise */
+	int ResultFd; /* read end of the pipe the process sends its results on */
+}BenchThreadType;
+
+/*
+ * Thread erasing a range in the background, to see how much it delays
+ * the workload
+ */
+typedef struct BenchEraserTag
+{
+	const BenchConfigType *Config;
+	pthread_t Thread;
+	volatile int Stop; /* set when the run is over */
+	unsigned long Erases; /* erases of the range completed */
+	int Error; /* errno of a failed erase, 0 if none */
+}BenchEraserType;
+
+/* *********************************************************************
+ * NAME:             Now
+ * DESCRIPTION:      monotonic time in seconds
+ ***********************************************************************/
+static double Now(void)
+{
+	struct timespec Ts;
+	clock_gettime(CLOCK_MONOTONIC,&Ts);
+	return Ts.tv_sec + (Ts.tv_nsec / 1e9);
+}
+
+/* *********************************************************************
+ * NAME:             WaitFor
+ * DESCRIPTION:      sleeps in poll until the file reports the event
+ ***********************************************************************/
+static void WaitFor(int Fd, short Events)
+{
+	struct pollfd PollFd;
+	PollFd.fd = Fd;
+	PollFd.events = Events;
+	poll(&PollFd,1,-1);
+}
+
+/* *********************************************************************
+ * NAME:             ReadAt
+ * DESCRIPTION:      reads Length bytes at Offset. A blocking file sleeps
+ *                   in the driver, on an O_NONBLOCK file pread is
+ *                   repeated after poll until the driver stops
+ *                   returning -EAGAIN.
+ * RETURN VALUES:    0 on success, errno otherwise
+ ***********************************************************************/
+static int ReadAt(int Fd, unsigned char *Buffer, unsigned int Length, unsigned int Offset)
+{
+	ssize_t res;
+	while ((res = pread(Fd,Buffer,Length,Offset)) < 0)
+	{
+		if (EAGAIN == errno)
+		{
+			WaitFor(Fd,POLLIN);
+		}
+		else if (EBUSY == errno)
+		{
+			WaitFor(Fd,POLLOUT);
+		}
+		else
+		{
+			return errno;
+		}
+	}
+	return (res == (ssize_t)Length) ? 0 : EIO;
+}
+
+/* *********************************************************************
+ * NAME:             WriteAt
+ * DESCRIPTION:      queues Length bytes at Offset, waiting for a free
+ *                   slot of the queue if it is full. A blocking file
+ *                   returns once the data is in the EEPROM.
+ * RETURN VALUES:    0 on success, errno otherwise
+ ***********************************************************************/
+static int WriteAt(int Fd, const unsigned char *Buffer, unsigned int Length, unsigned int Offset)
+{
+	ssize_t res;
+	while ((res = pwrite(Fd,Buffer,Length,Offset)) < 0)
+	{
+		if (EBUSY != errno)
+		{
+			return errno;
+		}
+		WaitFor(Fd,POLLOUT);
+	}
+	return (res == (ssize_t)Length) ? 0 : EIO;
+}
+
+/* *********************************************************************
+ * NAME:             EraseAt
+ * DESCRIPTION:      queues the erase of Count pages from page First, a
+ *                   blocking file returns once they are erased
+ * RETURN VALUES:    0 on success, errno otherwise
+ ***********************************************************************/
+static int EraseAt(int Fd, unsigned int First, unsigned int Count)
+{
+	while (ioctl(Fd,FLASHERASERANGE,((Count << 16) | First)) < 0)
+	{
+		if (EBUSY != errno)
+		{
+			return errno;
+		}
+		WaitFor(Fd,POLLOUT);
+	}
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             PipeIo
+ * DESCRIPTION:      moves Length bytes through a pipe, reading if Write
+ *                   is 0
+ * RETURN VALUES:    0 on success, errno otherwise
+ ***********************************************************************/
+static int PipeIo(int Fd, void *Buffer, size_t Length, int Write)
+{
+	size_t Done = 0;
+	ssize_t res;
+	while (Done < Length)
+	{
+		res = Write ? write(Fd,((char*)Buffer + Done),(Length - Done)) : read(Fd,((char*)Buffer + Done),(Length - Done));
+		if ((res < 0) && (EINTR == errno))
+		{
+			continue;
+		}
+		if (res <= 0)
+		{
+			return (res < 0) ? errno : EIO;
+		}
+		Done += res;
+	}
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             NextOffset
+ * DESCRIPTION:      offset within the part of the thread of the next
+ *                   request, one after the other for the sequential
+ *                   workloads, a random page otherwise
+ ***********************************************************************/
+static unsigned int NextOffset(BenchThreadType *Thread, unsigned int Length, unsigned int *Cursor)
+{
+	const BenchConfigType *Config = Thread->Config;
+	unsigned int Offset;
+	if ((SEQREAD == Config->Workload) || (SEQWRITE == Config->Workload))
+	{
+		if ((*Cursor + Length) > Thread->Size)
+		{
+			*Cursor = 0;
+		}
+		Offset = *Cursor;
+		*Cursor += Length;
+		return Offset;
+	}
+	Offset = rand_r(&Thread->Seed) % ((Thread->Size - Length) / Config->PageSize + 1);
+	return Offset * Config->PageSize;
+}
+
+/* *********************************************************************
+ * NAME:             BenchThread
+ * DESCRIPTION:      runs the workload on the part of the range of the
+ *                   thread until the duration is over, recording the
+ *                   latency of every operation
+ ***********************************************************************/
+static void *BenchThread(void *Arg)
+{
+	BenchThreadType *Thread = (BenchThreadType*)Arg;
+	const BenchConfigType *Config = Thread->Config;
+	unsigned int Length = Config->Bytes; /* bytes of one request */
+	unsigned int Cursor = 0; /* next offset of the sequential workloads */
+	unsigned int Offset, Index;
+	unsigned char *Buffer;
+	double Start, End;
+	int Fd;
+	if (ERASE == Config->Workload)
+	{
+		Length = ((Length + Config->PageSize - 1) / Config->PageSize) * Config->PageSize;
+	}
+	Buffer = malloc(Length);
+	/* the driver takes the mode of every call from the file */
+	Fd = open(Thread->Device,(O_RDWR | (Config->Blocking ? 0 : O_NONBLOCK)));
+	if ((NULL == Buffer) || (Fd < 0))
+	{
+		Thread->Error = (NULL == Buffer) ? ENOMEM : errno;
+		free(Buffer);
+		return NULL;
+	}
+	if (Config->HighPriority)
+	{
+		ioctl(Fd,FLASHPRIORITY,PRIORITYHIGH);
+	}
+	if (0 != Config->DeadlineMs)
+	{
+		ioctl(Fd,FLASHDEADLINE,Config->DeadlineMs);
+	}
+	End = Now() + Config->Seconds;
+	while (Now() < End)
+	{
+		Offset = NextOffset(Thread,Length,&Cursor);
+		if ((SEQWRITE == Config->Workload) || (RANDWRITE == Config->Workload))
+		{
+			for (Index = 0; Index < Length; Index++)
+			{
+				Buffer[Index] = (unsigned char)rand_r(&Thread->Seed);
+			}
+		}
+		Start = Now();
+		if ((SEQREAD == Config->Workload) || (RANDREAD == Config->Workload))
+		{
+			Thread->Error = ReadAt(Fd,Buffer,Length,Thread->Base + Offset);
+			if (ETIMEDOUT == Thread->Error)
+			{
+				/* a missed deadline is a result of the run, not a failure */
+				Thread->Misses++;
+				Thread->Error = 0;
+				continue;
+			}
+			if ((0 == Thread->Error) && (0 != memcmp(Buffer,(Thread->Model + Offset),Length)))
+			{
+				Thread->Mismatches++;
+			}
+		}
+		else if (ERASE == Config->Workload)
+		{
+			Thread->Error = EraseAt(Fd,(Thread->Base + Offset) / Config->PageSize,Length / Config->PageSize);
+			memset((Thread->Model + Offset),0xFF,Length);
+		}
+		else
+		{
+			Thread->Error = WriteAt(Fd,Buffer,Length,Thread->Base + Offset);
+			memcpy((Thread->Model + Offset),Buffer,Length);
+		}
+		if (0 != Thread->Error)
+		{
+			break;
+		}
+		if (Thread->Ops == Thread->Capacity)
+		{
+			double *Grown = realloc(Thread->Latency,(Thread->Capacity + 4096) * sizeof(double));
+			if (NULL == Grown)
+			{
+				Thread->Error = ENOMEM;
+				break;
+			}
+			Thread->Latency = Grown;
+			Thread->Capacity += 4096;
+		}
+		Thread->Latency[Thread->Ops++] = (Now() - Start) * 1e6;
+		Thread->BytesDone += Length;
+	}
+	/* the pipelined requests are part of the run */
+	ioctl(Fd,FLASHWAIT,0);
+	close(Fd);
+	free(Buffer);
+	return NULL;
+}
+
+/* *********************************************************************
+ * NAME:             StartProcess
+ * DESCRIPTION:      runs the thread in a child process, which sends its
+ *                   counters and latencies back on a pipe once the run
+ *                   is over. The expected contents are in shared memory.
+ * RETURN VALUES:    0 on success, errno otherwise
+ ***********************************************************************/
+static int StartProcess(BenchThreadType *Thread)
+{
+	int Pipe[2];
+	int Error;
+	if (pipe(Pipe) < 0)
+	{
+		return errno;
+	}
+	Thread->Pid = fork();
+	if (Thread->Pid < 0)
+	{
+		Error = errno;
+		close(Pipe[0]);
+		close(Pipe[1]);
+		return Error;
+	}
+	if (0 == Thread->Pid)
+	{
+		close(Pipe[0]);
+		BenchThread(Thread);
+		Error = PipeIo(Pipe[1],&Thread->Ops,sizeof(Thread->Ops),1);
+		if (0 == Error)
+		{
+			Error = PipeIo(Pipe[1],&Thread->BytesDone,sizeof(Thread->BytesDone),1);
+		}
+		if (0 == Error)
+		{
+			Error = PipeIo(Pipe[1],&Thread->Mismatches,sizeof(Thread->Mismatches),1);
+		}
+		if (0 == Error)
+		{
+			Error = PipeIo(Pipe[1],&Thread->Misses,sizeof(Thread->Misses),1);
+		}
+		if (0 == Error)
+		{
+			Error = PipeIo(Pipe[1],&Thread->Error,sizeof(Thread->Error),1);
+		}
+		if (0 == Error)
+		{
+			Error = PipeIo(Pipe[1],Thread->Latency,(Thread->Ops * sizeof(double)),1);
+		}
+		_exit((0 == Error) ? 0 : 1);
+	}
+	close(Pipe[1]);
+	Thread->ResultFd = Pipe[0];
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             JoinProcess
+ * DESCRIPTION:      takes the results of a thread run by StartProcess
+ *                   and waits for its process to exit
+ ***********************************************************************/
+static void JoinProcess(BenchThreadType *Thread)
+{
+	int Error = PipeIo(Thread->ResultFd,&Thread->Ops,sizeof(Thread->Ops),0);
+	if (0 == Error)
+	{
+		Error = PipeIo(Thread->ResultFd,&Thread->BytesDone,sizeof(Thread->BytesDone),0);
+	}
+	if (0 == Error)
+	{
+		Error = PipeIo(Thread->ResultFd,&Thread->Mismatches,sizeof(Thread->Mismatches),0);
+	}
+	if (0 == Error)
+	{
+		Error = PipeIo(Thread->ResultFd,&Thread->Misses,sizeof(Thread->Misses),0);
+	}
+	if (0 == Error)
+	{
+		Error = PipeIo(Thread->ResultFd,&Thread->Error,sizeof(Thread->Error),0);
+	}
+	if (0 == Error)
+	{
+		Thread->Latency = malloc((Thread->Ops + 1) * sizeof(double));
+		Error = (NULL != Thread->Latency) ? PipeIo(Thread->ResultFd,Thread->Latency,(Thread->Ops * sizeof(double)),0) : ENOMEM;
+	}
+	if (0 != Error)
+	{
+		/* the process died, nothing of it is counted */
+		Thread->Ops = 0;
+		Thread->BytesDone = 0;
+		Thread->Error = Error;
+	}
+	close(Thread->ResultFd);
+	waitpid(Thread->Pid,NULL,0);
+}
+
+/* *********************************************************************
+ * NAME:             EraserThread
+ * DESCRIPTION:      erases the background range again and again, each
+ *                   erase waited for on a blocking file, until the run
+ *                   is over
+ ***********************************************************************/
+static void *EraserThread(void *Arg)
+{
+	BenchEraserType *Eraser = (BenchEraserType*)Arg;
+	int Fd = open(Eraser->Config->Devices[0],O_RDWR);
+	if (Fd < 0)
+	{
+		Eraser->Error = errno;
+		return NULL;
+	}
+	while (!Eraser->Stop)
+	{
+		Eraser->Error = EraseAt(Fd,Eraser->Config->EraseFirst,Eraser->Config->EraseCount);
+		if (0 != Eraser->Error)
+		{
+			break;
+		}
+		Eraser->Erases++;
+	}
+	close(Fd);
+	return NULL;
+}
+
+/* *********************************************************************
+ * NAME:             CompareLatency
+ * DESCRIPTION:      qsort comparison of two latencies
+ ***********************************************************************/
+static int CompareLatency(const void *A, const void *B)
+{
+	double X = *(const double*)A, Y = *(const double*)B;
+	return (X < Y) ? -1 : ((X > Y) ? 1 : 0);
+}
+
+/* *********************************************************************
+ * NAME:             Percentile
+ * DESCRIPTION:      nearest rank percentile of sorted latencies
+ ***********************************************************************/
+static double Percentile(const double *Sorted, unsigned long Count, double Fraction)
+{
+	unsigned long Rank = (unsigned long)(Fraction * Count + 0.999999);
+	if (0 == Count)
+	{
+		return 0;
+	}
+	return Sorted[(0 == Rank) ? 0 : (Rank - 1)];
+}
+
+/* *********************************************************************
+ * NAME:             Prepare
+ * DESCRIPTION:      writes random data to the range so that reads can
+ *                   be checked and erases have pages to clear, and
+ *                   fills the expected contents of every thread
+ * RETURN VALUES:    0 on success, errno otherwise
+ ***********************************************************************/
+static int Prepare(const BenchConfigType *Config, BenchThreadType *Threads)
+{
+	unsigned int Index, Byte;
+	int Fd;
+	int res = 0;
+	for (Index = 0; (Index < Config->Threads) && (0 == res); Index++)
+	{
+		Fd = open(Threads[Index].Device,O_RDWR);
+		if (Fd < 0)
+		{
+			return errno;
+		}
+		for (Byte = 0; Byte < Threads[Index].Size; Byte++)
+		{
+			Threads[Index].Model[Byte] = (unsigned char)rand_r(&Threads[Index].Seed);
+		}
+		res = WriteAt(Fd,Threads[Index].Model,Threads[Index].Size,Threads[Index].Base);
+		if ((0 == res) && Config->NoCache)
+		{
+			ioctl(Fd,FLASHCACHE,CACHEDISABLE);
+		}
+		close(Fd);
+	}
+	return res;
+}
+
+/* *********************************************************************
+ * NAME:             SetReadChunk
+ * DESCRIPTION:      sets the read_chunk parameter of the driver, the
+ *                   chunk size of the sequential read transfers
+ * RETURN VALUES:    0 on success, errno otherwise
+ ***********************************************************************/
+static int SetReadChunk(unsigned int Bytes)
+{
+	FILE *Param = fopen(READ_CHUNK_PARAM,"w");
+	int res;
+	if (NULL == Param)
+	{
+		return errno;
+	}
+	res = (fprintf(Param,"%u\n",Bytes) < 0) ? EIO : 0;
+	if ((0 != fclose(Param)) && (0 == res))
+	{
+		res = errno;
+	}
+	return res;
+}
+
+/* *********************************************************************
+ * NAME:             Verify
+ * DESCRIPTION:      reads the range back from the EEPROM, past the
+ *                   shadow image, and counts the pages which do not
+ *                   hold the expected contents
+ * RETURN VALUES:    pages not matching, -1 if the shadow image could not
+ *                   be invalidated or the range could not be read
+ ***********************************************************************/
+static long Verify(const BenchConfigType *Config, BenchThreadType *Threads)
+{
+	unsigned int Index, Page;
+	unsigned char *Buffer;
+	long Bad = 0;
+	int Fd;
+	for (Index = 0; (Index < Config->Threads) && (Bad >= 0); Index++)
+	{
+		Fd = open(Threads[Index].Device,O_RDWR);
+		if (Fd < 0)
+		{
+			return -1;
+		}
+		/* the shadow image holds what was queued, not what reached the EEPROM */
+		Buffer = NULL;
+		if (ioctl(Fd,FLASHCACHE,CACHEINVALIDATE) < 0)
+		{
+			Bad = -1;
+		}
+		else if ((NULL == (Buffer = malloc(Threads[Index].Size))) ||
+		         (0 != ReadAt(Fd,Buffer,Threads[Index].Size,Threads[Index].Base)))
+		{
+			Bad = -1;
+		}
+		else
+		{
+			for (Page = 0; Page < Threads[Index].Size; Page += Config->PageSize)
+			{
+				if (0 != memcmp((Buffer + Page),(Threads[Index].Model + Page),Config->PageSize))
+				{
+					Bad++;
+				}
+			}
+		}
+		free(Buffer);
+		if (Config->NoCache)
+		{
+			ioctl(Fd,FLASHCACHE,CACHEENABLE);
+		}
+		close(Fd);
+	}
+	return Bad;
+}
+
+/* *********************************************************************
+ * NAME:             Report
+ * DESCRIPTION:      prints the results of the run as text or JSON
+ ***********************************************************************/
+static void Report(const BenchConfigType *Config, double Seconds, unsigned long Ops, unsigned long long Bytes,
+                   const double *Sorted, unsigned long Mismatches, long BadPages, unsigned long Erases,
+                   unsigned long Misses)
+{
+	double P50 = Percentile(Sorted,Ops,0.50), P99 = Percentile(Sorted,Ops,0.99), P999 = Percentile(Sorted,Ops,0.999);
+	double Max = (0 != Ops) ? Sorted[Ops - 1] : 0;
+	if (Config->Json)
+	{
+		printf("{\"device\":\"%s\",\"workload\":\"%s\",\"mode\":\"%s\",\"request_bytes\":%u,\"first_page\":%u,"
+		       "\"pages\":%u,\"threads\":%u,\"processes\":%s,\"seconds\":%.3f,\"ops\":%lu,\"bytes\":%llu,\"ops_per_s\":%.1f,"
+		       "\"bytes_per_s\":%.1f,\"latency_us\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f},"
+		       "\"priority\":\"%s\",\"background_erase_pages\":%u,\"background_erases\":%lu,"
+		       "\"deadline_ms\":%u,\"deadline_misses\":%lu,\"read_chunk\":%u,"
+		       "\"read_mismatches\":%lu,\"bad_pages\":%ld,\"verified\":%s}\n",
+		       Config->Device,BenchWorkloadNames[Config->Workload],Config->Blocking ? "blocking" : "nonblocking",
+		       Config->Bytes,Config->FirstPage,Config->PageCount,Config->Threads,Config->Processes ? "true" : "false",Seconds,Ops,Bytes,Ops / Seconds,
+		       Bytes / Seconds,P50,P99,P999,Max,Config->HighPriority ? "high" : "normal",Config->EraseCount,Erases,
+		       Config->DeadlineMs,Misses,Config->ReadChunk,Mismatches,BadPages,((0 == Mismatches) && (0 == BadPages)) ? "true" : "false");
+		return;
+	}
+	printf("%s %s, %u bytes per request, pages %u..%u, %u %s, %.1f s\n",BenchWorkloadNames[Config->Workload],
+	       Config->Blocking ? "blocking" : "nonblocking",Config->Bytes,Config->FirstPage,
+	       Config->FirstPage + Config->PageCount - 1,Config->Threads,Config->Processes ? "processes" : "threads",Seconds);
+	printf("  %lu ops  %.1f ops/s  %.1f bytes/s\n",Ops,Ops / Seconds,Bytes / Seconds);
+	printf("  latency us  p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",P50,P99,P999,Max);
+	if (0 != Config->EraseCount)
+	{
+		printf("  %s priority, %lu erases of pages %u..%u in the background\n",Config->HighPriority ? "high" : "normal",
+		       Erases,Config->EraseFirst,Config->EraseFirst + Config->EraseCount - 1);
+	}
+	if (0 != Config->ReadChunk)
+	{
+		printf("  read_chunk %u bytes\n",Config->ReadChunk);
+	}
+	if (0 != Config->DeadlineMs)
+	{
+		printf("  %lu reads missed their deadline of %u ms\n",Misses,Config->DeadlineMs);
+	}
+	if (BadPages < 0)
+	{
+		printf("  verify: range could not be read back from the EEPROM\n");
+	}
+	else
+	{
+		printf("  verify: %s (%lu read mismatches, %ld bad pages)\n",((0 == Mismatches) && (0 == BadPages)) ? "ok" : "FAILED",
+		       Mismatches,BadPages);
+	}
+}
+
+/* *********************************************************************
+ * NAME:             Usage
+ * DESCRIPTION:      prints the options
+ ***********************************************************************/
+static void Usage(const char *Name)
+{
+	fprintf(stderr,"usage: %s [-d device[,device...]] [-w seqread|randread|seqwrite|randwrite|erase] [-b bytes]\n"
+	               "          [-p first:count] [-P page size] [-t seconds] [-T threads 1..%d]\n"
+	               "          [-m blocking|nonblocking] [-n] [-j] [-H] [-e first:count] [-D ms] [-F]\n"
+	               "          [-c bytes]\n"
+	               "  -n  switch the shadow image off during the run\n"
+	               "  -H  the reads of the threads are high priority (FLASHPRIORITY)\n"
+	               "  -e  erase these pages over and over in the background, outside the range\n"
+	               "  -D  every request of the threads has a deadline (FLASHDEADLINE), late reads are counted\n"
+	               "  -d  several devices (chips) share the threads in turn, -T a multiple of the devices\n"
+	               "  -F  run every thread as a process of its own, N writer processes with -T N\n"
+	               "  -c  set read_chunk of the driver for the run, with -n the reads are timed per chunk size\n"
+	               "  -j  print the results as JSON\n"
+	               "The range is overwritten with random data before the run and checked after it.\n",
+	        Name,MAX_THREADS);
+}
+
+/* *********************************************************************
+ * Usage: see Usage above. Exit status is 0 only if the run completed
+ * and the contents of the EEPROM were as expected.
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	static BenchThreadType Threads[MAX_THREADS];
+	BenchConfigType Config = { "/dev/i2c_flash", SEQREAD, 64, 64, 0, 0, 5.0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, { NULL }, 0 };
+	static BenchEraserType Eraser;
+	unsigned long Ops = 0, Mismatches = 0, Misses = 0, Copied = 0;
+	unsigned long long Bytes = 0;
+	unsigned int Index, Slice, Started;
+	double *Sorted, Start, Seconds;
+	long BadPages;
+	off_t DeviceSize = 0, Size;
+	char *DeviceList, *Next;
+	int Option, Fd, Error = 0;
+	while (-1 != (Option = getopt(argc,argv,"d:w:b:p:P:t:T:m:njHe:D:Fc:")))
+	{
+		switch (Option)
+		{
+		case 'd':
+			Config.Device = optarg;
+			break;
+		case 'w':
+			for (Index = 0; Index <= ERASE; Index++)
+			{
+				if (0 == strcmp(optarg,BenchWorkloadNames[Index]))
+				{
+					break;
+				}
+			}
+			if (Index > ERASE)
+			{
+				Usage(argv[0]);
+				return 2;
+			}
+			Config.Workload = (BenchWorkloadType)Index;
+			break;
+		case 'b':
+			Config.Bytes = strtoul(optarg,NULL,0);
+			break;
+		case 'p':
+			if (2 != sscanf(optarg,"%u:%u",&Config.FirstPage,&Config.PageCount))
+			{
+				Usage(argv[0]);
+				return 2;
+			}
+			break;
+		case 'P':
+			Config.PageSize = strtoul(optarg,NULL,0);
+			break;
+		case 't':
+			Config.Seconds = strtod(optarg,NULL);
+			break;
+		case 'T':
+			Config.Threads = strtoul(optarg,NULL,0);
+			break;
+		case 'm':
+			Config.Blocking = (0 == strcmp(optarg,"blocking"));
+			break;
+		case 'n':
+			Config.NoCache = 1;
+			break;
+		case 'j':
+			Config.Json = 1;
+			break;
+		case 'H':
+			Config.HighPriority = 1;
+			break;
+		case 'e':
+			if ((2 != sscanf(optarg,"%u:%u",&Config.EraseFirst,&Config.EraseCount)) || (0 == Config.EraseCount))
+			{
+				Usage(argv[0]);
+				return 2;
+			}
+			break;
+		case 'D':
+			Config.DeadlineMs = strtoul(optarg,NULL,0);
+			break;
+		case 'F':
+			Config.Processes = 1;
+			break;
+		case 'c':
+			Config.ReadChunk = strtoul(optarg,NULL,0);
+			break;
+		default:
+			Usage(argv[0]);
+			return 2;
+		}
+	}
+	/* -d /dev/i2c_flash,/dev/i2c_flash1 runs on both chips, the range is used on each */
+	DeviceList = strdup(Config.Device);
+	for (Next = strtok(DeviceList,","); (NULL != Next) && (Config.DeviceCount < MAX_DEVICES); Next = strtok(NULL,","))
+	{
+		Config.Devices[Config.DeviceCount++] = Next;
+	}
+	if (0 == Config.DeviceCount)
+	{
+		Usage(argv[0]);
+		return 2;
+	}
+	for (Index = 0; Index < Config.DeviceCount; Index++)
+	{
+		Fd = open(Config.Devices[Index],O_RDWR);
+		if (Fd < 0)
+		{
+			perror(Config.Devices[Index]);
+			return 1;
+		}
+		/* the smallest device bounds the range */
+		Size = lseek(Fd,0,SEEK_END);
+		if ((0 == Index) || (Size < DeviceSize))
+		{
+			DeviceSize = Size;
+		}
+		close(Fd);
+	}
+	if (0 == Config.PageCount)
+	{
+		Config.PageCount = (DeviceSize / Config.PageSize) - Config.FirstPage;
+	}
+	Slice = (0 != Config.Threads) ? (Config.PageCount / ((Config.Threads + Config.DeviceCount - 1) / Config.DeviceCount)) : 0;
+	if ((0 == Config.PageSize) || (0 == Config.Bytes) || (Config.Seconds <= 0) || (0 == Config.Threads) ||
+	    (Config.Threads > MAX_THREADS) || (0 != (Config.Threads % Config.DeviceCount)) ||
+	    ((off_t)(Config.FirstPage + Config.PageCount) * Config.PageSize > DeviceSize) ||
+	    ((Slice * Config.PageSize) < Config.Bytes))
+	{
+		fprintf(stderr,"%s: bad parameters, the threads must be a multiple of the devices and the range of every thread must hold one request\n",argv[0]);
+		Usage(argv[0]);
+		return 2;
+	}
+	if ((0 != Config.EraseCount) &&
+	    (((off_t)(Config.EraseFirst + Config.EraseCount) * Config.PageSize > DeviceSize) ||
+	     ((Config.EraseFirst < (Config.FirstPage + Config.PageCount)) && (Config.FirstPage < (Config.EraseFirst + Config.EraseCount)))))
+	{
+		fprintf(stderr,"%s: the background erase must be on the device and outside the range\n",argv[0]);
+		return 2;
+	}
+	for (Index = 0; Index < Config.Threads; Index++)
+	{
+		Threads[Index].Config = &Config;
+		Threads[Index].Device = Config.Devices[Index % Config.DeviceCount];
+		Threads[Index].Base = (Config.FirstPage + ((Index / Config.DeviceCount) * Slice)) * Config.PageSize;
+		Threads[Index].Size = Slice * Config.PageSize;
+		Threads[Index].Seed = Index + 1;
+		/* shared, a process of -F updates it for the check after the run */
+		Threads[Index].Model = mmap(NULL,Threads[Index].Size,(PROT_READ | PROT_WRITE),(MAP_SHARED | MAP_ANONYMOUS),-1,0);
+		if (MAP_FAILED == Threads[Index].Model)
+		{
+			fprintf(stderr,"out of memory\n");
+			return 1;
+		}
+	}
+	if ((0 != Config.ReadChunk) && (0 != (Error = SetReadChunk(Config.ReadChunk))))
+	{
+		fprintf(stderr,"%s: %s\n",READ_CHUNK_PARAM,strerror(Error));
+		return 1;
+	}
+	Error = Prepare(&Config,Threads);
+	if (0 != Error)
+	{
+		fprintf(stderr,"preparing the range failed: %s\n",strerror(Error));
+		return 1;
+	}
+	if (0 != Config.EraseCount)
+	{
+		Eraser.Config = &Config;
+		pthread_create(&Eraser.Thread,NULL,EraserThread,&Eraser);
+	}
+	Start = Now();
+	for (Index = 0; Index < Config.Threads; Index++)
+	{
+		if (!Config.Processes)
+		{
+			pthread_create(&Threads[Index].Thread,NULL,BenchThread,&Threads[Index]);
+		}
+		else if (0 != (Threads[Index].Error = StartProcess(&Threads[Index])))
+		{
+			/* the run goes on with the processes already started */
+			Error = Threads[Index].Error;
+			break;
+		}
+	}
+	Started = Index;
+	for (Index = 0; Index < Started; Index++)
+	{
+		if (Config.Processes)
+		{
+			JoinProcess(&Threads[Index]);
+		}
+		else
+		{
+			pthread_join(Threads[Index].Thread,NULL);
+		}
+		Ops += Threads[Index].Ops;
+		Bytes += Threads[Index].BytesDone;
+		Mismatches += Threads[Index].Mismatches;
+		Misses += Threads[Index].Misses;
+		if (0 != Threads[Index].Error)
+		{
+			Error = Threads[Index].Error;
+		}
+	}
+	Seconds = Now() - Start;
+	if (0 != Config.EraseCount)
+	{
+		Eraser.Stop = 1;
+		pthread_join(Eraser.Thread,NULL);
+		if (0 != Eraser.Error)
+		{
+			fprintf(stderr,"background erase failed: %s\n",strerror(Eraser.Error));
+		}
+	}
+	BadPages = Verify(&Config,Threads);
+	Sorted = malloc((Ops + 1) * sizeof(double));
+	if (NULL == Sorted)
+	{
+		fprintf(stderr,"out of memory\n");
+		return 1;
+	}
+	for (Index = 0; Index < Config.Threads; Index++)
+	{
+		memcpy((Sorted + Copied),Threads[Index].Latency,Threads[Index].Ops * sizeof(double));
+		Copied += Threads[Index].Ops;
+	}
+	qsort(Sorted,Ops,sizeof(double),CompareLatency);
+	Report(&Config,Seconds,Ops,Bytes,Sorted,Mismatches,BadPages,Eraser.Erases,Misses);
+	if (0 != Error)
+	{
+		fprintf(stderr,"%s failed: %s\n",BenchWorkloadNames[Config.Workload],strerror(Error));
+	}
+	return ((0 == Error) && (0 == Mismatches) && (0 == BadPages)) ? 0 : 1;
+}
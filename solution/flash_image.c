@@ -0,0 +1,561 @@
+/* *********************************************************************
+ *
+ * Backup and restore of the whole EEPROM image through the i2c_flash
+ * driver. Dump reads the image with one bulk sequential read, restore
+ * writes only the pages which differ from the image, in address order
+ * and queued back to back so that the write cycles follow each other.
+ *
+ * Program Name:        I2cFlashImage
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+
+/* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+/* ***************** PREPROCESSOR DIRECTIVES **************************/
+/*
+ * Macros required to identify requests in ioctl
+ */
+#define FLASHCACHE      _IO('F',5)
+#define FLASHWAIT       _IO('F',6)
+#define CACHEINVALIDATE 2
+#define FLASHVERIFY     _IO('F',15)
+#define FLASHPAGESIZE   _IO('F',16)
+/*
+ * FLASHDIGEST takes a pointer to the range of pages on entry and to the
+ * 32 bit digest on return
+ */
+#define FLASHDIGEST     _IOWR('F',14,uint32_t)
+
+/*
+ * Ways of finding the pages which differ from the image
+ */
+typedef enum ImageCompareTag
+{
+	COMPARE_DIGEST, /* page CRCs kept by the driver, nothing is read from the EEPROM */
+	COMPARE_READ /* the current image is read and compared byte by byte */
+}ImageCompareType;
+
+static const char *ImageCompareNames[] = { "digest", "read" };
+
+/*
+ * Outcome of a dump or a restore
+ */
+typedef struct ImageResultTag
+{
+	const char *Operation; /* dump or restore */
+	unsigned int Size; /* bytes of the image */
+	unsigned int PageSize; /* bytes of a page */
+	ImageCompareType Compare; /* how the pages to be written were found */
+	unsigned long BytesRead; /* bytes read through the driver */
+	unsigned long BytesWritten; /* bytes written through the driver */
+	unsigned int PagesWritten; /* pages which differed from the image */
+	unsigned int Runs; /* write requests, one per run of such pages */
+	long PagesBad; /* pages found different after a restore with -v, -1 if not verified */
+	double Seconds; /* wall time of the transfer */
+}ImageResultType;
+
+static unsigned int Crc32cTable[256];
+
+/* *********************************************************************
+ * NAME:             Now
+ * DESCRIPTION:      monotonic time in seconds
+ ***********************************************************************/
+static double Now(void)
+{
+	struct timespec Ts;
+	clock_gettime(CLOCK_MONOTONIC,&Ts);
+	return Ts.tv_sec + (Ts.tv_nsec / 1e9);
+}
+
+/* *********************************************************************
+ * NAME:             WaitFor
+ * DESCRIPTION:      sleeps in poll until the file reports the event
+ ***********************************************************************/
+static void WaitFor(int Fd, short Events)
+{
+	struct pollfd PollFd;
+	PollFd.fd = Fd;
+	PollFd.events = Events;
+	poll(&PollFd,1,-1);
+}
+
+/* *********************************************************************
+ * NAME:             Crc32c
+ * DESCRIPTION:      CRC32C of a buffer as the driver computes it, with
+ *                   the CRC32 instruction when built for SSE4.2 and a
+ *                   table otherwise
+ ***********************************************************************/
+static unsigned int Crc32c(const unsigned char *Data, unsigned int Length)
+{
+	unsigned int Crc = 0xFFFFFFFF;
+	unsigned int Index, Bit;
+	if (0 == Crc32cTable[1])
+	{
+		for (Index = 0; Index < 256; Index++)
+		{
+			Crc32cTable[Index] = Index;
+			for (Bit = 0; Bit < 8; Bit++)
+			{
+				Crc32cTable[Index] = (Crc32cTable[Index] >> 1) ^ ((Crc32cTable[Index] & 1) ? 0x82F63B78 : 0);
+			}
+		}
+	}
+	for (Index = 0; Index < Length; Index++)
+	{
+#ifdef __SSE4_2__
+		Crc = __builtin_ia32_crc32qi(Crc,Data[Index]);
+#else
+		Crc = Crc32cTable[(Crc ^ Data[Index]) & 0xFF] ^ (Crc >> 8);
+#endif
+	}
+	return ~Crc;
+}
+
+/* *********************************************************************
+ * NAME:             PageDigest
+ * DESCRIPTION:      what FLASHDIGEST gives for a single page holding
+ *                   Data: the CRC32C of the CRC32C of the page, taken as
+ *                   4 bytes little endian
+ ***********************************************************************/
+static uint32_t PageDigest(const unsigned char *Data, unsigned int PageSize)
+{
+	unsigned int Crc = Crc32c(Data,PageSize);
+	unsigned char Entry[4];
+	Entry[0] = Crc & 0xFF;
+	Entry[1] = (Crc >> 8) & 0xFF;
+	Entry[2] = (Crc >> 16) & 0xFF;
+	Entry[3] = Crc >> 24;
+	return Crc32c(Entry,sizeof(Entry));
+}
+
+/* *********************************************************************
+ * NAME:             ReadAll
+ * DESCRIPTION:      reads Length bytes from Offset, with as few reads as
+ *                   the driver allows, one for the whole EEPROM. On an
+ *                   O_NONBLOCK file pread is repeated after poll.
+ * RETURN VALUES:    0 on success, errno otherwise
+ ***********************************************************************/
+static int ReadAll(int Fd, unsigned char *Buffer, unsigned int Length, unsigned int Offset)
+{
+	unsigned int Done = 0;
+	ssize_t res;
+	while (Done < Length)
+	{
+		res = pread(Fd,(Buffer + Done),(Length - Done),(Offset + Done));
+		if (res > 0)
+		{
+			Done += res;
+		}
+		else if (0 == res)
+		{
+			return EIO;
+		}
+		else if (EAGAIN == errno)
+		{
+			WaitFor(Fd,POLLIN);
+		}
+		else if (EBUSY == errno)
+		{
+			WaitFor(Fd,POLLOUT);
+		}
+		else
+		{
+			return errno;
+		}
+	}
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             Geometry
+ * DESCRIPTION:      size of the device and size of its pages
+ * RETURN VALUES:    0 on success, errno otherwise
+ ***********************************************************************/
+static int Geometry(int Fd, unsigned int *Size, unsigned int *PageSize)
+{
+	off_t End = lseek(Fd,0,SEEK_END);
+	int Page;
+	if (End <= 0)
+	{
+		return (End < 0) ? errno : EINVAL;
+	}
+	*Size = End;
+	if (0 == *PageSize)
+	{
+		Page = ioctl(Fd,FLASHPAGESIZE,0);
+		if (Page <= 0)
+		{
+			/* a driver without FLASHPAGESIZE, -P has to be given */
+			return EINVAL;
+		}
+		*PageSize = Page;
+	}
+	return ((0 == (*Size % *PageSize)) ? 0 : EINVAL);
+}
+
+/* *********************************************************************
+ * NAME:             FileIo
+ * DESCRIPTION:      moves Length bytes between the buffer and a regular
+ *                   file or a pipe, reading if Write is 0
+ * RETURN VALUES:    bytes moved, fewer at the end of the input, -1 on
+ *                   error
+ ***********************************************************************/
+static long FileIo(int Fd, unsigned char *Buffer, unsigned int Length, int Write)
+{
+	unsigned int Done = 0;
+	ssize_t res;
+	while (Done < Length)
+	{
+		res = Write ? write(Fd,(Buffer + Done),(Length - Done)) : read(Fd,(Buffer + Done),(Length - Done));
+		if ((res < 0) && (EINTR == errno))
+		{
+			continue;
+		}
+		if (res < 0)
+		{
+			return -1;
+		}
+		if (0 == res)
+		{
+			break;
+		}
+		Done += res;
+	}
+	return Done;
+}
+
+/* *********************************************************************
+ * NAME:             Dump
+ * DESCRIPTION:      reads the whole EEPROM with one read and writes it
+ *                   to the image file
+ * RETURN VALUES:    0 on success, errno otherwise
+ ***********************************************************************/
+static int Dump(int Fd, int ImageFd, ImageResultType *Result)
+{
+	unsigned char *Image = malloc(Result->Size);
+	double Start;
+	int Error;
+	if (NULL == Image)
+	{
+		return ENOMEM;
+	}
+	Start = Now();
+	Error = ReadAll(Fd,Image,Result->Size,0);
+	Result->Seconds = Now() - Start;
+	if (0 == Error)
+	{
+		Result->BytesRead = Result->Size;
+		if (FileIo(ImageFd,Image,Result->Size,1) != (long)Result->Size)
+		{
+			Error = errno;
+		}
+	}
+	free(Image);
+	return Error;
+}
+
+/* *********************************************************************
+ * NAME:             FindChanged
+ * DESCRIPTION:      marks the pages whose contents differ from the
+ *                   image. The driver knows the CRC of every page, so
+ *                   asking for the digest of each page costs no bus
+ *                   transfer. FLASHVERIFY first reads back the pages
+ *                   the driver is not sure about. If the driver can not
+ *                   give digests, or -R is given, the EEPROM is read
+ *                   with one read and compared byte by byte.
+ * RETURN VALUES:    0 on success, errno otherwise
+ ***********************************************************************/
+static int FindChanged(int Fd, const unsigned char *Image, unsigned char *Changed, ImageResultType *Result)
+{
+	unsigned int Pages = Result->Size / Result->PageSize;
+	unsigned int Page;
+	unsigned char *Current;
+	uint32_t Digest;
+	int Error;
+	if (COMPARE_DIGEST == Result->Compare)
+	{
+		/* only the suspect pages are read, usually none */
+		if (ioctl(Fd,FLASHVERIFY,0) >= 0)
+		{
+			for (Page = 0; Page < Pages; Page++)
+			{
+				Digest = (1 << 16) | Page;
+				if (ioctl(Fd,FLASHDIGEST,&Digest) < 0)
+				{
+					break;
+				}
+				Changed[Page] = (Digest != PageDigest((Image + (Page * Result->PageSize)),Result->PageSize));
+			}
+			if (Page == Pages)
+			{
+				return 0;
+			}
+		}
+		Result->Compare = COMPARE_READ;
+	}
+	Current = malloc(Result->Size);
+	if (NULL == Current)
+	{
+		return ENOMEM;
+	}
+	Error = ReadAll(Fd,Current,Result->Size,0);
+	if (0 == Error)
+	{
+		Result->BytesRead += Result->Size;
+		for (Page = 0; Page < Pages; Page++)
+		{
+			Changed[Page] = (0 != memcmp((Current + (Page * Result->PageSize)),(Image + (Page * Result->PageSize)),Result->PageSize));
+		}
+	}
+	free(Current);
+	return Error;
+}
+
+/* *********************************************************************
+ * NAME:             Restore
+ * DESCRIPTION:      writes the pages of the image which differ from the
+ *                   EEPROM. Each run of such pages is one write, queued
+ *                   on an O_NONBLOCK file without waiting for the one
+ *                   before, so the driver goes from one write cycle to
+ *                   the next without a round trip to this program.
+ *                   Nothing is erased first. With Verify the whole
+ *                   EEPROM is read back past the shadow image, which
+ *                   holds what was queued rather than what reached the
+ *                   EEPROM, and compared with the image.
+ * RETURN VALUES:    0 on success, errno otherwise
+ ***********************************************************************/
+static int Restore(int Fd, int ImageFd, int Verify, ImageResultType *Result)
+{
+	unsigned int Pages = Result->Size / Result->PageSize;
+	unsigned char *Image = malloc(Result->Size);
+	unsigned char *Changed = calloc(Pages,1);
+	unsigned int Page, End;
+	ImageCompareType Compare;
+	unsigned char Extra;
+	double Start;
+	ssize_t res;
+	long Length;
+	int Error = 0;
+	if ((NULL == Image) || (NULL == Changed))
+	{
+		free(Image);
+		free(Changed);
+		return ENOMEM;
+	}
+	Length = FileIo(ImageFd,Image,Result->Size,0);
+	if ((Length != (long)Result->Size) || (0 != FileIo(ImageFd,&Extra,1,0)))
+	{
+		fprintf(stderr,"image does not have the %u bytes of the device\n",Result->Size);
+		free(Image);
+		free(Changed);
+		return EINVAL;
+	}
+	Start = Now();
+	Error = FindChanged(Fd,Image,Changed,Result);
+	for (Page = 0; (0 == Error) && (Page < Pages); Page = End)
+	{
+		for (End = Page; (End < Pages) && (Changed[End] == Changed[Page]); End++)
+		{
+		}
+		if (!Changed[Page])
+		{
+			continue;
+		}
+		Length = (End - Page) * Result->PageSize;
+		while ((res = pwrite(Fd,(Image + (Page * Result->PageSize)),Length,(Page * Result->PageSize))) < 0)
+		{
+			if (EBUSY != errno)
+			{
+				Error = errno;
+				break;
+			}
+			/* the queue is full, a slot frees up at the end of the oldest write */
+			WaitFor(Fd,POLLOUT);
+		}
+		if ((0 == Error) && (res != Length))
+		{
+			Error = EIO;
+		}
+		Result->BytesWritten += Length;
+		Result->PagesWritten += End - Page;
+		Result->Runs++;
+	}
+	/* the writes are done once this returns, a write which failed is reported here */
+	if ((0 == Error) && (0 != ioctl(Fd,FLASHWAIT,0)))
+	{
+		Error = errno;
+	}
+	Result->Seconds = Now() - Start;
+	if ((0 == Error) && Verify)
+	{
+		/* the pages just written have known CRCs, only a read compared with the image checks the EEPROM */
+		if (ioctl(Fd,FLASHCACHE,CACHEINVALIDATE) < 0)
+		{
+			Error = errno;
+		}
+		else
+		{
+			Compare = Result->Compare;
+			Result->Compare = COMPARE_READ;
+			Error = FindChanged(Fd,Image,Changed,Result);
+			Result->Compare = Compare;
+		}
+		if (0 == Error)
+		{
+			Result->PagesBad = 0;
+		}
+		for (Page = 0; (0 == Error) && (Page < Pages); Page++)
+		{
+			Result->PagesBad += Changed[Page];
+		}
+	}
+	free(Image);
+	free(Changed);
+	return Error;
+}
+
+/* *********************************************************************
+ * NAME:             Report
+ * DESCRIPTION:      prints the outcome as text or JSON
+ ***********************************************************************/
+static void Report(FILE *Out, const ImageResultType *Result, int Json)
+{
+	if (Json)
+	{
+		fprintf(Out,"{\"operation\":\"%s\",\"bytes\":%u,\"page_size\":%u,\"compare\":\"%s\",\"bytes_read\":%lu,"
+		        "\"bytes_written\":%lu,\"pages_written\":%u,\"write_requests\":%u,\"pages_bad\":%ld,\"seconds\":%.3f}\n",
+		        Result->Operation,Result->Size,Result->PageSize,
+		        (0 == strcmp(Result->Operation,"restore")) ? ImageCompareNames[Result->Compare] : "none",Result->BytesRead,
+		        Result->BytesWritten,Result->PagesWritten,Result->Runs,Result->PagesBad,Result->Seconds);
+		return;
+	}
+	fprintf(Out,"%s of %u bytes (%u pages of %u bytes) in %.3f s\n",Result->Operation,Result->Size,
+	        Result->Size / Result->PageSize,Result->PageSize,Result->Seconds);
+	fprintf(Out,"  %lu bytes read, %lu bytes written\n",Result->BytesRead,Result->BytesWritten);
+	if (0 == strcmp(Result->Operation,"restore"))
+	{
+		fprintf(Out,"  %u pages differed (found by %s), written with %u requests\n",Result->PagesWritten,
+		        ImageCompareNames[Result->Compare],Result->Runs);
+		if (Result->PagesBad >= 0)
+		{
+			fprintf(Out,"  verify: %s (%ld pages differ from the image)\n",(0 == Result->PagesBad) ? "ok" : "FAILED",
+			        Result->PagesBad);
+		}
+	}
+}
+
+/* *********************************************************************
+ * NAME:             Usage
+ * DESCRIPTION:      prints the options
+ ***********************************************************************/
+static void Usage(const char *Name)
+{
+	fprintf(stderr,"usage: %s [-d device] [-P page size] [-R] [-v] [-j] dump|restore file\n"
+	               "  dump     write the whole EEPROM to file, - for stdout\n"
+	               "  restore  write the pages of file, - for stdin, which differ from the EEPROM\n"
+	               "  -P  bytes of a page, asked from the driver by default\n"
+	               "  -R  find the differing pages by reading the EEPROM instead of the page CRCs\n"
+	               "  -v  read every page back after a restore and compare it\n"
+	               "  -j  print the results as JSON\n"
+	               "The image has the size of the device, the pages of a persisted manifest are not part of it.\n",
+	        Name);
+}
+
+/* *********************************************************************
+ * Usage: see Usage above. Exit status is 0 only if the image was
+ * dumped, or restored and verified when asked for.
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	const char *Device = "/dev/i2c_flash";
+	ImageResultType Result = { NULL, 0, 0, COMPARE_DIGEST, 0, 0, 0, 0, -1, 0 };
+	int Option, Fd, ImageFd, Json = 0, Verify = 0, Error;
+	int IsDump, Stdio;
+	while (-1 != (Option = getopt(argc,argv,"d:P:Rvj")))
+	{
+		switch (Option)
+		{
+		case 'd':
+			Device = optarg;
+			break;
+		case 'P':
+			Result.PageSize = strtoul(optarg,NULL,0);
+			break;
+		case 'R':
+			Result.Compare = COMPARE_READ;
+			break;
+		case 'v':
+			Verify = 1;
+			break;
+		case 'j':
+			Json = 1;
+			break;
+		default:
+			Usage(argv[0]);
+			return 2;
+		}
+	}
+	if (((argc - optind) != 2) || ((0 != strcmp(argv[optind],"dump")) && (0 != strcmp(argv[optind],"restore"))))
+	{
+		Usage(argv[0]);
+		return 2;
+	}
+	Result.Operation = argv[optind];
+	IsDump = (0 == strcmp(argv[optind],"dump"));
+	Stdio = (0 == strcmp(argv[optind + 1],"-"));
+	/* writes are queued without waiting, reads wait in poll */
+	Fd = open(Device,(O_RDWR | (IsDump ? 0 : O_NONBLOCK)));
+	if (Fd < 0)
+	{
+		perror(Device);
+		return 1;
+	}
+	Error = Geometry(Fd,&Result.Size,&Result.PageSize);
+	if (0 != Error)
+	{
+		fprintf(stderr,"%s: size or page size unknown: %s\n",Device,strerror(Error));
+		return 1;
+	}
+	if (Stdio)
+	{
+		ImageFd = IsDump ? STDOUT_FILENO : STDIN_FILENO;
+	}
+	else
+	{
+		ImageFd = IsDump ? open(argv[optind + 1],(O_WRONLY | O_CREAT | O_TRUNC),0644) : open(argv[optind + 1],O_RDONLY);
+	}
+	if (ImageFd < 0)
+	{
+		perror(argv[optind + 1]);
+		return 1;
+	}
+	Error = IsDump ? Dump(Fd,ImageFd,&Result) : Restore(Fd,ImageFd,Verify,&Result);
+	close(Fd);
+	if (!Stdio)
+	{
+		close(ImageFd);
+	}
+	if (0 != Error)
+	{
+		fprintf(stderr,"%s failed: %s\n",Result.Operation,strerror(Error));
+		return 1;
+	}
+	/* the image may go to stdout */
+	Report((Stdio && IsDump) ? stderr : stdout,&Result,Json);
+	return (Result.PagesBad > 0) ? 1 : 0;
+}
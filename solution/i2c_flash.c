@@ -1,6 +1,6 @@
 /* *********************************************************************
  *
- * Device driver for 24FC256 EEPROM using I2C
+ * Device driver for 24FC256 and other 24xx EEPROMs using I2C
  *
  * Program Name:        i2c_flash
  * Target:              Intel Galileo Gen1
@@ -18,7 +18,7 @@
 #include <linux/cdev.h>
 #include <linux/types.h>
 #include <linux/slab.h>
-#include <asm/uaccess.h>
+#include <linux/uaccess.h>
 #include <linux/string.h>
 #include <linux/device.h>
 #include <linux/init.h>
@@ -26,13 +26,42 @@
 #include <linux/gpio.h>
 #include <linux/i2c.h>
 #include <linux/workqueue.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/moduleparam.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/math64.h>
+#include <linux/bitmap.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/completion.h>
+#include <linux/wait.h>
+#include <linux/list.h>
+#include <linux/ioprio.h>
+#include <linux/poll.h>
+#include <linux/uio.h>
+#include <linux/kthread.h>
+#include <linux/sched/mm.h>
+#include <linux/of_device.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/crc32c.h>
+#include <linux/version.h>
 #include <asm/errno.h>
 /* ***************** PREPROCESSOR DIRECTIVES **************************/
 
 /*
- * If Blocking call is required, comment this macro
+ * The driver is built for Linux 6.6 or later: single argument probe,
+ * void remove, class_create without owner, vm_flags_set, kiocb
+ * completion without res2 and ITER_UBUF iterators
  */
-#define NON_BLOCKING
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,6,0)
+#error "i2c_flash needs Linux 6.6 or later"
+#endif
+
 /*
  * LED indicator can be switched on for one complete operation by commenting this macro
  */
@@ -44,29 +73,33 @@
 #define CHIP_ADDRESS   0x54
 
 /*
- * EEPROM TOTAL PAGES
+ * Limits of the parts in the geometry table, for the buffers and bitmaps
+ * sized at compile time. The 24FC1025 has the largest page and capacity.
  */
-#define PAGECOUNT 512
+#define MAX_PAGESIZE    128
+#define MAX_EEPROMSIZE  (128 * 1024)
+#define MAX_PAGECOUNT   1024
 /*
  * Length of the device name string
  */
 #define DEVICE_NAME_LENGTH   20
 
 /*
- * Number of devices that are need to be created by the driver at the end of the
- * driver initialization using udev
+ * Most chips handled by the driver, one device node each. The 24FC256 has
+ * three address pins, so eight chips fit on one bus (0x50 - 0x57).
  */
-#define NUMBER_OF_DEVICES   1
+#define NUMBER_OF_DEVICES   8
 
 /*
- * driver name
+ * Minor number and name of the striped device, after the chips
  */
-#define DEVICE_NAME    "i2c_flash"
+#define STRIPE_MINOR   NUMBER_OF_DEVICES
+#define STRIPE_NAME    "i2c_flash_stripe"
+
 /*
- * Page size
+ * driver name
  */
-#define PAGESIZE   64
-
+#define DEVICE_NAME    "i2c_flash"
 /*
  * Adapter minor number
  */
@@ -86,6 +119,75 @@
  * I2C Adapter class
  */
 #define I2C_ADAPTER_CLASS   0
+
+/*
+ * Default number of requests that can be queued to the workqueue
+ */
+#define QUEUE_DEPTH   16
+
+/*
+ * Internal write cycle time of the EEPROM (tWR) in micro seconds, from the datasheet
+ */
+#define WRITE_CYCLE_TIME_US   5000
+
+/*
+ * Interval between two ACK polls once tWR has elapsed, in micro seconds
+ */
+#define ACK_POLL_INTERVAL_US   100
+
+/*
+ * Time after which a write cycle is considered as stuck, in milli seconds
+ */
+#define WRITE_CYCLE_TIMEOUT_MS   20
+
+/*
+ * Default number of bytes read in one sequential read transfer, the complete EEPROM
+ */
+#define READ_CHUNK_SIZE   MAX_EEPROMSIZE
+
+/*
+ * Write data is kept in page frames with room for the address bytes in
+ * front of the payload, so a page goes to the bus without being copied.
+ * Frames preallocated per chip by default.
+ */
+#define FRAME_HEADER   2
+#define FRAMESIZE(d)   (FRAME_HEADER + (d)->PageSize)
+#define POOL_FRAMES    1024
+
+/*
+ * Read-ahead of a file read sequentially, in pages. The window starts
+ * small and doubles every time one is read completely, up to the
+ * readahead_pages module parameter.
+ */
+#define READAHEAD_MIN     2
+#define READAHEAD_PAGES   16
+
+/*
+ * Pages a write or an erase writes before the work function looks for
+ * high priority reads again
+ */
+#define CHUNK_PAGES   4
+
+/*
+ * Failed transfers a request may repeat before it is given up, and the
+ * back off between two tries of the same transfer. The back off starts
+ * at RETRY_BACKOFF_US and doubles with every failure up to
+ * RETRY_BACKOFF_MAX_US.
+ */
+#define RETRY_BUDGET           16
+#define RETRY_BACKOFF_US       200
+#define RETRY_BACKOFF_MAX_US   20000
+/*
+ * Checksum manifest kept in the last pages of a chip with
+ * persist_manifest=1
+ */
+#define MANIFEST_MAGIC   0x4D433249
+
+/*
+ * Buckets of the latency histograms. Bucket n counts the latencies from
+ * 2^(n-1) up to 2^n - 1 micro seconds, the last one everything longer.
+ */
+#define HIST_BUCKETS   24
 /*
  * Macros required to identify requests in ioctl
  */
@@ -93,6 +195,47 @@
 #define FLASHGETP   1
 #define FLASHSETP   2
 #define FLASHERASE  3
+/*
+ * The commands after the first four are given the usual way round,
+ * ioctl(fd, FLASHCACHE, CACHEINVALIDATE), with numbers of their own so
+ * that no argument can be taken for a command of the VFS (FIGETBSZ is 2,
+ * FIONBIO 0x5421). FLASHDIGEST takes a pointer to a u32 holding the
+ * range of pages on entry and the whole 32 bit digest on return.
+ */
+#define FLASHMAGIC       'F'
+#define FLASHERASERANGE  _IO(FLASHMAGIC,4)
+#define FLASHCACHE       _IO(FLASHMAGIC,5)
+#define FLASHWAIT        _IO(FLASHMAGIC,6)
+#define FLASHGETID       _IO(FLASHMAGIC,7)
+#define FLASHREADAHEAD   _IO(FLASHMAGIC,8)
+#define FLASHPRIORITY    _IO(FLASHMAGIC,9)
+#define FLASHDEADLINE    _IO(FLASHMAGIC,10)
+#define FLASHRETRIES     _IO(FLASHMAGIC,11)
+#define FLASHCANCEL      _IO(FLASHMAGIC,12)
+#define FLASHPROGRESS    _IO(FLASHMAGIC,13)
+#define FLASHDIGEST      _IOWR(FLASHMAGIC,14,__u32)
+#define FLASHVERIFY      _IO(FLASHMAGIC,15)
+#define FLASHPAGESIZE    _IO(FLASHMAGIC,16)
+
+/*
+ * Arguments of FLASHPRIORITY
+ */
+#define PRIORITYNORMAL   0
+#define PRIORITYHIGH     1
+
+/*
+ * Arguments of FLASHCACHE
+ */
+#define CACHEDISABLE      0
+#define CACHEENABLE       1
+#define CACHEINVALIDATE   2
+
+/*
+ * FLASHERASERANGE takes the first page in the lower 16 bits and the
+ * number of pages in the upper 16 bits of its argument
+ */
+#define ERASERANGESTART(x)   ((x) & 0xFFFF)
+#define ERASERANGECOUNT(x)   ((x) >> 16)
 
 /*
  * Please uncomment this when debugging, this will print the
@@ -101,34 +244,56 @@
 //#define DEBUG
 
 /*
- * Macro to get page number
+ * Macro to get page number, the page size of a chip is a power of two
  */
-#define PAGENO(x)  (x >> 6)
+#define PAGENO(d,x)  ((x) >> (d)->PageShift)
 
 /*
  * Macro to get offset
  */
-#define OFFSET(x)  (x & 0x3F)
-
-/*
- * Marcro to reverse the bytes
- */
-#define REVERSEBYTES(x)   ((x >> 8) | (x << 8))
+#define OFFSET(d,x)  ((x) & ((d)->PageSize - 1))
 
 /*
  * Macro to join Page number and offset
  */
-#define JOIN(x,y)   ((x << 6) | (y))
+#define JOIN(d,x,y)   (((x) << (d)->PageShift) | (y))
 
 /* uint8 and unsigned char are used interchangeably in the program */
 typedef unsigned char uint8;
 
-typedef struct I2cFlashDevTag
+/*
+ * Parts of the 24xx family known to the driver, index in the geometry table
+ */
+typedef enum I2cFlashPartTag
 {
-	struct cdev cdev; /* cdev structure */
-	char name[DEVICE_NAME_LENGTH];   /* Driver Name */
-	unsigned char Page[PAGESIZE]; /* Page to be written or read */
-}I2cFlashDevType;
+	PART_24LC01,
+	PART_24LC02,
+	PART_24LC04,
+	PART_24LC08,
+	PART_24LC16,
+	PART_24LC32,
+	PART_24LC64,
+	PART_24LC128,
+	PART_24LC256,
+	PART_24FC256,
+	PART_24LC512,
+	PART_24FC1025
+}I2cFlashPartType;
+
+/*
+ * Geometry of one part. Sizes are given as shifts so that the hot path
+ * only shifts and masks.
+ */
+typedef struct I2cFlashGeometryTag
+{
+	const char *Name; /* name of the part, also its i2c device id */
+	unsigned char PageShift; /* log2 of the page size, the most bytes of one write transaction */
+	unsigned char SizeShift; /* log2 of the capacity in bytes */
+	unsigned char AddressBytes; /* byte address sent MSB first after the chip address, 1 or 2 */
+	unsigned char BlockSelectBits; /* address bits above the address bytes, carried in the chip address */
+	unsigned char BlockSelectShift; /* position of those bits in the 7 bit chip address */
+	unsigned int WriteCycleUs; /* internal write cycle time (tWR) */
+}I2cFlashGeometryType;
 
 
 /*
@@ -144,172 +309,467 @@ typedef enum I2cFlashReadOrWrite_Tag
 }
 I2cFlashReadOrWriteType;
 
+/*
+ * Descriptor of one read/write/erase request waiting in the ring buffer
+ */
+typedef struct I2cFlashRequestTag
+{
+	I2cFlashReadOrWriteType I2cFlashRequestState; /* operation requested, DATAREADY/NONE once done */
+	char* I2cFlashRequestBufferPtr; /* pointer to buffer to read/write */
+	unsigned int I2cFlashRequestAddress; /* first byte of the EEPROM touched by this request */
+	unsigned int I2cFlashRequestLength; /* number of bytes to read/write/erase */
+	unsigned long I2cFlashRequestId; /* sequence number of the request */
+	struct I2cFlashFileTag *I2cFlashRequestOwner; /* file waiting for the read data, NULL if none */
+	unsigned long I2cFlashRequestShadowGeneration; /* generation of the image when a read was queued */
+	struct completion *I2cFlashRequestDone; /* completed when a kernel caller waits for the request */
+	struct kiocb *I2cFlashRequestIocb; /* asynchronous read_iter/write_iter completed by the work function, NULL if none */
+	struct iov_iter I2cFlashRequestIter; /* user buffers of an asynchronous read */
+	const void *I2cFlashRequestIovCopy; /* copy of the iovec array of the iterator, NULL if none */
+	struct mm_struct *I2cFlashRequestMm; /* address space of the user buffers of an asynchronous read */
+	DECLARE_BITMAP(I2cFlashRequestUnchanged, MAX_PAGECOUNT); /* pages of a write which already hold its data */
+	struct I2cFlashDevTag *I2cFlashRequestPool; /* chip whose pool gave the descriptor or the frames, NULL if none */
+	unsigned char I2cFlashRequestPooled; /* the descriptor itself belongs to the pool */
+	char *I2cFlashRequestFrames; /* page frames holding the write data, NULL if the data is in the buffer */
+	unsigned int I2cFlashRequestFrameIndex; /* first frame taken from the pool */
+	unsigned int I2cFlashRequestFrameCount; /* frames taken from the pool, one per page */
+	unsigned char I2cFlashRequestStale; /* read-ahead window overwritten by a later write or erase */
+	unsigned char I2cFlashRequestReserved; /* takes the slot set aside for it by I2cFlashReserveSlot */
+	unsigned char I2cFlashRequestPriority; /* PRIORITYHIGH for a read which may go before writes and erases */
+	unsigned int I2cFlashRequestProgress; /* bytes done, a write or erase resumes from here, a failed request stopped here */
+	unsigned long I2cFlashRequestPagesDone; /* pages written so far by a write or erase */
+	ktime_t I2cFlashRequestStartTime; /* when the first chunk of a write or erase started */
+	struct I2cFlashFileTag *I2cFlashRequestFile; /* file which queued the request, for cancel and errors, NULL if none */
+	ktime_t I2cFlashRequestDeadline; /* time after which the request fails with -ETIMEDOUT, 0 for none */
+	unsigned int I2cFlashRequestRetries; /* failed transfers the request may still repeat */
+	unsigned char I2cFlashRequestCancelled; /* set by FLASHCANCEL, the work function stops before the next transfer */
+	int I2cFlashRequestStatus; /* 0, or why the request stopped before its last byte */
+}I2cFlashRequestType;
+
+/*
+ * Per open file data, stored in the private data of the file pointer
+ */
+typedef struct I2cFlashFileTag
+{
+	struct I2cFlashDevTag *I2cFlashFileDev; /* device which is opened */
+	I2cFlashRequestType *I2cFlashFileReadRequest; /* read request submitted by this file */
+	unsigned long I2cFlashFileLastRequestId; /* id of the last request queued by this file */
+	loff_t I2cFlashFileNextOffset; /* where the last read ended, a read starting here is sequential */
+	I2cFlashRequestType *I2cFlashFileReadAhead; /* read-ahead window being read from, NULL if none */
+	I2cFlashRequestType *I2cFlashFileReadAheadNext; /* window right behind it, fetched in the background */
+	unsigned int I2cFlashFileReadAheadPages; /* pages of the next window to be fetched */
+	unsigned char I2cFlashFileReadAheadLate; /* the reader had to wait for the window being read */
+	struct list_head I2cFlashFileNode; /* entry in the open files of the chip */
+	unsigned char I2cFlashFilePriority; /* priority of the reads of this file, set with FLASHPRIORITY */
+	unsigned int I2cFlashFileDeadlineMs; /* deadline of every request of this file, 0 for none, set with FLASHDEADLINE */
+	unsigned int I2cFlashFileRetries; /* retry budget of every request of this file, set with FLASHRETRIES */
+	int I2cFlashFileError; /* error of a write or erase of this file not reported yet, under the ring lock */
+	unsigned long I2cFlashFileFirstErrorId; /* id of the request I2cFlashFileError comes from */
+	unsigned long I2cFlashFileErrorId; /* id of the last failed request of this file */
+	int I2cFlashFileErrorStatus; /* status of that request */
+	unsigned int I2cFlashFileErrorProgress; /* bytes that request got done, given by FLASHPROGRESS */
+}I2cFlashFileType;
+
 /*
  * Global structure used for signaling between workqueue and Read/Write functions
  */
 typedef struct I2cFlashWorkQueuePrivateTag
 {
-	I2cFlashReadOrWriteType I2cFlashReadOrWrite; /* Enum having different states */
-	char* I2cFlashWorkQueueBufferPtr; /* pointer to buffer to read/write */
-	unsigned long I2cFlashWorkQueuePageCount; /* number of pages requested for read/write */
+	I2cFlashReadOrWriteType I2cFlashReadOrWrite; /* Operation being executed, NONE when the queue is drained */
+	I2cFlashRequestType **I2cFlashRequestRing; /* ring buffer of pending requests */
+	unsigned int I2cFlashRingDepth; /* number of slots in the ring buffer */
+	unsigned int I2cFlashRingReadIndex; /* next request to be executed */
+	unsigned int I2cFlashRingWriteIndex; /* next free slot */
+	unsigned int I2cFlashRingCount; /* number of requests queued, in both ring buffers */
+	unsigned int I2cFlashRingReserved; /* slots set aside for the parts of a striped request, not queued yet */
+	I2cFlashRequestType **I2cFlashPriorityRing; /* high priority reads, executed before the ring buffer */
+	unsigned int I2cFlashPriorityReadIndex; /* next high priority read to be executed */
+	unsigned int I2cFlashPriorityWriteIndex; /* next free slot of the priority ring */
+	unsigned int I2cFlashPriorityCount; /* high priority reads queued, part of I2cFlashRingCount */
+	I2cFlashRequestType *I2cFlashLongRequest; /* write or erase being executed chunk by chunk, NULL if none */
+	I2cFlashRequestType *I2cFlashActiveRequest; /* request taken by the work function and not completed, NULL if none */
+	unsigned long I2cFlashLastRequestId; /* id given to the last submitted request */
+	unsigned long I2cFlashLastCompletedId; /* every request up to this id has been executed */
+	unsigned int I2cFlashRingMaxCount; /* most requests seen in the ring buffer, for debugfs */
+	spinlock_t I2cFlashRingLock; /* protects the ring buffer */
+	wait_queue_head_t I2cFlashWaitQueue; /* woken up every time a request is executed */
 }I2cFlashWorkQueuePrivateType;
 
 
 /*
- * Device pointer which stores the upper layer device structure
+ * Counters of the bus activity, updated by the work function only
+ */
+typedef struct I2cFlashStatsTag
+{
+	unsigned long I2cFlashBytesRead; /* bytes read from the EEPROM */
+	unsigned long I2cFlashBytesWritten; /* bytes written or erased */
+	unsigned long I2cFlashPagesWritten; /* page write transactions, each costs a write cycle */
+	unsigned long I2cFlashBusTransactions; /* every i2c message sent on the bus, including ACK polls */
+	unsigned long I2cFlashAckPolls; /* ACK polls done while waiting for a write cycle */
+	unsigned long I2cFlashWriteCycleTimeouts; /* write cycles which did not finish in time */
+	unsigned long long I2cFlashWorkerCpuNs; /* cpu time consumed by the work function */
+	unsigned long long I2cFlashReadNs; /* time spent in read requests */
+	unsigned long I2cFlashErasePagesSkipped; /* blank pages not rewritten by erase */
+	unsigned long I2cFlashLastErasePagesErased; /* pages rewritten by the last erase */
+	unsigned long I2cFlashLastErasePagesSkipped; /* blank pages skipped by the last erase */
+	unsigned long long I2cFlashLastEraseUs; /* duration of the last erase */
+	unsigned long I2cFlashCacheHits; /* read requests served from the shadow image */
+	unsigned long I2cFlashCacheMisses; /* read requests sent to the EEPROM */
+	unsigned long I2cFlashWritePagesSkipped; /* pages not written since they already held the data */
+	unsigned long I2cFlashLastWritePagesWritten; /* pages written by the last write request */
+	unsigned long I2cFlashLastWritePagesSkipped; /* pages skipped by the last write request */
+}I2cFlashStatsType;
+
+/*
+ * Latency histograms kept per chip
+ */
+typedef enum I2cFlashHistTag
+{
+	HIST_READ, /* execution of a read request */
+	HIST_WRITE, /* execution of a write request */
+	HIST_ERASE, /* execution of an erase request */
+	HIST_WRITE_CYCLE, /* wait for the EEPROM to finish a write cycle */
+	HIST_COUNT
+}I2cFlashHistType;
+
+/*
+ * Always on counters and histograms, one copy per cpu so that the submit
+ * path and the worker never share a cache line. Exposed through debugfs.
+ */
+typedef struct I2cFlashPcpuStatsTag
+{
+	unsigned long PagesRead; /* pages touched by read requests sent to the EEPROM */
+	unsigned long PagesWritten; /* pages written by write requests */
+	unsigned long PagesErased; /* pages written by erase requests */
+	unsigned long Nacks; /* transfers not acknowledged by the EEPROM */
+	unsigned long BusErrors; /* transfers failed for another reason */
+	unsigned long Retries; /* pages read or written once more after a failed transfer */
+	unsigned long Submitted; /* requests queued */
+	unsigned long EbusyRejections; /* requests refused since the queue was full */
+	unsigned long BytesQueued; /* bytes of write requests queued */
+	unsigned long Allocations; /* descriptors and buffers of write and erase requests allocated with kmalloc */
+	unsigned long BytesCopied; /* bytes of write data copied on the way to the bus */
+	unsigned long ReadAheadHits; /* sequential reads served from a window which was ready */
+	unsigned long ReadAheadLate; /* sequential reads served from a window still being fetched */
+	unsigned long ReadAheadMisses; /* sequential reads which went to the queue */
+	unsigned long ReadAheadBytes; /* bytes fetched ahead */
+	unsigned long ReadAheadWasted; /* bytes fetched ahead and never read */
+	unsigned long PriorityReads; /* high priority reads queued ahead of the writes and erases */
+	unsigned long PriorityDeferred; /* high priority reads kept in order since they overlap a pending write */
+	unsigned long Preemptions; /* writes and erases paused between two chunks for high priority reads */
+	unsigned long Timeouts; /* requests failed since their deadline passed */
+	unsigned long Cancellations; /* requests cancelled with FLASHCANCEL */
+	unsigned long Failures; /* requests failed once their retry budget was used up */
+	unsigned long Latency[HIST_COUNT][HIST_BUCKETS]; /* latency histograms in micro seconds */
+}I2cFlashPcpuStatsType;
+
+/*
+ * Header of the manifest stored in the last pages of a chip, followed by
+ * the CRC32C of every page, little endian
+ */
+typedef struct I2cFlashManifestHeaderTag
+{
+	__le32 Magic; /* MANIFEST_MAGIC */
+	__le16 PageCount; /* pages covered, the pages of the device node */
+	unsigned char Clean; /* 1 if stored when the chip was removed, 0 once a probe has used it */
+	unsigned char Unused;
+	__le32 TableCrc; /* CRC32C of the table, the digest of the whole chip */
+}I2cFlashManifestHeaderType;
+
+/*
+ * Everything belonging to one EEPROM chip
+ */
+typedef struct I2cFlashDevTag
+{
+	struct cdev cdev; /* cdev structure */
+	char name[DEVICE_NAME_LENGTH];   /* Driver Name */
+	const I2cFlashGeometryType *Geometry; /* part of the chip */
+	unsigned int PageShift; /* log2 of the page size, copied from the geometry */
+	unsigned int PageSize; /* bytes of a page, the most bytes of one write transaction */
+	unsigned int PageCount; /* pages of the chip */
+	unsigned int Size; /* bytes of the chip */
+	unsigned int BlockShift; /* log2 of the bytes reached by the address bytes */
+	unsigned char *Shadow; /* write through image of the EEPROM, NULL if not allocated */
+	DECLARE_BITMAP(ShadowValid, MAX_PAGECOUNT); /* pages of the image which match the EEPROM */
+	unsigned long ShadowGeneration; /* incremented by every write/erase/invalidate of the image */
+	unsigned char ShadowEnable; /* reads are served from the image when set */
+	unsigned char *MmapImage; /* image mapped to the user by mmap, NULL until the first mmap */
+	unsigned char *MmapReference; /* EEPROM data as last read/written, to find pages dirtied through the mapping */
+	DECLARE_BITMAP(MmapLoaded, (PAGE_ALIGN(MAX_EEPROMSIZE) >> PAGE_SHIFT)); /* kernel pages of the image faulted in */
+	struct mutex MmapLock; /* serializes fault-in and write back of the mapped image */
+	struct i2c_client *Client; /* the EEPROM chip */
+	unsigned int Minor; /* minor number of the device node */
+	struct device *Device; /* device node, carries the stats attribute */
+	I2cFlashWorkQueuePrivateType Queue; /* request queue of the chip */
+	struct workqueue_struct *WorkQueue; /* worker of the chip, the only context which uses its bus */
+	struct work_struct Work; /* drains the request queue */
+	struct list_head Files; /* open files, under the ring lock, for invalidating their read-ahead windows */
+	struct mutex BusLock; /* only one context drains the ring buffer at a time */
+	unsigned char WriteCyclePending; /* set when a page was written and the EEPROM may still be in its write cycle */
+	ktime_t WriteCycleStart; /* time at which the last page write was accepted by the EEPROM */
+	unsigned int WriteCyclePage; /* page of the last page write, for the tracepoints */
+	unsigned long ActiveRequestId; /* request executed by the work function, 0 if none, for the tracepoints */
+	DECLARE_BITMAP(DirtyPages, MAX_PAGECOUNT); /* pages holding data other than 0xFF, for erase */
+	u32 PageCrc[MAX_PAGECOUNT]; /* CRC32C of every page, in the order of submission like the shadow image */
+	DECLARE_BITMAP(CrcKnown, MAX_PAGECOUNT); /* pages whose CRC is known */
+	DECLARE_BITMAP(CrcSuspect, MAX_PAGECOUNT); /* pages the EEPROM may not hold as their CRC says, read back by FLASHVERIFY */
+	u32 BlankCrc; /* CRC of an erased page */
+	unsigned int ManifestPage; /* first page keeping the manifest, after the pages of the device node */
+	unsigned int ManifestPages; /* pages keeping the manifest, 0 if it is not persisted */
+	I2cFlashStatsType Stats; /* bus statistics exposed through sysfs */
+	I2cFlashPcpuStatsType __percpu *PcpuStats; /* counters and histograms exposed through debugfs */
+	struct dentry *DebugDir; /* debugfs directory of the chip */
+	spinlock_t PoolLock; /* protects the pool below */
+	char *PoolFrames; /* page frames of write requests, FRAMESIZE bytes each */
+	unsigned long *PoolFrameMap; /* frames in use */
+	unsigned int PoolFrameCount; /* frames in the pool */
+	I2cFlashRequestType *PoolRequests; /* preallocated request descriptors, one per slot of the queue */
+	I2cFlashRequestType **PoolFree; /* stack of the free descriptors */
+	unsigned int PoolFreeCount; /* descriptors on the stack */
+	unsigned char BlankFrame[FRAME_HEADER + MAX_PAGESIZE]; /* frame of an erased page, used by erase */
+}I2cFlashDevType;
+
+/*
+ * Striped view of several chips, logical page n is page n / Width of
+ * chip n % Width, like RAID-0 with one EEPROM page per stripe unit
+ */
+typedef struct I2cFlashStripeTag
+{
+	struct cdev cdev; /* cdev structure */
+	char name[DEVICE_NAME_LENGTH]; /* Driver Name */
+	unsigned int Width; /* number of chips the pages are spread over */
+	I2cFlashDevType *Chips[NUMBER_OF_DEVICES]; /* chip of each column */
+}I2cFlashStripeType;
+
+/*
+ * Per open file data of the striped device
  */
-static I2cFlashDevType *I2cFlashDevMem = NULL;
+typedef struct I2cFlashStripeFileTag
+{
+	I2cFlashStripeType *Stripe; /* striped device which is opened */
+	I2cFlashFileType ChipFile[NUMBER_OF_DEVICES]; /* last request queued to each chip, for FLASHWAIT, and its pending read part */
+	loff_t PendingOffset; /* offset of the pending read */
+	size_t PendingCount; /* bytes of the pending read, 0 if none */
+}I2cFlashStripeFileType;
+
 /*
- * Read or write pointer for the EEPROM
+ * Tracepoints of the request lifecycle, the types above are used by the
+ * events
  */
-static unsigned short I2cFlashEepromPtr = 0;
-/* Device number alloted */
+#define CREATE_TRACE_POINTS
+#include "i2c_flash_trace.h"
+
+/* Device numbers alloted, one minor per chip */
 static dev_t I2cFlashDevNumber;
 
 /* Create class and device which are required for udev */
 struct class *I2cFlashDevClass;
-static struct device *I2cFlashDevName;
 
 /*
- * This will point to local kmalloc structure
+ * Minor numbers in use, taken by probe
  */
-static struct i2c_client *I2cFlashClient = NULL;
+static DECLARE_BITMAP(I2cFlashMinors, NUMBER_OF_DEVICES);
+static DEFINE_MUTEX(I2cFlashMinorLock);
 
 /*
- * This will store the address of the client copy sent by the core,used later for deleting the device
+ * Clients created by this module, used later for deleting the devices
  */
-static struct i2c_client *I2cFlashClientDeviceInit = NULL;
+static struct i2c_client *I2cFlashClientDeviceInit[NUMBER_OF_DEVICES];
+
 /*
- * Device Ids to probe
+ * Chips handled by the module, address and adapter number of each
  */
-static struct i2c_device_id my_device_id[] = {{"i2c_flash",0}};
+static unsigned short I2cFlashChipAddress[NUMBER_OF_DEVICES] = {CHIP_ADDRESS};
+static int I2cFlashChipCount = 1;
+module_param_array_named(chips, I2cFlashChipAddress, ushort, &I2cFlashChipCount, S_IRUGO);
+MODULE_PARM_DESC(chips, "Addresses of the EEPROM chips, up to 8 (default 0x54)");
+static int I2cFlashChipAdapter[NUMBER_OF_DEVICES];
+static int I2cFlashChipAdapterCount = 0;
+module_param_array_named(adapters, I2cFlashChipAdapter, int, &I2cFlashChipAdapterCount, S_IRUGO);
+MODULE_PARM_DESC(adapters, "I2C adapter number of each chip (default 0)");
 
 /*
- * WorkQueue Data
+ * Striped device over the first chips, NULL if not created
  */
-#ifdef NON_BLOCKING
-struct workqueue_struct *I2cFlashWorkQueue;
-#endif
-struct work_struct I2cFlashWork;
-static I2cFlashWorkQueuePrivateType I2cFlashWorkQueuePrivate = {NONE,NULL,0};
+static I2cFlashStripeType *I2cFlashStripe = NULL;
+static unsigned int I2cFlashStripeWidth = 0;
+module_param_named(stripe, I2cFlashStripeWidth, uint, S_IRUGO);
+MODULE_PARM_DESC(stripe, "Number of chips interleaved page by page in /dev/i2c_flash_stripe, 0 for none (default 0)");
+/*
+ * Geometry of the parts, from the datasheets
+ */
+static const I2cFlashGeometryType I2cFlashGeometries[] = {
+	/* Name        PageShift SizeShift AddressBytes BlockSelectBits BlockSelectShift WriteCycleUs */
+	[PART_24LC01]   = {"24lc01",   3,  7, 1, 0, 0, WRITE_CYCLE_TIME_US},
+	[PART_24LC02]   = {"24lc02",   3,  8, 1, 0, 0, WRITE_CYCLE_TIME_US},
+	[PART_24LC04]   = {"24lc04",   4,  9, 1, 1, 0, WRITE_CYCLE_TIME_US},
+	[PART_24LC08]   = {"24lc08",   4, 10, 1, 2, 0, WRITE_CYCLE_TIME_US},
+	[PART_24LC16]   = {"24lc16",   4, 11, 1, 3, 0, WRITE_CYCLE_TIME_US},
+	[PART_24LC32]   = {"24lc32",   5, 12, 2, 0, 0, WRITE_CYCLE_TIME_US},
+	[PART_24LC64]   = {"24lc64",   5, 13, 2, 0, 0, WRITE_CYCLE_TIME_US},
+	[PART_24LC128]  = {"24lc128",  6, 14, 2, 0, 0, WRITE_CYCLE_TIME_US},
+	[PART_24LC256]  = {"24lc256",  6, 15, 2, 0, 0, WRITE_CYCLE_TIME_US},
+	[PART_24FC256]  = {"24fc256",  6, 15, 2, 0, 0, WRITE_CYCLE_TIME_US},
+	[PART_24LC512]  = {"24lc512",  7, 16, 2, 0, 0, WRITE_CYCLE_TIME_US},
+	[PART_24FC1025] = {"24fc1025", 7, 17, 2, 1, 2, WRITE_CYCLE_TIME_US},
+};
+
+/*
+ * Device Ids to probe, the driver data is the part. "i2c_flash" is the
+ * 24FC256 of the Galileo board.
+ */
+static struct i2c_device_id my_device_id[] = {
+	{"i2c_flash", PART_24FC256},
+	{"24lc01", PART_24LC01},
+	{"24lc02", PART_24LC02},
+	{"24lc04", PART_24LC04},
+	{"24lc08", PART_24LC08},
+	{"24lc16", PART_24LC16},
+	{"24lc32", PART_24LC32},
+	{"24lc64", PART_24LC64},
+	{"24lc128", PART_24LC128},
+	{"24lc256", PART_24LC256},
+	{"24fc256", PART_24FC256},
+	{"24lc512", PART_24LC512},
+	{"24fc1025", PART_24FC1025},
+	{}
+};
+MODULE_DEVICE_TABLE(i2c, my_device_id);
+
+/*
+ * Device tree compatible strings, the data is the geometry
+ */
+static const struct of_device_id I2cFlashOfMatch[] = {
+	{ .compatible = "microchip,24lc01", .data = &I2cFlashGeometries[PART_24LC01] },
+	{ .compatible = "microchip,24lc02", .data = &I2cFlashGeometries[PART_24LC02] },
+	{ .compatible = "microchip,24lc04", .data = &I2cFlashGeometries[PART_24LC04] },
+	{ .compatible = "microchip,24lc08", .data = &I2cFlashGeometries[PART_24LC08] },
+	{ .compatible = "microchip,24lc16", .data = &I2cFlashGeometries[PART_24LC16] },
+	{ .compatible = "microchip,24lc32", .data = &I2cFlashGeometries[PART_24LC32] },
+	{ .compatible = "microchip,24lc64", .data = &I2cFlashGeometries[PART_24LC64] },
+	{ .compatible = "microchip,24lc128", .data = &I2cFlashGeometries[PART_24LC128] },
+	{ .compatible = "microchip,24lc256", .data = &I2cFlashGeometries[PART_24LC256] },
+	{ .compatible = "microchip,24fc256", .data = &I2cFlashGeometries[PART_24FC256] },
+	{ .compatible = "microchip,24lc512", .data = &I2cFlashGeometries[PART_24LC512] },
+	{ .compatible = "microchip,24fc1025", .data = &I2cFlashGeometries[PART_24FC1025] },
+	{}
+};
+MODULE_DEVICE_TABLE(of, I2cFlashOfMatch);
+
+/*
+ * Part of each chip created by the module, a device id of my_device_id
+ */
+static char *I2cFlashChipPart[NUMBER_OF_DEVICES];
+static int I2cFlashChipPartCount = 0;
+module_param_array_named(parts, I2cFlashChipPart, charp, &I2cFlashChipPartCount, S_IRUGO);
+MODULE_PARM_DESC(parts, "Part of each chip, e.g. 24fc256, 24lc512 or 24fc1025 (default 24fc256)");
+
+/*
+ * Number of requests that can wait in the ring buffer
+ */
+static unsigned int I2cFlashQueueDepth = QUEUE_DEPTH;
+module_param_named(queue_depth, I2cFlashQueueDepth, uint, S_IRUGO);
+MODULE_PARM_DESC(queue_depth, "Number of read/write/erase requests that can be queued");
+
+/*
+ * Write cycle handling. When ACK polling is disabled, the next transfer is
+ * simply retried until the EEPROM accepts it.
+ */
+static unsigned int I2cFlashAckPollEnable = 1;
+module_param_named(ack_poll, I2cFlashAckPollEnable, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(ack_poll, "Wait for the write cycle with ACK polling (1) or retry the next transfer blindly (0)");
+static unsigned int I2cFlashWriteCycleUs = 0;
+module_param_named(write_cycle_us, I2cFlashWriteCycleUs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(write_cycle_us, "Time slept after a page write before the first ACK poll, 0 for tWR of the part (default 0)");
+static unsigned int I2cFlashAckPollIntervalUs = ACK_POLL_INTERVAL_US;
+module_param_named(poll_interval_us, I2cFlashAckPollIntervalUs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(poll_interval_us, "Interval between two ACK polls");
+static unsigned int I2cFlashWriteCycleTimeoutMs = WRITE_CYCLE_TIMEOUT_MS;
+module_param_named(write_timeout_ms, I2cFlashWriteCycleTimeoutMs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(write_timeout_ms, "Time after which a write cycle is given up");
+/*
+ * Bytes read in one sequential read transfer, limited by the adapter
+ */
+static unsigned int I2cFlashReadChunk = READ_CHUNK_SIZE;
+module_param_named(read_chunk, I2cFlashReadChunk, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(read_chunk, "Bytes read in one transfer, from one page up to the complete EEPROM");
+/*
+ * Shadow image of the EEPROM used for reads
+ */
+static unsigned int I2cFlashCacheEnable = 1;
+module_param_named(cache, I2cFlashCacheEnable, uint, S_IRUGO);
+MODULE_PARM_DESC(cache, "Serve reads from an in memory image of the EEPROM (1) or always from the bus (0)");
+/*
+ * Write deduplication, pages which already hold the data are not written
+ */
+static unsigned int I2cFlashDedupMode = 1;
+module_param_named(dedup, I2cFlashDedupMode, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(dedup, "Write every page (0), skip pages equal to the shadow image (1), also read back and compare the other pages (2)");
+/*
+ * Page frames preallocated per chip for the data of write requests
+ */
+static unsigned int I2cFlashPoolFrames = POOL_FRAMES;
+module_param_named(pool_frames, I2cFlashPoolFrames, uint, S_IRUGO);
+MODULE_PARM_DESC(pool_frames, "Page frames preallocated per chip for write data, 0 to allocate every write (default 1024)");
+/*
+ * Largest read-ahead window of a file read sequentially
+ */
+static unsigned int I2cFlashReadAheadPages = READAHEAD_PAGES;
+module_param_named(readahead_pages, I2cFlashReadAheadPages, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(readahead_pages, "Most pages fetched ahead of a file read sequentially, 0 for no read-ahead (default 16)");
+/*
+ * Pages of a write or an erase between two looks at the high priority reads
+ */
+static unsigned int I2cFlashChunkPages = CHUNK_PAGES;
+module_param_named(chunk_pages, I2cFlashChunkPages, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(chunk_pages, "Pages a write or an erase writes before high priority reads can go first (default 4)");
+/*
+ * Defaults of the deadline and retry budget of the requests, and the back
+ * off between two tries of a failed transfer
+ */
+static unsigned int I2cFlashDeadlineMs = 0;
+module_param_named(deadline_ms, I2cFlashDeadlineMs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(deadline_ms, "Deadline of the requests of a newly opened file, 0 for none (default 0)");
+static unsigned int I2cFlashRetryBudget = RETRY_BUDGET;
+module_param_named(retries, I2cFlashRetryBudget, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(retries, "Failed transfers a request may repeat before it fails (default 16)");
+static unsigned int I2cFlashRetryBackoffUs = RETRY_BACKOFF_US;
+module_param_named(retry_backoff_us, I2cFlashRetryBackoffUs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(retry_backoff_us, "Sleep before the first retry of a transfer, doubled for every further one (default 200)");
+static unsigned int I2cFlashRetryBackoffMaxUs = RETRY_BACKOFF_MAX_US;
+module_param_named(retry_backoff_max_us, I2cFlashRetryBackoffMaxUs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(retry_backoff_max_us, "Longest sleep between two retries of a transfer (default 20000)");
+/*
+ * Checksum manifest stored in the last pages of every chip
+ */
+static unsigned int I2cFlashPersistManifest = 0;
+module_param_named(persist_manifest, I2cFlashPersistManifest, uint, S_IRUGO);
+MODULE_PARM_DESC(persist_manifest, "Keep the page CRCs in the last pages of the chip, hidden from the device node (default 0)");
 void I2cFlashWorkFunction(struct work_struct *work);
+static void I2cFlashScanBlankPages(I2cFlashDevType *Dev);
+static int I2cFlashCancelRequests(I2cFlashFileType *FilePrivate, unsigned int RequestId);
 
 /* *********************************************************************
  * NAME:             I2cFlashDetect
  * CALLED BY:        i2c-core
- * DESCRIPTION:      this is called if i2c core finds the device at the
- *                   time of installation of driver. 
+ * DESCRIPTION:      the chips are created by the module from the chips
+ *                   and adapters parameters, nothing is detected on the
+ *                   bus
  * INPUT PARAMETERS: Client pointer:pointer to the client tmp created by
  *                                  the i2c-core
  *                   Board info ptr:pointer to the board info
- * RETURN VALUES:    int : status - Fail/Pass(0)
+ * RETURN VALUES:    int : -ENODEV
  ***********************************************************************/
 int I2cFlashDetect(struct i2c_client *ReceivedClient, struct i2c_board_info *ReceivedBoardInfo)
 {
-#ifdef DEBUG
-	printk(KERN_INFO "\n I2cFlashDetect function called with client pointer %d\n",ReceivedClient);
-#endif
-    /* If this functions is called twice ,then it is detected by this check */
-	if (I2cFlashClient != NULL)
-	{
-		printk(KERN_INFO "\n I2cFlash finds two clients \n");
-		return -ENOMEM;
-	}
-	/* Client structure given by i2c-core is a temporary structure, so safely copying the entire structure */
-	I2cFlashClient = kzalloc(sizeof(struct i2c_client),GFP_KERNEL);
-	if (NULL != I2cFlashClient)
-	{
-		/* copying the entire structure to a i2c_flash copy of the client */
-	   memcpy(I2cFlashClient,ReceivedClient,sizeof(struct i2c_client));
-#ifdef DEBUG
-	   printk(KERN_INFO "\n client found by I2cFlashDetect : \n chip adddress = %d \n client.name = %s \n Board info addr = %d \n Board Name = %s\n",
-	          I2cFlashClient->addr,I2cFlashClient->name,ReceivedBoardInfo->addr,ReceivedBoardInfo->type);
-#endif
-	   return 0;
-    }
-    else
-    {
-		printk(KERN_INFO "\nI2cFlash client not allocated\n");
-		return -ENOMEM;
-	}
-}
-
-/* *********************************************************************
- * NAME:             I2cFlashProbe
- * CALLED BY:        i2c-core
- * DESCRIPTION:      this is called if i2c core finds the device at the
- *                   when device is added by this module. 
- * INPUT PARAMETERS: Client pointer:pointer to the client tmp created by
- *                                  the i2c-core
- *                   device id :received device id info
- * RETURN VALUES:    int : status - Fail/Pass(0)
- ***********************************************************************/
-int I2cFlashProbe(struct i2c_client *ReceivedClient, const struct i2c_device_id *ReceivedDeviceIdInfo)
-{
-#ifdef DEBUG
-    printk(KERN_INFO "\n I2cFlashProbe function called  %d\n",ReceivedClient);
-#endif
-    /* If this functions is called twice ,then it is detected by this check */
-	if (I2cFlashClient != NULL)
-	{
-		printk(KERN_INFO "\n I2cFlash probe not succeed, may be I2cFlash has laready detected the driver \n");
-		return -ENOMEM;
-	}
-	/* Client structure given by i2c-core is a temporary structure, so safely copying the entire structure */
-	I2cFlashClient = kzalloc(sizeof(struct i2c_client),GFP_KERNEL);
-	if (NULL != I2cFlashClient)
-	{
-	   /* copying the entire structure to a i2c_flash copy of the client */
-	   memcpy(I2cFlashClient,ReceivedClient,sizeof(struct i2c_client));
-#ifdef DEBUG
-	   printk(KERN_INFO "\n client found by I2cFlashProbe: \n chip adddress = %d \n client.name = %s \n Device id name = %s\n",
-	          I2cFlashClient->addr,I2cFlashClient->name,ReceivedDeviceIdInfo->name);
-#endif
-	   return 0;
-    }
-    else
-    {
-		printk(KERN_INFO "\nI2cFlash client not allocated\n");
-		return -ENOMEM;
-	}
-}
-
-/* *********************************************************************
- * NAME:             I2cFlashRemove
- * CALLED BY:        i2c-core
- * DESCRIPTION:      this is called if i2c core finds a device is 
- *                   is unregistered.
- * INPUT PARAMETERS: Client pointer:pointer to the client tmp created by
- *                                  the i2c-core
- * RETURN VALUES:    int : status - Fail/Pass(0)
- ***********************************************************************/
-int I2cFlashRemove(struct i2c_client *ReceivedClient)
-{
-#ifdef DEBUG
-	printk(KERN_INFO "\n I2cFlash client is being deleted \n");
-#endif
-    /* free the client memory allocated by our driver for this device */
-    kfree(I2cFlashClient);
-    I2cFlashClient = NULL;
-    return 0;
+	return -ENODEV;
 }
 
-/* This is the driver that will be inserted */
-static struct i2c_driver I2cFlashDriver = {
-	.id_table   = my_device_id,
-	.driver     = {
-	                .owner = THIS_MODULE,
-	                .name		= "i2c_flash"
-	             },
-	.probe = &I2cFlashProbe,
-	.remove = &I2cFlashRemove,
-	.detect = &I2cFlashDetect
-};
 /* *********************************************************************
  * NAME:             I2cFlashDriverOpen
  * CALLED BY:        User App through kernel
- * DESCRIPTION:      copies the device structure pointer to the private  
- *                   data of the file pointer. 
+ * DESCRIPTION:      allocates the per file data and stores it along with
+ *                   the device structure pointer in the private data of
+ *                   the file pointer. 
  * INPUT PARAMETERS: inode pointer:pointer to the inode of the caller
  *                   filept:file pointer used by this inode
  * RETURN VALUES:    int : status - Fail/Pass(0)
@@ -317,10 +777,27 @@ static struct i2c_driver I2cFlashDriver = {
 int I2cFlashDriverOpen(struct inode *inode, struct file *filept)
 {
 	I2cFlashDevType *dev; /* dev pointer for the present device */
+	I2cFlashFileType *FilePrivate; /* per file data */
 	/* to get the device specific structure from cdev pointer */
 	dev = container_of(inode->i_cdev, I2cFlashDevType, cdev);
+	FilePrivate = kzalloc(sizeof(I2cFlashFileType),GFP_KERNEL);
+	if (NULL == FilePrivate)
+	{
+		return -ENOMEM;
+	}
+	FilePrivate->I2cFlashFileDev = dev;
+	FilePrivate->I2cFlashFileReadRequest = NULL;
+	FilePrivate->I2cFlashFileLastRequestId = 0;
+	FilePrivate->I2cFlashFileReadAheadPages = READAHEAD_MIN;
+	FilePrivate->I2cFlashFileDeadlineMs = I2cFlashDeadlineMs;
+	FilePrivate->I2cFlashFileRetries = I2cFlashRetryBudget;
+	spin_lock(&dev->Queue.I2cFlashRingLock);
+	list_add(&FilePrivate->I2cFlashFileNode,&dev->Files);
+	spin_unlock(&dev->Queue.I2cFlashRingLock);
 	/* stored to private data so that next time filept can be directly used */
-	filept->private_data = dev;
+	filept->private_data = FilePrivate;
+	/* read_iter/write_iter only queue the request, io_uring need not punt them to a thread */
+	filept->f_mode |= FMODE_NOWAIT;
 #ifdef DEBUG
 	/* Print that device has opened succesfully */
 	printk("Device %s opened succesfully ! \n",(char *)&(dev->name));
@@ -332,425 +809,5124 @@ int I2cFlashDriverOpen(struct inode *inode, struct file *filept)
 }
 
 /* *********************************************************************
- * NAME:             I2cFlashDriverRelease
- * CALLED BY:        User App through kernel
- * DESCRIPTION:      Releases the file structure
- * INPUT PARAMETERS: inode pointer:pointer to the inode of the caller
- *                   filept:file pointer used by this inode
- * RETURN VALUES:    int : status - Fail/Pass(0)
+ * NAME:             I2cFlashFreeRequest
+ * CALLED BY:        I2cFlashWorkFunction, read function and release
+ * DESCRIPTION:      frees the request descriptor and its buffer
+ * INPUT PARAMETERS: Request : request to be freed
+ * RETURN VALUES:    None
  ***********************************************************************/
-int I2cFlashDriverRelease(struct inode *inode, struct file *filept)
+static void I2cFlashFreeRequest(I2cFlashRequestType *Request)
 {
-	I2cFlashDevType *dev = (I2cFlashDevType*)(filept->private_data);
-	printk("\n%s is closing\n", dev->name);
-	return 0;
+	I2cFlashDevType *Dev = Request->I2cFlashRequestPool; /* chip of the pool, NULL if nothing came from it */
+	kfree(Request->I2cFlashRequestIovCopy);
+	kfree(Request->I2cFlashRequestBufferPtr);
+	if (NULL != Dev)
+	{
+		spin_lock(&Dev->PoolLock);
+		if (NULL != Request->I2cFlashRequestFrames)
+		{
+			bitmap_clear(Dev->PoolFrameMap,Request->I2cFlashRequestFrameIndex,Request->I2cFlashRequestFrameCount);
+		}
+		if (Request->I2cFlashRequestPooled)
+		{
+			Dev->PoolFree[Dev->PoolFreeCount++] = Request;
+			spin_unlock(&Dev->PoolLock);
+			return;
+		}
+		spin_unlock(&Dev->PoolLock);
+	}
+	kfree(Request);
 }
 
 /* *********************************************************************
- * NAME:             I2cFlashWorkFunction
- * CALLED BY:        Kernel work queue
- * DESCRIPTION:      Function is used for non blocking implementation
- * INPUT PARAMETERS: work ptr: Pointer to the work structure
- * RETURN VALUES:    None
+ * NAME:             I2cFlashAllocRequest
+ * CALLED BY:        write, write_iter and ioctl functions
+ * DESCRIPTION:      gives a zeroed request descriptor for a write or an
+ *                   erase, from the pool of the chip while it lasts.
+ *                   The data of a write gets one page frame per page it
+ *                   touches, from the pool as well, or a plain buffer
+ *                   when the pool has no room.
+ * INPUT PARAMETERS: Address : first byte of the request
+ *                   Length : number of bytes
+ *                   WithData : 1 for a write, 0 for an erase
+ * RETURN VALUES:    I2cFlashRequestType * : NULL if out of memory
  ***********************************************************************/
-void I2cFlashWorkFunction(struct work_struct *work)
+static I2cFlashRequestType *I2cFlashAllocRequest(I2cFlashDevType *Dev, unsigned int Address, unsigned int Length, unsigned char WithData)
 {
-    unsigned short loopindex = 0; /* For loop */
-    int Status = 0; /* For storing read and write status */
-    unsigned short Address = REVERSEBYTES(JOIN(PAGENO(I2cFlashEepromPtr),0x00));/*this is bcoz MSB should be sent first*/
-    unsigned char TempMessage[PAGESIZE + 2] = {0};/* to store the address temporarily */
-    /* Check if READ was requested that resulted the work queue */
-    if (I2CFLASHREAD == I2cFlashWorkQueuePrivate.I2cFlashReadOrWrite)
-    {
-        /* Set the read ptr on the eeprom */
-        i2c_master_send(I2cFlashClient,(const char *)&Address,sizeof(Address));
-       /* Though 32K of data can be read in one shot, here page read is implemented so that kernel is not blocked for such a long time */
-#ifndef LED_DYNAMIC
-       gpio_set_value_cansleep(26,1);
-#endif
-       for (loopindex = 0; loopindex < I2cFlashWorkQueuePrivate.I2cFlashWorkQueuePageCount; loopindex++)
-       {
-	    	do
-		   {
-#ifdef DEBUG
-		      printk("\n Inside do while");
-#endif
-#ifdef LED_DYNAMIC
-              /* switch on led */
-              gpio_set_value_cansleep(26,1);
-#endif
-              /* Receive one page of data */
-		      Status = i2c_master_recv(I2cFlashClient,((I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr) + (loopindex * PAGESIZE)),PAGESIZE);
-		      /* Switch off led */
-#ifdef LED_DYNAMIC
-		      gpio_set_value_cansleep(26,0);
-#endif
-#ifdef DEBUG
-		      printk("\nRead status = %i",Status);
-#endif
-	       }while(PAGESIZE != Status);
-	   }
-#ifndef LED_DYNAMIC
-       gpio_set_value_cansleep(26,0);
-#endif
-	   /* incrment the pointer by 64 bytes, and wrap around if required */
-	   I2cFlashEepromPtr = (((PAGENO(I2cFlashEepromPtr)) + (I2cFlashWorkQueuePrivate.I2cFlashWorkQueuePageCount)) <= (PAGECOUNT-1)) ? (JOIN(((PAGENO(I2cFlashEepromPtr)) + (I2cFlashWorkQueuePrivate.I2cFlashWorkQueuePageCount)),(0x00))) : 
-	                                                (JOIN(((I2cFlashWorkQueuePrivate.I2cFlashWorkQueuePageCount)- ((PAGECOUNT-1) - (PAGENO(I2cFlashEepromPtr))) - (1)),0x00));
-	   /* Change the state to READ DATA READY state */
-	   I2cFlashWorkQueuePrivate.I2cFlashReadOrWrite = I2CFLASHDATAREADY;
+	I2cFlashRequestType *Request = NULL; /* new request */
+	unsigned int Frames = WithData ? (PAGENO(Dev,(Address + Length - 1)) - PAGENO(Dev,Address) + 1) : 0; /* frames needed */
+	unsigned long Index = 0; /* first free frame found */
+	spin_lock(&Dev->PoolLock);
+	if (0 != Dev->PoolFreeCount)
+	{
+		Request = Dev->PoolFree[--Dev->PoolFreeCount];
 	}
-	else if(I2CFLASHWRITE == I2cFlashWorkQueuePrivate.I2cFlashReadOrWrite)
+	spin_unlock(&Dev->PoolLock);
+	if (NULL != Request)
 	{
-#ifndef LED_DYNAMIC
-       gpio_set_value_cansleep(26,1);
-#endif
-       /* Join the address to the message */
-       for (loopindex = 0; loopindex < (I2cFlashWorkQueuePrivate.I2cFlashWorkQueuePageCount); loopindex++)
-       {
-	    	/* Prepare the message */
-            /* put the Address */
-            memcpy(&TempMessage[0],&Address,sizeof(Address));
-            memcpy(&TempMessage[2],(I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr + (loopindex * PAGESIZE)), PAGESIZE);
-		    do
-		    {
-#ifdef DEBUG
-		       printk("\n Inside do while");
-#endif
-#ifdef LED_DYNAMIC
-               gpio_set_value_cansleep(26,1);
-#endif
-               /* Send one page along with the adress pointer */
-		       Status = i2c_master_send(I2cFlashClient,(const char *)&TempMessage,sizeof(TempMessage));
-#ifdef LED_DYNAMIC
-		       gpio_set_value_cansleep(26,0);
-#endif
-#ifdef DEBUG
-		       printk("\nWrite status = %i",Status);
-#endif
-	        }while((PAGESIZE +2) != Status);
-	        /* incrment the pointer by 64 bytes, and wrap around if required */
-	        I2cFlashEepromPtr = (((PAGENO(I2cFlashEepromPtr)) + (1)) <= (PAGECOUNT-1)) ? (JOIN(((PAGENO(I2cFlashEepromPtr)) + (1)),(0x00))) : (JOIN(0x00,0x00));
-	        /* reverse the address bytes which is required for sending the next page write */
-	        Address = REVERSEBYTES(JOIN(PAGENO(I2cFlashEepromPtr),0x00));
-	    }
-#ifndef LED_DYNAMIC
-       gpio_set_value_cansleep(26,0);
-#endif
-	    /* Free up the memory which was allocated in the .write function */
-	    kfree(I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr);
-	    I2cFlashWorkQueuePrivate.I2cFlashWorkQueuePageCount = 0;
-	    I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr = NULL;
-	    /* Be the last lastment */
-	    I2cFlashWorkQueuePrivate.I2cFlashReadOrWrite = NONE;
-	}
-	else if(I2CFLASHERASE == I2cFlashWorkQueuePrivate.I2cFlashReadOrWrite)
-	{
-       /* bring up the write pointer to 0 */
-       I2cFlashEepromPtr = 0;
-       /* Below part of the code is similar to that of write procedure */
-       I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr = (unsigned char*)kmalloc((PAGESIZE + 2),GFP_KERNEL);
-       memset(I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr,0xFF,(PAGESIZE + 2));
-#ifndef LED_DYNAMIC
-       gpio_set_value_cansleep(26,1);
-#endif
-       /* Join the address to the message */
-       for (loopindex = 0; loopindex < PAGECOUNT; loopindex++)
-       {
-		   /* prepare the address */
-	       Address = REVERSEBYTES(JOIN(loopindex,0x00));
-	       /* Prepare the message */
-           /* put the Address */
-           memcpy(I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr,&Address,sizeof(Address));
-		   do
-		   {
+		memset(Request,0,sizeof(I2cFlashRequestType));
+		Request->I2cFlashRequestPooled = 1;
+		Request->I2cFlashRequestPool = Dev;
+	}
+	else
+	{
+		Request = kzalloc(sizeof(I2cFlashRequestType),GFP_KERNEL);
+		if (NULL == Request)
+		{
+			return NULL;
+		}
+		this_cpu_inc(Dev->PcpuStats->Allocations);
+	}
+	if (0 == Frames)
+	{
+		return Request;
+	}
+	spin_lock(&Dev->PoolLock);
+	Index = (0 != Dev->PoolFrameCount) ? bitmap_find_next_zero_area(Dev->PoolFrameMap,Dev->PoolFrameCount,0,Frames,0) : Dev->PoolFrameCount;
+	if (Index < Dev->PoolFrameCount)
+	{
+		bitmap_set(Dev->PoolFrameMap,Index,Frames);
+		Request->I2cFlashRequestFrames = Dev->PoolFrames + (Index * FRAMESIZE(Dev));
+		Request->I2cFlashRequestFrameIndex = Index;
+		Request->I2cFlashRequestFrameCount = Frames;
+		Request->I2cFlashRequestPool = Dev;
+	}
+	spin_unlock(&Dev->PoolLock);
+	if (NULL == Request->I2cFlashRequestFrames)
+	{
+		Request->I2cFlashRequestBufferPtr = (char*)kmalloc(Length,GFP_KERNEL);
+		if (NULL == Request->I2cFlashRequestBufferPtr)
+		{
+			I2cFlashFreeRequest(Request);
+			return NULL;
+		}
+		this_cpu_inc(Dev->PcpuStats->Allocations);
+	}
+	return Request;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashRequestData
+ * CALLED BY:        write procedures
+ * DESCRIPTION:      gives where a byte of a write request is kept. In a
+ *                   page frame the bytes sit at their offset in the page,
+ *                   so the bytes up to the end of the page follow it.
+ * INPUT PARAMETERS: Request : write request
+ *                   Offset : byte of the request
+ * RETURN VALUES:    char * : the byte
+ ***********************************************************************/
+static char *I2cFlashRequestData(I2cFlashDevType *Dev, I2cFlashRequestType *Request, unsigned int Offset)
+{
+	unsigned int EepromAddress = Request->I2cFlashRequestAddress + Offset; /* address of the byte */
+	if (NULL == Request->I2cFlashRequestFrames)
+	{
+		return Request->I2cFlashRequestBufferPtr + Offset;
+	}
+	return Request->I2cFlashRequestFrames + ((PAGENO(Dev,EepromAddress) - PAGENO(Dev,Request->I2cFlashRequestAddress)) * FRAMESIZE(Dev)) +
+	       FRAME_HEADER + OFFSET(Dev,EepromAddress);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashPagePart
+ * CALLED BY:        write procedures
+ * DESCRIPTION:      gives the bytes from an address up to the end of its
+ *                   page, at most Remaining
+ * INPUT PARAMETERS: EepromAddress : first byte
+ *                   Remaining : bytes left in the request
+ * RETURN VALUES:    unsigned int : number of bytes
+ ***********************************************************************/
+static unsigned int I2cFlashPagePart(I2cFlashDevType *Dev, unsigned int EepromAddress, unsigned int Remaining)
+{
+	unsigned int Length = Dev->PageSize - OFFSET(Dev,EepromAddress);
+	return (Length < Remaining) ? Length : Remaining;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDropRequest
+ * CALLED BY:        I2cFlashDropReadRequest, I2cFlashReadAheadDrop
+ * DESCRIPTION:      detaches a read request from the slot of the file
+ *                   holding it. A request which is still in the queue is
+ *                   handed over to the work function to be freed after
+ *                   execution.
+ * INPUT PARAMETERS: Slot : read request pointer of the file
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashDropRequest(I2cFlashDevType *Dev, I2cFlashRequestType **Slot)
+{
+	I2cFlashRequestType *Request = NULL; /* request which can be freed here */
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	if (NULL != *Slot)
+	{
+		if (I2CFLASHDATAREADY == (*Slot)->I2cFlashRequestState)
+		{
+			/* data was never collected */
+			Request = *Slot;
+		}
+		else
+		{
+			/* still queued, work function frees it */
+			(*Slot)->I2cFlashRequestOwner = NULL;
+		}
+		*Slot = NULL;
+	}
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	if (NULL != Request)
+	{
+		I2cFlashFreeRequest(Request);
+	}
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDropReadRequest
+ * CALLED BY:        read function and release
+ * DESCRIPTION:      detaches the read request from the file
+ * INPUT PARAMETERS: FilePrivate : per file data
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashDropReadRequest(I2cFlashFileType *FilePrivate)
+{
+	I2cFlashDropRequest(FilePrivate->I2cFlashFileDev,&FilePrivate->I2cFlashFileReadRequest);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashReadAheadDrop
+ * CALLED BY:        read function and release
+ * DESCRIPTION:      gives up both read-ahead windows of the file, the
+ *                   bytes of them not read yet are counted as wasted
+ * INPUT PARAMETERS: FilePrivate : per file data
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashReadAheadDrop(I2cFlashFileType *FilePrivate)
+{
+	I2cFlashDevType *Dev = FilePrivate->I2cFlashFileDev; /* chip of the file */
+	I2cFlashRequestType **Slot[2] = {&FilePrivate->I2cFlashFileReadAhead,&FilePrivate->I2cFlashFileReadAheadNext};
+	loff_t End = 0; /* byte after a window */
+	unsigned int Index = 0;
+	for (Index = 0; Index < 2; Index++)
+	{
+		if (NULL == *Slot[Index])
+		{
+			continue;
+		}
+		End = (*Slot[Index])->I2cFlashRequestAddress + (*Slot[Index])->I2cFlashRequestLength;
+		if (End > FilePrivate->I2cFlashFileNextOffset)
+		{
+			this_cpu_add(Dev->PcpuStats->ReadAheadWasted,
+			             End - max_t(loff_t,FilePrivate->I2cFlashFileNextOffset,(*Slot[Index])->I2cFlashRequestAddress));
+		}
+		I2cFlashDropRequest(Dev,Slot[Index]);
+	}
+	FilePrivate->I2cFlashFileReadAheadLate = 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashForgetFile
+ * CALLED BY:        release of a chip and of the striped device
+ * DESCRIPTION:      detaches the requests still in the queue from a file
+ *                   being closed, their errors have nowhere to go anymore
+ * INPUT PARAMETERS: FilePrivate : per file data about to be freed
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashForgetFile(I2cFlashDevType *Dev, I2cFlashFileType *FilePrivate)
+{
+	I2cFlashRequestType *Request = NULL; /* request being checked */
+	unsigned int Depth = Dev->Queue.I2cFlashRingDepth;
+	unsigned int Index = 0;
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	for (Index = 0; Index < (Dev->Queue.I2cFlashRingCount - Dev->Queue.I2cFlashPriorityCount); Index++)
+	{
+		Request = Dev->Queue.I2cFlashRequestRing[(Dev->Queue.I2cFlashRingReadIndex + Index) % Depth];
+		if (FilePrivate == Request->I2cFlashRequestFile)
+		{
+			Request->I2cFlashRequestFile = NULL;
+		}
+	}
+	for (Index = 0; Index < Dev->Queue.I2cFlashPriorityCount; Index++)
+	{
+		Request = Dev->Queue.I2cFlashPriorityRing[(Dev->Queue.I2cFlashPriorityReadIndex + Index) % Depth];
+		if (FilePrivate == Request->I2cFlashRequestFile)
+		{
+			Request->I2cFlashRequestFile = NULL;
+		}
+	}
+	if ((NULL != Dev->Queue.I2cFlashActiveRequest) && (FilePrivate == Dev->Queue.I2cFlashActiveRequest->I2cFlashRequestFile))
+	{
+		Dev->Queue.I2cFlashActiveRequest->I2cFlashRequestFile = NULL;
+	}
+	if ((NULL != Dev->Queue.I2cFlashLongRequest) && (FilePrivate == Dev->Queue.I2cFlashLongRequest->I2cFlashRequestFile))
+	{
+		Dev->Queue.I2cFlashLongRequest->I2cFlashRequestFile = NULL;
+	}
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDriverRelease
+ * CALLED BY:        User App through kernel
+ * DESCRIPTION:      Releases the file structure along with its pending
+ *                   read request and read-ahead windows
+ * INPUT PARAMETERS: inode pointer:pointer to the inode of the caller
+ *                   filept:file pointer used by this inode
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+int I2cFlashDriverRelease(struct inode *inode, struct file *filept)
+{
+	I2cFlashFileType *FilePrivate = (I2cFlashFileType*)(filept->private_data);
+	I2cFlashDevType *Dev = FilePrivate->I2cFlashFileDev; /* chip of the file */
+	I2cFlashDropReadRequest(FilePrivate);
+	I2cFlashReadAheadDrop(FilePrivate);
+	I2cFlashForgetFile(Dev,FilePrivate);
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	list_del(&FilePrivate->I2cFlashFileNode);
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	printk("\n%s is closing\n", FilePrivate->I2cFlashFileDev->name);
+	kfree(FilePrivate);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashShadowCopy
+ * CALLED BY:        I2cFlashShadowUpdate, I2cFlashShadowFill and
+ *                   I2cFlashScanBlankPages with the ring lock held
+ * DESCRIPTION:      copies bytes into the shadow image. Only the pages
+ *                   which are completely covered become valid. The
+ *                   generation is left alone, data read from the EEPROM
+ *                   does not make queued reads stale.
+ * INPUT PARAMETERS: Address : first byte
+ *                   Length : number of bytes
+ *                   Data : new data of the bytes, NULL for erased bytes
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashShadowCopy(I2cFlashDevType *Dev, unsigned int Address, unsigned int Length, const char *Data)
+{
+	unsigned int PageNumber = 0; /* page being validated */
+	if ((NULL == Dev->Shadow) || (0 == Dev->ShadowEnable))
+	{
+		return;
+	}
+	if (NULL != Data)
+	{
+		memcpy((Dev->Shadow + Address),Data,Length);
+	}
+	else
+	{
+		memset((Dev->Shadow + Address),0xFF,Length);
+	}
+	for (PageNumber = PAGENO(Dev,Address + Dev->PageSize - 1); PageNumber < PAGENO(Dev,Address + Length); PageNumber++)
+	{
+		__set_bit(PageNumber,Dev->ShadowValid);
+	}
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashShadowUpdate
+ * CALLED BY:        I2cFlashSubmitRequest with the ring lock held
+ * DESCRIPTION:      applies a queued write or erase to the shadow image,
+ *                   so that the image always shows the data in the order
+ *                   of submission. Reads which are already in the queue
+ *                   are not allowed to fill the image anymore.
+ * INPUT PARAMETERS: Address : first byte
+ *                   Length : number of bytes
+ *                   Data : new data of the bytes, NULL for erased bytes
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashShadowUpdate(I2cFlashDevType *Dev, unsigned int Address, unsigned int Length, const char *Data)
+{
+	Dev->ShadowGeneration++;
+	I2cFlashShadowCopy(Dev,Address,Length,Data);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashPageCrc
+ * CALLED BY:        checksum manifest procedures
+ * DESCRIPTION:      CRC32C of one page, the value crc32c tools in user
+ *                   space give as well. The crc32c library of the kernel
+ *                   uses the CRC32 instruction of the cpu if it has one.
+ * INPUT PARAMETERS: Data : bytes of the page
+ * RETURN VALUES:    u32 : CRC32C
+ ***********************************************************************/
+static u32 I2cFlashPageCrc(I2cFlashDevType *Dev, const char *Data)
+{
+	return ~crc32c(~0U,Data,Dev->PageSize);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashCrcUpdate
+ * CALLED BY:        I2cFlashSubmitRequest, I2cFlashShadowFill and
+ *                   I2cFlashScanBlankPages with the ring lock held
+ * DESCRIPTION:      keeps the CRC of the pages in step with the shadow
+ *                   image. A page completely covered gets the CRC of
+ *                   the new bytes, a part of a page gets the CRC of the
+ *                   shadow image if the rest of the page is known there,
+ *                   otherwise the CRC of a page changed in part is not
+ *                   known anymore. Data read only fills in CRCs not
+ *                   known yet, it never hides a suspect page.
+ * INPUT PARAMETERS: Address : first byte
+ *                   Length : number of bytes
+ *                   Data : bytes, NULL for erased bytes
+ *                   Changed : 1 for a write or erase, 0 for data read
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashCrcUpdate(I2cFlashDevType *Dev, unsigned int Address, unsigned int Length, const char *Data,
+                              unsigned char Changed)
+{
+	unsigned int Offset = 0; /* bytes handled so far */
+	unsigned int Part = 0; /* bytes within one page */
+	unsigned int PageNumber = 0; /* page being updated */
+	for (Offset = 0; Offset < Length; Offset += Part)
+	{
+		PageNumber = PAGENO(Dev,Address + Offset);
+		Part = I2cFlashPagePart(Dev,(Address + Offset),(Length - Offset));
+		if (!Changed && test_bit(PageNumber,Dev->CrcKnown))
+		{
+			continue;
+		}
+		if (Dev->PageSize == Part)
+		{
+			Dev->PageCrc[PageNumber] = (NULL != Data) ? I2cFlashPageCrc(Dev,(Data + Offset)) : Dev->BlankCrc;
+		}
+		else if ((NULL != Dev->Shadow) && (0 != Dev->ShadowEnable) && test_bit(PageNumber,Dev->ShadowValid))
+		{
+			/* the image holds the new bytes already */
+			Dev->PageCrc[PageNumber] = I2cFlashPageCrc(Dev,(Dev->Shadow + JOIN(Dev,PageNumber,0x00)));
+		}
+		else
+		{
+			if (Changed)
+			{
+				__clear_bit(PageNumber,Dev->CrcKnown);
+			}
+			continue;
+		}
+		__set_bit(PageNumber,Dev->CrcKnown);
+		if (Changed)
+		{
+			__clear_bit(PageNumber,Dev->CrcSuspect);
+		}
+	}
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashShadowLookup
+ * CALLED BY:        I2cFlashSubmitRequest with the ring lock held
+ * DESCRIPTION:      copies the bytes of a read request from the shadow
+ *                   image if all the pages holding them are valid
+ * INPUT PARAMETERS: Request : read request
+ * RETURN VALUES:    int : 1 if the request is served, 0 otherwise
+ ***********************************************************************/
+static int I2cFlashShadowLookup(I2cFlashDevType *Dev, I2cFlashRequestType *Request)
+{
+	unsigned int PageNumber = 0; /* page being checked */
+	if ((NULL == Dev->Shadow) || (0 == Dev->ShadowEnable))
+	{
+		return 0;
+	}
+	for (PageNumber = PAGENO(Dev,Request->I2cFlashRequestAddress);
+	     PageNumber <= PAGENO(Dev,Request->I2cFlashRequestAddress + Request->I2cFlashRequestLength - 1); PageNumber++)
+	{
+		if (!test_bit(PageNumber,Dev->ShadowValid))
+		{
+			Dev->Stats.I2cFlashCacheMisses++;
+			return 0;
+		}
+	}
+	memcpy(Request->I2cFlashRequestBufferPtr,(Dev->Shadow + Request->I2cFlashRequestAddress),Request->I2cFlashRequestLength);
+	Dev->Stats.I2cFlashCacheHits++;
+	return 1;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashShadowFill
+ * CALLED BY:        I2cFlashWorkFunction with the ring lock held
+ * DESCRIPTION:      stores the data of a completed read request in the
+ *                   shadow image, unless a write, erase or invalidate
+ *                   was submitted after the read
+ * INPUT PARAMETERS: Request : completed read request
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashShadowFill(I2cFlashDevType *Dev, I2cFlashRequestType *Request)
+{
+	if (Request->I2cFlashRequestShadowGeneration != Dev->ShadowGeneration)
+	{
+		return;
+	}
+	/* the data is what the EEPROM holds, other queued reads can still fill */
+	I2cFlashShadowCopy(Dev,Request->I2cFlashRequestAddress,Request->I2cFlashRequestLength,Request->I2cFlashRequestBufferPtr);
+	I2cFlashCrcUpdate(Dev,Request->I2cFlashRequestAddress,Request->I2cFlashRequestLength,Request->I2cFlashRequestBufferPtr,0);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDedupMark
+ * CALLED BY:        I2cFlashSubmitRequest with the ring lock held
+ * DESCRIPTION:      marks the pages of a write request whose bytes are
+ *                   equal to the shadow image. Requests are executed in
+ *                   order, so the EEPROM holds the same data when the
+ *                   write is executed and these pages need not be
+ *                   written, unless an earlier write fails, then
+ *                   I2cFlashDedupForget takes the marks back. Must be
+ *                   called before the shadow image is updated with the
+ *                   request.
+ * INPUT PARAMETERS: Request : write request being submitted
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashDedupMark(I2cFlashDevType *Dev, I2cFlashRequestType *Request)
+{
+	unsigned int Offset = 0; /* bytes of the request checked so far */
+	unsigned int Length = 0; /* bytes of the request in this page */
+	unsigned int EepromAddress = 0; /* first byte of the request in this page */
+	if ((0 == I2cFlashDedupMode) || (NULL == Dev->Shadow) || (0 == Dev->ShadowEnable))
+	{
+		return;
+	}
+	for (Offset = 0; Offset < Request->I2cFlashRequestLength; Offset += Length)
+	{
+		EepromAddress = Request->I2cFlashRequestAddress + Offset;
+		Length = I2cFlashPagePart(Dev,EepromAddress,(Request->I2cFlashRequestLength - Offset));
+		if (test_bit(PAGENO(Dev,EepromAddress),Dev->ShadowValid) &&
+		    (0 == memcmp((Dev->Shadow + EepromAddress),I2cFlashRequestData(Dev,Request,Offset),Length)))
+		{
+			__set_bit(PAGENO(Dev,EepromAddress),Request->I2cFlashRequestUnchanged);
+		}
+	}
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDedupForget
+ * CALLED BY:        I2cFlashRequestFailed with the ring lock held
+ * DESCRIPTION:      takes back the marks of the queued writes on pages
+ *                   which a failed or cancelled write did not reach.
+ *                   They were compared with the shadow image holding
+ *                   the data of that write, which the EEPROM now lacks.
+ * INPUT PARAMETERS: Address : first byte not written
+ *                   Length : number of bytes
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashDedupForget(I2cFlashDevType *Dev, unsigned int Address, unsigned int Length)
+{
+	I2cFlashRequestType *Request = Dev->Queue.I2cFlashLongRequest; /* request being checked */
+	unsigned int FirstPage = PAGENO(Dev,Address); /* first page not written */
+	unsigned int EndPage = PAGENO(Dev,(Address + Length - 1)) + 1; /* page after the range */
+	unsigned int Index = 0;
+	if ((NULL != Request) && (I2CFLASHWRITE == Request->I2cFlashRequestState))
+	{
+		bitmap_clear(Request->I2cFlashRequestUnchanged,FirstPage,(EndPage - FirstPage));
+	}
+	for (Index = 0; Index < (Dev->Queue.I2cFlashRingCount - Dev->Queue.I2cFlashPriorityCount); Index++)
+	{
+		Request = Dev->Queue.I2cFlashRequestRing[(Dev->Queue.I2cFlashRingReadIndex + Index) % Dev->Queue.I2cFlashRingDepth];
+		if (I2CFLASHWRITE == Request->I2cFlashRequestState)
+		{
+			bitmap_clear(Request->I2cFlashRequestUnchanged,FirstPage,(EndPage - FirstPage));
+		}
+	}
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashMmapUpdate
+ * CALLED BY:        I2cFlashSubmitRequest with the ring lock held
+ * DESCRIPTION:      applies a queued write or erase to the pages of the
+ *                   mapped image which are faulted in
+ * INPUT PARAMETERS: Address : first byte
+ *                   Length : number of bytes
+ *                   Data : new data of the bytes, NULL for erased bytes
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashMmapUpdate(I2cFlashDevType *Dev, unsigned int Address, unsigned int Length, const char *Data)
+{
+	unsigned int Offset = 0; /* bytes handled so far */
+	unsigned int Part = 0; /* bytes within one kernel page */
+	if (NULL == Dev->MmapImage)
+	{
+		return;
+	}
+	for (Offset = 0; Offset < Length; Offset += Part)
+	{
+		Part = PAGE_SIZE - ((Address + Offset) & (PAGE_SIZE - 1));
+		if (Part > (Length - Offset))
+		{
+			Part = Length - Offset;
+		}
+		if (!test_bit(((Address + Offset) >> PAGE_SHIFT),Dev->MmapLoaded))
+		{
+			continue;
+		}
+		if (NULL != Data)
+		{
+			memcpy((Dev->MmapImage + Address + Offset),(Data + Offset),Part);
+		}
+		else
+		{
+			memset((Dev->MmapImage + Address + Offset),0xFF,Part);
+		}
+		memcpy((Dev->MmapReference + Address + Offset),(Dev->MmapImage + Address + Offset),Part);
+	}
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashCompleteIocb
+ * CALLED BY:        I2cFlashSubmitRequest and I2cFlashWorkFunction
+ * DESCRIPTION:      completes an asynchronous read_iter/write_iter and
+ *                   frees the request. The read data is copied to the
+ *                   user buffers, the work queue thread borrows the
+ *                   address space of the submitter for this.
+ * INPUT PARAMETERS: Request : executed request with a kiocb
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashCompleteIocb(I2cFlashRequestType *Request)
+{
+	long RetValue = Request->I2cFlashRequestLength; /* result given to the submitter */
+	struct mm_struct *Mm = Request->I2cFlashRequestMm; /* NULL for writes */
+	unsigned char Borrow = (current->flags & PF_KTHREAD) ? 1 : 0; /* not running in the submitter's context */
+	if (0 != Request->I2cFlashRequestStatus)
+	{
+		/* stopped part way, the bytes done like a short read or write, or why none */
+		RetValue = (0 != Request->I2cFlashRequestProgress) ? Request->I2cFlashRequestProgress : Request->I2cFlashRequestStatus;
+	}
+	if ((NULL != Mm) && (RetValue > 0))
+	{
+		if (Borrow && !mmget_not_zero(Mm))
+		{
+			/* submitter has exited, nowhere to copy the data */
+			RetValue = -EFAULT;
+		}
+		else
+		{
+			if (Borrow)
+			{
+				kthread_use_mm(Mm);
+			}
+			if (copy_to_iter(Request->I2cFlashRequestBufferPtr,RetValue,&Request->I2cFlashRequestIter) != RetValue)
+			{
+				RetValue = -EFAULT;
+			}
+			if (Borrow)
+			{
+				kthread_unuse_mm(Mm);
+				mmput(Mm);
+			}
+		}
+	}
+	if (NULL != Mm)
+	{
+		mmdrop(Mm);
+	}
+	Request->I2cFlashRequestIocb->ki_complete(Request->I2cFlashRequestIocb,RetValue);
+	I2cFlashFreeRequest(Request);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashReadAheadInvalidate
+ * CALLED BY:        I2cFlashSubmitRequest with the ring lock held
+ * DESCRIPTION:      marks the read-ahead windows of all open files which
+ *                   overlap a queued write or erase as stale, a window
+ *                   still in the queue is executed before the write and
+ *                   would give the old data
+ * INPUT PARAMETERS: Address : first byte
+ *                   Length : number of bytes
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashReadAheadInvalidate(I2cFlashDevType *Dev, unsigned int Address, unsigned int Length)
+{
+	I2cFlashFileType *FilePrivate = NULL; /* open file being checked */
+	I2cFlashRequestType *Window[2]; /* read-ahead windows of the file */
+	unsigned int Index = 0;
+	list_for_each_entry(FilePrivate,&Dev->Files,I2cFlashFileNode)
+	{
+		Window[0] = FilePrivate->I2cFlashFileReadAhead;
+		Window[1] = FilePrivate->I2cFlashFileReadAheadNext;
+		for (Index = 0; Index < 2; Index++)
+		{
+			if ((NULL != Window[Index]) &&
+			    (Address < (Window[Index]->I2cFlashRequestAddress + Window[Index]->I2cFlashRequestLength)) &&
+			    (Window[Index]->I2cFlashRequestAddress < (Address + Length)))
+			{
+				Window[Index]->I2cFlashRequestStale = 1;
+			}
+		}
+	}
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashPendingWriteOverlaps
+ * CALLED BY:        I2cFlashSubmitRequest with the ring lock held
+ * DESCRIPTION:      tells whether a queued write or erase, or the part of
+ *                   the one being executed which is not done yet, touches
+ *                   the given bytes. A read of such bytes must not go
+ *                   before it.
+ * INPUT PARAMETERS: Address : first byte
+ *                   Length : number of bytes
+ * RETURN VALUES:    int : 1 if they overlap, 0 otherwise
+ ***********************************************************************/
+static int I2cFlashPendingWriteOverlaps(I2cFlashDevType *Dev, unsigned int Address, unsigned int Length)
+{
+	I2cFlashRequestType *Request = Dev->Queue.I2cFlashLongRequest; /* request being checked */
+	unsigned int Index = 0;
+	if ((NULL != Request) &&
+	    (Address < (Request->I2cFlashRequestAddress + Request->I2cFlashRequestLength)) &&
+	    ((Request->I2cFlashRequestAddress + Request->I2cFlashRequestProgress) < (Address + Length)))
+	{
+		return 1;
+	}
+	for (Index = 0; Index < (Dev->Queue.I2cFlashRingCount - Dev->Queue.I2cFlashPriorityCount); Index++)
+	{
+		Request = Dev->Queue.I2cFlashRequestRing[(Dev->Queue.I2cFlashRingReadIndex + Index) % Dev->Queue.I2cFlashRingDepth];
+		if ((I2CFLASHREAD != Request->I2cFlashRequestState) &&
+		    (Address < (Request->I2cFlashRequestAddress + Request->I2cFlashRequestLength)) &&
+		    (Request->I2cFlashRequestAddress < (Address + Length)))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashOldestPendingId
+ * CALLED BY:        I2cFlashCompleteRequest with the ring lock held
+ * DESCRIPTION:      finds the id of the oldest request not executed yet.
+ *                   High priority reads complete out of order, so the
+ *                   last executed request does not tell which ones are
+ *                   done.
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    unsigned long : oldest pending id, the next id to be
+ *                                   given if nothing is pending
+ ***********************************************************************/
+static unsigned long I2cFlashOldestPendingId(I2cFlashDevType *Dev)
+{
+	unsigned long Oldest = Dev->Queue.I2cFlashLastRequestId + 1; /* nothing pending */
+	unsigned long Id = 0;
+	if (NULL != Dev->Queue.I2cFlashLongRequest)
+	{
+		Oldest = Dev->Queue.I2cFlashLongRequest->I2cFlashRequestId;
+	}
+	if (NULL != Dev->Queue.I2cFlashActiveRequest)
+	{
+		/* a request is completed by FLASHCANCEL while the work function executes an older one */
+		Id = Dev->Queue.I2cFlashActiveRequest->I2cFlashRequestId;
+		Oldest = ((long)(Id - Oldest) < 0) ? Id : Oldest;
+	}
+	if (Dev->Queue.I2cFlashRingCount > Dev->Queue.I2cFlashPriorityCount)
+	{
+		/* the ring buffer is in the order of the ids */
+		Id = Dev->Queue.I2cFlashRequestRing[Dev->Queue.I2cFlashRingReadIndex]->I2cFlashRequestId;
+		Oldest = ((long)(Id - Oldest) < 0) ? Id : Oldest;
+	}
+	if (0 != Dev->Queue.I2cFlashPriorityCount)
+	{
+		Id = Dev->Queue.I2cFlashPriorityRing[Dev->Queue.I2cFlashPriorityReadIndex]->I2cFlashRequestId;
+		Oldest = ((long)(Id - Oldest) < 0) ? Id : Oldest;
+	}
+	return Oldest;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashSubmitRequest
+ * CALLED BY:        read, write and ioctl functions
+ * DESCRIPTION:      adds a request to the ring buffer and starts the
+ *                   work function if nothing is running. Reads of pages
+ *                   held in the shadow image are completed here without
+ *                   going to the queue, an asynchronous one is freed.
+ * INPUT PARAMETERS: Request : filled request descriptor
+ *                   FilePrivate : file submitting the request, which
+ *                                 remembers the request id, can be NULL
+ * RETURN VALUES:    int : 0 if queued or served, -EBUSY if the ring
+ *                         buffer is full, never for a request with a
+ *                         reserved slot
+ ***********************************************************************/
+static int I2cFlashSubmitRequest(I2cFlashDevType *Dev, I2cFlashRequestType *Request, I2cFlashFileType *FilePrivate)
+{
+	unsigned int Offset = 0; /* bytes of a write applied to the images so far */
+	unsigned int Length = 0; /* bytes of the write in one page */
+	unsigned char Reserved = Request->I2cFlashRequestReserved; /* a slot is already set aside */
+	Request->I2cFlashRequestReserved = 0;
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	if (Reserved)
+	{
+		Dev->Queue.I2cFlashRingReserved--;
+	}
+	if (I2CFLASHREAD == Request->I2cFlashRequestState)
+	{
+		Request->I2cFlashRequestShadowGeneration = Dev->ShadowGeneration;
+		if (I2cFlashShadowLookup(Dev,Request))
+		{
+			Request->I2cFlashRequestState = I2CFLASHDATAREADY;
+			spin_unlock(&Dev->Queue.I2cFlashRingLock);
+			if (Reserved)
+			{
+				/* the slot set aside is not needed */
+				wake_up_interruptible_all(&Dev->Queue.I2cFlashWaitQueue);
+			}
+			if (NULL != Request->I2cFlashRequestDone)
+			{
+				complete(Request->I2cFlashRequestDone);
+			}
+			else if (NULL != Request->I2cFlashRequestIocb)
+			{
+				I2cFlashCompleteIocb(Request);
+			}
+			return 0;
+		}
+	}
+	if (!Reserved && ((Dev->Queue.I2cFlashRingCount + Dev->Queue.I2cFlashRingReserved) >= Dev->Queue.I2cFlashRingDepth))
+	{
+		spin_unlock(&Dev->Queue.I2cFlashRingLock);
+		this_cpu_inc(Dev->PcpuStats->EbusyRejections);
+		return -EBUSY;
+	}
+	if (I2CFLASHERASE == Request->I2cFlashRequestState)
+	{
+		I2cFlashShadowUpdate(Dev,Request->I2cFlashRequestAddress,Request->I2cFlashRequestLength,NULL);
+		I2cFlashCrcUpdate(Dev,Request->I2cFlashRequestAddress,Request->I2cFlashRequestLength,NULL,1);
+		I2cFlashMmapUpdate(Dev,Request->I2cFlashRequestAddress,Request->I2cFlashRequestLength,NULL);
+		I2cFlashReadAheadInvalidate(Dev,Request->I2cFlashRequestAddress,Request->I2cFlashRequestLength);
+	}
+	else if (I2CFLASHWRITE == Request->I2cFlashRequestState)
+	{
+		I2cFlashReadAheadInvalidate(Dev,Request->I2cFlashRequestAddress,Request->I2cFlashRequestLength);
+		/* write through to the shadow image, the page CRCs and the mapped image, page by page as the frames are */
+		I2cFlashDedupMark(Dev,Request);
+		for (Offset = 0; Offset < Request->I2cFlashRequestLength; Offset += Length)
+		{
+			Length = I2cFlashPagePart(Dev,(Request->I2cFlashRequestAddress + Offset),(Request->I2cFlashRequestLength - Offset));
+			I2cFlashShadowUpdate(Dev,(Request->I2cFlashRequestAddress + Offset),Length,I2cFlashRequestData(Dev,Request,Offset));
+			I2cFlashCrcUpdate(Dev,(Request->I2cFlashRequestAddress + Offset),Length,I2cFlashRequestData(Dev,Request,Offset),1);
+			I2cFlashMmapUpdate(Dev,(Request->I2cFlashRequestAddress + Offset),Length,I2cFlashRequestData(Dev,Request,Offset));
+		}
+		this_cpu_add(Dev->PcpuStats->BytesQueued,Request->I2cFlashRequestLength);
+	}
+	Request->I2cFlashRequestId = ++Dev->Queue.I2cFlashLastRequestId;
+	Request->I2cFlashRequestRetries = I2cFlashRetryBudget;
+	if (NULL != FilePrivate)
+	{
+		FilePrivate->I2cFlashFileLastRequestId = Request->I2cFlashRequestId;
+		Request->I2cFlashRequestFile = FilePrivate;
+		Request->I2cFlashRequestRetries = FilePrivate->I2cFlashFileRetries;
+		if (0 != FilePrivate->I2cFlashFileDeadlineMs)
+		{
+			/* the time in the queue counts as well */
+			Request->I2cFlashRequestDeadline = ktime_add_ms(ktime_get(),FilePrivate->I2cFlashFileDeadlineMs);
+		}
+	}
+	if ((I2CFLASHREAD == Request->I2cFlashRequestState) && (PRIORITYHIGH == Request->I2cFlashRequestPriority) &&
+	    I2cFlashPendingWriteOverlaps(Dev,Request->I2cFlashRequestAddress,Request->I2cFlashRequestLength))
+	{
+		/* it has to see the data of the write queued before it */
+		this_cpu_inc(Dev->PcpuStats->PriorityDeferred);
+		Request->I2cFlashRequestPriority = PRIORITYNORMAL;
+	}
+	if ((I2CFLASHREAD == Request->I2cFlashRequestState) && (PRIORITYHIGH == Request->I2cFlashRequestPriority))
+	{
+		/* goes before the ring buffer and between the chunks of a write or an erase */
+		Dev->Queue.I2cFlashPriorityRing[Dev->Queue.I2cFlashPriorityWriteIndex] = Request;
+		Dev->Queue.I2cFlashPriorityWriteIndex = (Dev->Queue.I2cFlashPriorityWriteIndex + 1) % Dev->Queue.I2cFlashRingDepth;
+		Dev->Queue.I2cFlashPriorityCount++;
+		this_cpu_inc(Dev->PcpuStats->PriorityReads);
+	}
+	else
+	{
+		Dev->Queue.I2cFlashRequestRing[Dev->Queue.I2cFlashRingWriteIndex] = Request;
+		Dev->Queue.I2cFlashRingWriteIndex = (Dev->Queue.I2cFlashRingWriteIndex + 1) % Dev->Queue.I2cFlashRingDepth;
+	}
+	Dev->Queue.I2cFlashRingCount++;
+	if (Dev->Queue.I2cFlashRingCount > Dev->Queue.I2cFlashRingMaxCount)
+	{
+		Dev->Queue.I2cFlashRingMaxCount = Dev->Queue.I2cFlashRingCount;
+	}
+	trace_i2c_flash_submit(Dev->name,Request->I2cFlashRequestId,Request->I2cFlashRequestState,PAGENO(Dev,Request->I2cFlashRequestAddress),
+	                       Request->I2cFlashRequestLength,Dev->Queue.I2cFlashRingCount);
+	/* Show the state of the oldest request until the work function picks it up */
+	if (NONE == Dev->Queue.I2cFlashReadOrWrite)
+	{
+		Dev->Queue.I2cFlashReadOrWrite = Request->I2cFlashRequestState;
+	}
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	this_cpu_inc(Dev->PcpuStats->Submitted);
+	/* Submit to work queue, does nothing if the work is already pending. Blocking
+	   callers sleep for the result, they never drive the bus themselves */
+	queue_work(Dev->WorkQueue,&Dev->Work);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashRingHasRoom
+ * CALLED BY:        procedures sleeping for a free slot
+ * DESCRIPTION:      tells if a request can be queued, the slots set aside
+ *                   for striped requests are taken
+ * INPUT PARAMETERS: Dev : chip
+ * RETURN VALUES:    int : 1 if there is a free slot, 0 otherwise
+ ***********************************************************************/
+static int I2cFlashRingHasRoom(I2cFlashDevType *Dev)
+{
+	return (READ_ONCE(Dev->Queue.I2cFlashRingCount) + READ_ONCE(Dev->Queue.I2cFlashRingReserved)) < Dev->Queue.I2cFlashRingDepth;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashReserveSlot
+ * CALLED BY:        I2cFlashStripeQueue, I2cFlashSubmitAndWait, read_iter
+ *                   and write_iter
+ * DESCRIPTION:      sets a slot of the queue aside, sleeping for one
+ *                   while the queue is full if Blocking is set. The
+ *                   request submitted with I2cFlashRequestReserved set
+ *                   takes it and can not get -EBUSY, so the parts of a
+ *                   striped request are queued on all the chips or on
+ *                   none of them.
+ * INPUT PARAMETERS: Dev : chip
+ *                   Blocking : 0 for a file opened with O_NONBLOCK
+ * RETURN VALUES:    int : 0 if reserved, -EBUSY if the queue is full and
+ *                         Blocking is 0, -ERESTARTSYS on a signal
+ ***********************************************************************/
+static int I2cFlashReserveSlot(I2cFlashDevType *Dev, unsigned char Blocking)
+{
+	int RetValue = -EBUSY;
+	while (-EBUSY == RetValue)
+	{
+		spin_lock(&Dev->Queue.I2cFlashRingLock);
+		if ((Dev->Queue.I2cFlashRingCount + Dev->Queue.I2cFlashRingReserved) < Dev->Queue.I2cFlashRingDepth)
+		{
+			Dev->Queue.I2cFlashRingReserved++;
+			RetValue = 0;
+		}
+		spin_unlock(&Dev->Queue.I2cFlashRingLock);
+		if ((0 != RetValue) && !Blocking)
+		{
+			this_cpu_inc(Dev->PcpuStats->EbusyRejections);
+			break;
+		}
+		if ((0 != RetValue) && wait_event_interruptible(Dev->Queue.I2cFlashWaitQueue,I2cFlashRingHasRoom(Dev)))
+		{
+			return -ERESTARTSYS;
+		}
+	}
+	return RetValue;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashUnreserveSlot
+ * CALLED BY:        I2cFlashStripeQueue
+ * DESCRIPTION:      gives back a slot set aside by I2cFlashReserveSlot
+ *                   which is not going to be used
+ * INPUT PARAMETERS: Dev : chip
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashUnreserveSlot(I2cFlashDevType *Dev)
+{
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	Dev->Queue.I2cFlashRingReserved--;
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	wake_up_interruptible_all(&Dev->Queue.I2cFlashWaitQueue);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashSubmitAndWait
+ * CALLED BY:        kernel callers which need the request to be executed
+ * DESCRIPTION:      submits a request and sleeps until the work function
+ *                   has executed it, waiting for a slot first unless the
+ *                   caller has reserved one. The request is not freed by
+ *                   the work function, the caller frees it and looks at
+ *                   its status. Only a fatal signal ends the wait early,
+ *                   the request is then left to the work function, which
+ *                   frees it.
+ * INPUT PARAMETERS: Request : filled request descriptor
+ *                   FilePrivate : file whose deadline and retry budget the
+ *                                 request gets, NULL for the defaults
+ * RETURN VALUES:    int : 0 once executed, -ERESTARTSYS on a signal
+ *                         while waiting for a slot, -EINTR if the
+ *                         process is killed while it is queued
+ ***********************************************************************/
+static int I2cFlashSubmitAndWait(I2cFlashDevType *Dev, I2cFlashRequestType *Request, I2cFlashFileType *FilePrivate)
+{
+	struct completion Done; /* completed by the work function */
+	int RetValue = 0;
+	if (!Request->I2cFlashRequestReserved)
+	{
+		RetValue = I2cFlashReserveSlot(Dev,1);
+		if (RetValue)
+		{
+			return RetValue;
+		}
+		Request->I2cFlashRequestReserved = 1;
+	}
+	init_completion(&Done);
+	Request->I2cFlashRequestDone = &Done;
+	/* can not be refused, the slot is set aside */
+	I2cFlashSubmitRequest(Dev,Request,FilePrivate);
+	if (wait_for_completion_killable(&Done))
+	{
+		/* the work function completes it with the ring lock held */
+		spin_lock(&Dev->Queue.I2cFlashRingLock);
+		if (!completion_done(&Done))
+		{
+			Request->I2cFlashRequestDone = NULL;
+			RetValue = -EINTR;
+		}
+		spin_unlock(&Dev->Queue.I2cFlashRingLock);
+		if (RetValue)
+		{
+			return RetValue;
+		}
+	}
+	Request->I2cFlashRequestDone = NULL;
+	return RetValue;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashWaitRequest
+ * CALLED BY:        I2cFlashDriverIoctl for FLASHWAIT, blocking writes
+ * DESCRIPTION:      sleeps until the request with the given id, and every
+ *                   request queued before it, has been executed
+ * INPUT PARAMETERS: RequestId : id of the request
+ * RETURN VALUES:    int : 0 once executed, -ERESTARTSYS on a signal
+ ***********************************************************************/
+static int I2cFlashWaitRequest(I2cFlashDevType *Dev, unsigned long RequestId)
+{
+	return wait_event_interruptible(Dev->Queue.I2cFlashWaitQueue,
+	                                ((long)(READ_ONCE(Dev->Queue.I2cFlashLastCompletedId) - RequestId) >= 0));
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashTakeError
+ * CALLED BY:        FLASHWAIT, fsync, blocking writes and erases
+ * DESCRIPTION:      gives the error of a write or erase of the file which
+ *                   failed and was not reported yet, and forgets it, so
+ *                   every failure is reported once
+ * INPUT PARAMETERS: FilePrivate : per file data
+ * RETURN VALUES:    int : 0, -ETIMEDOUT, -ECANCELED or the bus error
+ ***********************************************************************/
+static int I2cFlashTakeError(I2cFlashFileType *FilePrivate)
+{
+	I2cFlashDevType *Dev = FilePrivate->I2cFlashFileDev; /* chip of the file */
+	int RetValue = 0;
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	RetValue = FilePrivate->I2cFlashFileError;
+	FilePrivate->I2cFlashFileError = 0;
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	return RetValue;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashWaitResult
+ * CALLED BY:        blocking write, write_iter and erase
+ * DESCRIPTION:      sleeps until the request just queued by the file is
+ *                   executed and gives its outcome. A request which
+ *                   stopped part way gives the bytes it got done, like a
+ *                   short write. A signal cancels the request through
+ *                   FLASHCANCEL, after the transfer on the bus. The
+ *                   errors of earlier requests are left to FLASHWAIT
+ *                   and fsync.
+ * INPUT PARAMETERS: FilePrivate : per file data
+ *                   count : bytes of the request, 0 for an erase
+ * RETURN VALUES:    ssize_t : count once done, the bytes done by a write
+ *                             which failed or was interrupted part way,
+ *                             -ERESTARTSYS if a signal came before
+ *                             anything was done, error code of a
+ *                             failure of this request
+ ***********************************************************************/
+static ssize_t I2cFlashWaitResult(I2cFlashFileType *FilePrivate, size_t count)
+{
+	I2cFlashDevType *Dev = FilePrivate->I2cFlashFileDev; /* chip of the file */
+	unsigned long RequestId = FilePrivate->I2cFlashFileLastRequestId; /* the request just queued */
+	unsigned char Interrupted = 0; /* a signal came while it was pending */
+	ssize_t RetValue = count;
+	if (I2cFlashWaitRequest(Dev,RequestId))
+	{
+		/* a queued request completes right away, the one on the bus at its next page */
+		I2cFlashCancelRequests(FilePrivate,(unsigned int)RequestId);
+		wait_event(Dev->Queue.I2cFlashWaitQueue,((long)(READ_ONCE(Dev->Queue.I2cFlashLastCompletedId) - RequestId) >= 0));
+		Interrupted = 1;
+	}
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	if (RequestId == FilePrivate->I2cFlashFileErrorId)
+	{
+		RetValue = FilePrivate->I2cFlashFileErrorStatus;
+		if ((0 != count) && (0 != FilePrivate->I2cFlashFileErrorProgress))
+		{
+			RetValue = FilePrivate->I2cFlashFileErrorProgress;
+		}
+		else if (Interrupted && (-ECANCELED == RetValue))
+		{
+			RetValue = -ERESTARTSYS;
+		}
+		if (RequestId == FilePrivate->I2cFlashFileFirstErrorId)
+		{
+			/* reported here, not once more by FLASHWAIT */
+			FilePrivate->I2cFlashFileError = 0;
+		}
+	}
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	return RetValue;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashSubmitFromFile
+ * CALLED BY:        read, write and erase of a chip file
+ * DESCRIPTION:      submits a request of a file. A file opened without
+ *                   O_NONBLOCK sleeps until the work function frees a
+ *                   slot of a full queue, the request is never run in
+ *                   the caller's context. The flag is looked at on every
+ *                   call, so fcntl(F_SETFL) switches the mode at run time.
+ * INPUT PARAMETERS: filept : file submitting the request
+ *                   Request : filled request descriptor
+ * RETURN VALUES:    int : 0 if queued or served, -EBUSY if the queue is
+ *                         full and the file is non blocking,
+ *                         -ERESTARTSYS on a signal
+ ***********************************************************************/
+static int I2cFlashSubmitFromFile(struct file *filept, I2cFlashRequestType *Request)
+{
+	I2cFlashFileType *FilePrivate = (I2cFlashFileType*)(filept->private_data);
+	I2cFlashDevType *Dev = FilePrivate->I2cFlashFileDev; /* chip of the file */
+	int RetValue = 0;
+	while ((-EBUSY == (RetValue = I2cFlashSubmitRequest(Dev,Request,FilePrivate))) && !(filept->f_flags & O_NONBLOCK))
+	{
+		if (wait_event_interruptible(Dev->Queue.I2cFlashWaitQueue,I2cFlashRingHasRoom(Dev)))
+		{
+			return -ERESTARTSYS;
+		}
+	}
+	return RetValue;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashReadAheadSubmit
+ * CALLED BY:        read function
+ * DESCRIPTION:      queues a read of the current window size of the file
+ *                   from Address into one of its read-ahead slots. It is
+ *                   only done while the queue is less than half full, so
+ *                   that fetching ahead never makes real requests wait
+ *                   for a slot.
+ * INPUT PARAMETERS: FilePrivate : per file data
+ *                   Slot : read-ahead slot of the file, empty
+ *                   Address : first byte of the window
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashReadAheadSubmit(I2cFlashFileType *FilePrivate, I2cFlashRequestType **Slot, unsigned int Address)
+{
+	I2cFlashDevType *Dev = FilePrivate->I2cFlashFileDev; /* chip of the file */
+	I2cFlashRequestType *Request = NULL; /* read of the window */
+	unsigned int Length = FilePrivate->I2cFlashFileReadAheadPages << Dev->PageShift; /* bytes of the window */
+	if ((Address >= Dev->Size) || ((2 * READ_ONCE(Dev->Queue.I2cFlashRingCount)) >= Dev->Queue.I2cFlashRingDepth))
+	{
+		return;
+	}
+	if (Length > (Dev->Size - Address))
+	{
+		Length = Dev->Size - Address;
+	}
+	Request = kzalloc(sizeof(I2cFlashRequestType),GFP_KERNEL);
+	if (NULL == Request)
+	{
+		return;
+	}
+	Request->I2cFlashRequestBufferPtr = (char*)kzalloc(Length,GFP_KERNEL);
+	if (NULL == Request->I2cFlashRequestBufferPtr)
+	{
+		kfree(Request);
+		return;
+	}
+	Request->I2cFlashRequestState = I2CFLASHREAD;
+	Request->I2cFlashRequestAddress = Address;
+	Request->I2cFlashRequestLength = Length;
+	Request->I2cFlashRequestOwner = FilePrivate;
+	Request->I2cFlashRequestPriority = FilePrivate->I2cFlashFilePriority;
+	/* in the slot before it is queued, so that a write queued right after it makes it stale */
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	*Slot = Request;
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	if (I2cFlashSubmitRequest(Dev,Request,NULL))
+	{
+		spin_lock(&Dev->Queue.I2cFlashRingLock);
+		*Slot = NULL;
+		spin_unlock(&Dev->Queue.I2cFlashRingLock);
+		I2cFlashFreeRequest(Request);
+		return;
+	}
+	this_cpu_add(Dev->PcpuStats->ReadAheadBytes,Length);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashReadAheadRead
+ * CALLED BY:        read function
+ * DESCRIPTION:      serves a sequential read from the read-ahead windows
+ *                   of the file. The window read completely is replaced
+ *                   by the one behind it and a larger one is fetched
+ *                   behind that. Windows which do not fit the read
+ *                   anymore are dropped, the read then goes to the queue.
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   buf : pointer to the user data
+ *                   count : no of bytes to be copied to the user buffer
+ *                   offp: byte offset in the EEPROM, moved by the bytes
+ *                         read
+ * RETURN VALUES:    ssize_t : number of bytes read, 0 if the read is not
+ *                             served from the windows, -EAGAIN if the
+ *                             window is still being fetched (O_NONBLOCK
+ *                             only), -ERESTARTSYS on a signal
+ ***********************************************************************/
+static ssize_t I2cFlashReadAheadRead(struct file *filept, char *buf, size_t count, loff_t *offp)
+{
+	I2cFlashFileType *FilePrivate = (I2cFlashFileType*)(filept->private_data);
+	I2cFlashDevType *Dev = FilePrivate->I2cFlashFileDev; /* chip of the file */
+	I2cFlashRequestType *Window[2]; /* window being read and the one behind it */
+	I2cFlashRequestType *Done = NULL; /* window read completely */
+	size_t Part = 0; /* bytes of the read in the first window */
+	unsigned int End = 0; /* byte after the first window */
+	unsigned int Index = 0;
+	if ((0 == I2cFlashReadAheadPages) || (*offp != FilePrivate->I2cFlashFileNextOffset))
+	{
+		/* not sequential anymore, start again from the smallest window */
+		I2cFlashReadAheadDrop(FilePrivate);
+		FilePrivate->I2cFlashFileReadAheadPages = READAHEAD_MIN;
+		return 0;
+	}
+	Window[0] = FilePrivate->I2cFlashFileReadAhead;
+	Window[1] = FilePrivate->I2cFlashFileReadAheadNext;
+	if ((NULL == Window[0]) || (*offp < Window[0]->I2cFlashRequestAddress))
+	{
+		/* nothing fetched yet, or the read which started the read-ahead is being repeated */
+		return 0;
+	}
+	End = Window[0]->I2cFlashRequestAddress + Window[0]->I2cFlashRequestLength;
+	Part = (count < (End - *offp)) ? count : (End - *offp);
+	if ((*offp >= End) || ((Part < count) && ((NULL == Window[1]) || ((*offp + count) > (End + Window[1]->I2cFlashRequestLength)))))
+	{
+		/* the read is larger than the windows */
+		I2cFlashReadAheadDrop(FilePrivate);
+		return 0;
+	}
+	for (Index = 0; Index < ((Part < count) ? 2 : 1); Index++)
+	{
+		if (I2CFLASHDATAREADY == READ_ONCE(Window[Index]->I2cFlashRequestState))
+		{
+			continue;
+		}
+		FilePrivate->I2cFlashFileReadAheadLate = 1;
+		if (filept->f_flags & O_NONBLOCK)
+		{
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(Dev->Queue.I2cFlashWaitQueue,
+		                             (I2CFLASHDATAREADY == READ_ONCE(Window[Index]->I2cFlashRequestState))))
+		{
+			return -ERESTARTSYS;
+		}
+	}
+	if (READ_ONCE(Window[0]->I2cFlashRequestStale) || ((Part < count) && READ_ONCE(Window[1]->I2cFlashRequestStale)) ||
+	    (0 != Window[0]->I2cFlashRequestStatus) || ((Part < count) && (0 != Window[1]->I2cFlashRequestStatus)))
+	{
+		/* written since it was fetched, or the fetch failed */
+		I2cFlashReadAheadDrop(FilePrivate);
+		return 0;
+	}
+	if (copy_to_user(buf,(Window[0]->I2cFlashRequestBufferPtr + (*offp - Window[0]->I2cFlashRequestAddress)),Part) ||
+	    ((Part < count) && copy_to_user((buf + Part),Window[1]->I2cFlashRequestBufferPtr,(count - Part))))
+	{
+		return -EFAULT;
+	}
+	*offp += count;
+	FilePrivate->I2cFlashFileNextOffset = *offp;
+	if (FilePrivate->I2cFlashFileReadAheadLate)
+	{
+		this_cpu_inc(Dev->PcpuStats->ReadAheadLate);
+	}
+	else
+	{
+		this_cpu_inc(Dev->PcpuStats->ReadAheadHits);
+	}
+	FilePrivate->I2cFlashFileReadAheadLate = 0;
+	if (*offp >= End)
+	{
+		/* the window is read completely, the one behind it takes its place */
+		spin_lock(&Dev->Queue.I2cFlashRingLock);
+		Done = FilePrivate->I2cFlashFileReadAhead;
+		FilePrivate->I2cFlashFileReadAhead = FilePrivate->I2cFlashFileReadAheadNext;
+		FilePrivate->I2cFlashFileReadAheadNext = NULL;
+		spin_unlock(&Dev->Queue.I2cFlashRingLock);
+		I2cFlashFreeRequest(Done);
+		/* the reader keeps up with the windows, fetch further ahead */
+		FilePrivate->I2cFlashFileReadAheadPages = min(2 * FilePrivate->I2cFlashFileReadAheadPages,
+		                                              max(I2cFlashReadAheadPages,(unsigned int)READAHEAD_MIN));
+		if (NULL != FilePrivate->I2cFlashFileReadAhead)
+		{
+			I2cFlashReadAheadSubmit(FilePrivate,&FilePrivate->I2cFlashFileReadAheadNext,
+			                        (FilePrivate->I2cFlashFileReadAhead->I2cFlashRequestAddress +
+			                         FilePrivate->I2cFlashFileReadAhead->I2cFlashRequestLength));
+		}
+	}
+	return count;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashHistAdd
+ * CALLED BY:        work function, when an operation is over
+ * DESCRIPTION:      adds the time since Start to a latency histogram of
+ *                   this cpu
+ * INPUT PARAMETERS: Hist : histogram
+ *                   Start : time at which the operation started
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashHistAdd(I2cFlashDevType *Dev, I2cFlashHistType Hist, ktime_t Start)
+{
+	unsigned int Bucket = fls64(ktime_to_us(ktime_sub(ktime_get(),Start))); /* log2 of the latency */
+	if (Bucket >= HIST_BUCKETS)
+	{
+		Bucket = HIST_BUCKETS - 1;
+	}
+	this_cpu_inc(Dev->PcpuStats->Latency[Hist][Bucket]);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashBusError
+ * CALLED BY:        I2cFlashBusReadAt, I2cFlashBusWritePage
+ * DESCRIPTION:      counts a failed transfer as a NACK or as a bus error
+ *                   and gives the error code for it
+ * INPUT PARAMETERS: Status : return value of i2c_transfer
+ * RETURN VALUES:    int : error code
+ ***********************************************************************/
+static int I2cFlashBusError(I2cFlashDevType *Dev, int Status)
+{
+	if ((-ENXIO == Status) || (-EREMOTEIO == Status))
+	{
+		this_cpu_inc(Dev->PcpuStats->Nacks);
+	}
+	else
+	{
+		this_cpu_inc(Dev->PcpuStats->BusErrors);
+	}
+	return (Status < 0) ? Status : -EIO;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashSleepUntil
+ * CALLED BY:        I2cFlashWaitWriteCycle, I2cFlashRetryWait
+ * DESCRIPTION:      sleeps on a hrtimer until the given time
+ * INPUT PARAMETERS: Expiry : absolute time to wake up
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashSleepUntil(ktime_t Expiry)
+{
+	set_current_state(TASK_UNINTERRUPTIBLE);
+	schedule_hrtimeout(&Expiry,HRTIMER_MODE_ABS);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashAckPoll
+ * CALLED BY:        I2cFlashWaitWriteCycle
+ * DESCRIPTION:      addresses the EEPROM without data, the EEPROM ACKs
+ *                   only when its write cycle is over. Adapters which
+ *                   can not send zero length messages read one byte.
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    int : 0 if the EEPROM acknowledged, -EBUSY otherwise
+ ***********************************************************************/
+static int I2cFlashAckPoll(I2cFlashDevType *Dev)
+{
+	struct i2c_msg PollMessage;
+	char Dummy = 0; /* byte read by adapters not supporting zero length */
+	PollMessage.addr = Dev->Client->addr;
+	PollMessage.flags = 0;
+	PollMessage.len = 0;
+	PollMessage.buf = (u8 *)&Dummy;
+	if ((NULL != Dev->Client->adapter->quirks) && (Dev->Client->adapter->quirks->flags & I2C_AQ_NO_ZERO_LEN_WRITE))
+	{
+		PollMessage.flags = I2C_M_RD;
+		PollMessage.len = 1;
+	}
+	Dev->Stats.I2cFlashBusTransactions++;
+	Dev->Stats.I2cFlashAckPolls++;
+	return (1 == i2c_transfer(Dev->Client->adapter,&PollMessage,1)) ? 0 : -EBUSY;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashWaitWriteCycle
+ * CALLED BY:        I2cFlashBusReadAt, I2cFlashBusWritePage
+ * DESCRIPTION:      if a page write is in progress inside the EEPROM,
+ *                   sleeps for tWR and then ACK polls until the EEPROM
+ *                   is ready again or the timeout expires
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    int : 0 if the EEPROM is ready, -ETIMEDOUT if it did
+ *                         not answer within write_cycle_timeout_ms
+ ***********************************************************************/
+static int I2cFlashWaitWriteCycle(I2cFlashDevType *Dev)
+{
+	ktime_t Deadline; /* time after which the write cycle is given up */
+	unsigned int WriteCycleUs = (0 != I2cFlashWriteCycleUs) ? I2cFlashWriteCycleUs : Dev->Geometry->WriteCycleUs; /* tWR */
+	ktime_t WaitStart; /* for the write cycle histogram */
+	unsigned int Polls = 0; /* ACK polls not answered, for the tracepoint */
+	int Status = 0; /* 0 or -ETIMEDOUT, for the tracepoint */
+	if ((0 == Dev->WriteCyclePending) || (0 == I2cFlashAckPollEnable))
+	{
+		Dev->WriteCyclePending = 0;
+		return 0;
+	}
+	Dev->WriteCyclePending = 0;
+	WaitStart = ktime_get();
+	/* no need to poll before the minimum write cycle time */
+	if (ktime_before(ktime_get(),ktime_add_us(Dev->WriteCycleStart,WriteCycleUs)))
+	{
+		I2cFlashSleepUntil(ktime_add_us(Dev->WriteCycleStart,WriteCycleUs));
+	}
+	Deadline = ktime_add_ms(Dev->WriteCycleStart,I2cFlashWriteCycleTimeoutMs);
+	while (I2cFlashAckPoll(Dev))
+	{
+		if (ktime_after(ktime_get(),Deadline))
+		{
+			Dev->Stats.I2cFlashWriteCycleTimeouts++;
+			dev_warn_ratelimited(&Dev->Client->dev,"write cycle did not complete in %u ms\n",I2cFlashWriteCycleTimeoutMs);
+			Status = -ETIMEDOUT;
+			break;
+		}
+		Polls++;
+		I2cFlashSleepUntil(ktime_add_us(ktime_get(),I2cFlashAckPollIntervalUs));
+	}
+	I2cFlashHistAdd(Dev,HIST_WRITE_CYCLE,WaitStart);
+	trace_i2c_flash_write_cycle(Dev->name,Dev->ActiveRequestId,Dev->WriteCyclePage,ktime_to_us(ktime_sub(ktime_get(),WaitStart)),Polls,Status);
+	return Status;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashBusAddress
+ * CALLED BY:        read and write procedures of the work function
+ * DESCRIPTION:      puts the byte address within the block into the
+ *                   address bytes of a message, MSB first, and gives the
+ *                   chip address carrying the block select bits
+ * INPUT PARAMETERS: EepromAddress : byte address in the EEPROM
+ *                   Message : buffer of at least 2 bytes
+ * RETURN VALUES:    unsigned short : 7 bit chip address
+ ***********************************************************************/
+static unsigned short I2cFlashBusAddress(I2cFlashDevType *Dev, unsigned int EepromAddress, unsigned char *Message)
+{
+	if (2 == Dev->Geometry->AddressBytes)
+	{
+		Message[0] = (unsigned char)(EepromAddress >> 8);
+		Message[1] = (unsigned char)(EepromAddress & 0xFF);
+	}
+	else
+	{
+		Message[0] = (unsigned char)(EepromAddress & 0xFF);
+	}
+	return Dev->Client->addr | ((EepromAddress >> Dev->BlockShift) << Dev->Geometry->BlockSelectShift);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashBusReadAt
+ * CALLED BY:        read procedure of the work function
+ * DESCRIPTION:      sets the EEPROM address and reads sequentially from
+ *                   it in one combined transfer (address write, repeated
+ *                   start, read). A sequential read does not go on into
+ *                   the next block of a part with block select bits, so
+ *                   the read is split at the blocks.
+ * INPUT PARAMETERS: EepromAddress : byte address in the EEPROM
+ *                   Buffer : buffer to receive the data
+ *                   Length : number of bytes to receive
+ * RETURN VALUES:    int : Length if the data is read, -ETIMEDOUT if the
+ *                         EEPROM stayed in its write cycle, error code of
+ *                         the transfer otherwise
+ ***********************************************************************/
+static int I2cFlashBusReadAt(I2cFlashDevType *Dev, unsigned int EepromAddress, char *Buffer, int Length)
+{
+	struct i2c_msg ReadMessage[2];
+	unsigned char AddressBytes[2]; /* MSB is sent first */
+	unsigned int Offset = 0; /* bytes read so far */
+	unsigned int Part = 0; /* bytes read within one block */
+	int Status = 0;
+	for (Offset = 0; Offset < Length; Offset += Part)
+	{
+		Part = (((EepromAddress + Offset) >> Dev->BlockShift) + 1) << Dev->BlockShift;
+		Part -= EepromAddress + Offset;
+		if (Part > (Length - Offset))
+		{
+			Part = Length - Offset;
+		}
+		ReadMessage[0].addr = I2cFlashBusAddress(Dev,(EepromAddress + Offset),AddressBytes);
+		ReadMessage[0].flags = 0;
+		ReadMessage[0].len = Dev->Geometry->AddressBytes;
+		ReadMessage[0].buf = AddressBytes;
+		ReadMessage[1].addr = ReadMessage[0].addr;
+		ReadMessage[1].flags = I2C_M_RD;
+		ReadMessage[1].len = Part;
+		ReadMessage[1].buf = (u8 *)(Buffer + Offset);
+		Status = I2cFlashWaitWriteCycle(Dev);
+		if (0 != Status)
+		{
+			/* the caller retries it within the budget and the deadline of its request */
+			return Status;
+		}
+		Dev->Stats.I2cFlashBusTransactions++;
+		Status = i2c_transfer(Dev->Client->adapter,ReadMessage,2);
+		if (2 != Status)
+		{
+			return I2cFlashBusError(Dev,Status);
+		}
+	}
+	return Length;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashReadChunkSize
+ * CALLED BY:        read procedure of the work function
+ * DESCRIPTION:      gives the number of bytes read in one transfer, the
+ *                   read_chunk parameter limited by the adapter quirks
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    unsigned int : chunk size in bytes
+ ***********************************************************************/
+static unsigned int I2cFlashReadChunkSize(I2cFlashDevType *Dev)
+{
+	const struct i2c_adapter_quirks *Quirks = Dev->Client->adapter->quirks;
+	unsigned int ChunkSize = I2cFlashReadChunk;
+	if (ChunkSize < Dev->PageSize)
+	{
+		ChunkSize = Dev->PageSize;
+	}
+	if (ChunkSize > Dev->Size)
+	{
+		ChunkSize = Dev->Size;
+	}
+	if (NULL != Quirks)
+	{
+		if ((0 != Quirks->max_read_len) && (ChunkSize > Quirks->max_read_len))
+		{
+			ChunkSize = Quirks->max_read_len;
+		}
+		if ((Quirks->flags & I2C_AQ_COMB_WRITE_THEN_READ) && (0 != Quirks->max_comb_2nd_msg_len) &&
+		    (ChunkSize > Quirks->max_comb_2nd_msg_len))
+		{
+			ChunkSize = Quirks->max_comb_2nd_msg_len;
+		}
+	}
+	return ChunkSize;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashBusWritePage
+ * CALLED BY:        write and erase procedures of the work function
+ * DESCRIPTION:      sends data within one page along with its address
+ *                   once the EEPROM is out of its write cycle and starts
+ *                   the write cycle timing once the EEPROM accepted it.
+ *                   The address bytes are put in front of the data, in
+ *                   the header room of its page frame, so the data is
+ *                   sent from where it is. The dirty bit of the page is
+ *                   updated with the new data.
+ * INPUT PARAMETERS: EepromAddress : byte address of the first byte
+ *                   Data : bytes to be written, within one page, with
+ *                          FRAME_HEADER bytes of room in front
+ *                   Length : number of bytes
+ * RETURN VALUES:    int : Length if written, -ETIMEDOUT if the EEPROM
+ *                         stayed in the write cycle of the previous page,
+ *                         error code of the transfer otherwise
+ ***********************************************************************/
+static int I2cFlashBusWritePage(I2cFlashDevType *Dev, unsigned int EepromAddress, char *Data, int Length)
+{
+	unsigned char *Message = (unsigned char *)Data - Dev->Geometry->AddressBytes; /* address followed by the data */
+	struct i2c_msg WriteMessage;
+	unsigned int PageNumber = PAGENO(Dev,EepromAddress);
+	int Status = 0;
+	WriteMessage.addr = I2cFlashBusAddress(Dev,EepromAddress,Message);
+	WriteMessage.flags = 0;
+	WriteMessage.len = Dev->Geometry->AddressBytes + Length;
+	WriteMessage.buf = Message;
+	Status = I2cFlashWaitWriteCycle(Dev);
+	if (0 != Status)
+	{
+		/* the caller retries it within the budget and the deadline of its request */
+		return Status;
+	}
+	Dev->Stats.I2cFlashBusTransactions++;
+	Status = i2c_transfer(Dev->Client->adapter,&WriteMessage,1);
+	if (1 != Status)
+	{
+		return I2cFlashBusError(Dev,Status);
+	}
+	Dev->WriteCycleStart = ktime_get();
+	Dev->WriteCyclePending = 1;
+	Dev->WriteCyclePage = PageNumber;
+	Dev->Stats.I2cFlashPagesWritten++;
+	Dev->Stats.I2cFlashBytesWritten += Length;
+	/* remember whether the page holds data, for erase */
+	if (NULL != memchr_inv(Data,0xFF,Length))
+	{
+		__set_bit(PageNumber,Dev->DirtyPages);
+	}
+	else if (Dev->PageSize == Length)
+	{
+		__clear_bit(PageNumber,Dev->DirtyPages);
+	}
+	return Length;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashRequestExpired
+ * CALLED BY:        read, write and erase procedures of the work function
+ * DESCRIPTION:      tells whether a request has to stop before its next
+ *                   transfer, since it was cancelled or its deadline has
+ *                   passed, also while it was waiting in the queue
+ * INPUT PARAMETERS: Request : request being executed
+ * RETURN VALUES:    int : 0 to go on, -ECANCELED or -ETIMEDOUT otherwise
+ ***********************************************************************/
+static int I2cFlashRequestExpired(I2cFlashRequestType *Request)
+{
+	if (READ_ONCE(Request->I2cFlashRequestCancelled))
+	{
+		return -ECANCELED;
+	}
+	if ((0 != Request->I2cFlashRequestDeadline) && ktime_after(ktime_get(),Request->I2cFlashRequestDeadline))
+	{
+		return -ETIMEDOUT;
+	}
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashRetryWait
+ * CALLED BY:        read, write and erase procedures of the work function
+ * DESCRIPTION:      decides what to do after a failed transfer. With
+ *                   ack_poll=0 a transfer refused during the write cycle
+ *                   of the previous page is the EEPROM being busy, it is
+ *                   tried again after poll_interval_us for free. Any
+ *                   other failure takes one retry from the budget of the
+ *                   request and is tried again after a back off doubled
+ *                   with every failure of the same transfer, so a chip
+ *                   which is gone is not hammered at full bus speed. The
+ *                   sleep never goes past the deadline of the request.
+ * INPUT PARAMETERS: Request : request being executed
+ *                   Status : error code of the failed transfer
+ *                   Attempt : failures of this transfer, 1 for the first
+ * RETURN VALUES:    int : 0 to try the transfer again, error code to give
+ *                         the request up
+ ***********************************************************************/
+static int I2cFlashRetryWait(I2cFlashDevType *Dev, I2cFlashRequestType *Request, int Status, unsigned int Attempt)
+{
+	ktime_t Wake; /* end of the back off */
+	unsigned int BackoffUs = I2cFlashAckPollIntervalUs; /* sleep before the next try */
+	int RetValue = I2cFlashRequestExpired(Request);
+	if (0 != RetValue)
+	{
+		return RetValue;
+	}
+	if ((0 != I2cFlashAckPollEnable) ||
+	    !ktime_before(ktime_get(),ktime_add_ms(Dev->WriteCycleStart,I2cFlashWriteCycleTimeoutMs)))
+	{
+		if (0 == Request->I2cFlashRequestRetries)
+		{
+			return (Status < 0) ? Status : -EIO;
+		}
+		Request->I2cFlashRequestRetries--;
+		BackoffUs = I2cFlashRetryBackoffUs << min_t(unsigned int,(Attempt - 1),16);
+		if (BackoffUs > I2cFlashRetryBackoffMaxUs)
+		{
+			BackoffUs = I2cFlashRetryBackoffMaxUs;
+		}
+	}
+	Wake = ktime_add_us(ktime_get(),BackoffUs);
+	if ((0 != Request->I2cFlashRequestDeadline) && ktime_after(Wake,Request->I2cFlashRequestDeadline))
+	{
+		Wake = Request->I2cFlashRequestDeadline;
+	}
+	I2cFlashSleepUntil(Wake);
+	this_cpu_inc(Dev->PcpuStats->Retries);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashReadPages
+ * CALLED BY:        I2cFlashWorkFunction
+ * DESCRIPTION:      reads the bytes of a read request from the EEPROM
+ *                   with sequential reads of read_chunk bytes each. The
+ *                   read stops at the first chunk it can not get before
+ *                   its deadline, within its retry budget or before it
+ *                   is cancelled, the status and progress of the request
+ *                   tell why and how far it got.
+ * INPUT PARAMETERS: Request : read request to be executed
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashReadPages(I2cFlashDevType *Dev, I2cFlashRequestType *Request)
+{
+    unsigned int Offset = 0; /* bytes of the request read so far */
+    unsigned int Length = 0; /* bytes read in this transfer */
+    unsigned int ChunkSize = I2cFlashReadChunkSize(Dev); /* max bytes per transfer */
+    unsigned int TotalLength = Request->I2cFlashRequestLength;
+    unsigned int Attempt = 0; /* failures of this transfer */
+    int Status = 0; /* For storing read status */
+    int Failure = 0; /* why the request is given up, 0 if it is not */
+    ktime_t StartTime = ktime_get(); /* for the read throughput */
+#ifndef LED_DYNAMIC
+   gpio_set_value_cansleep(26,1);
+#endif
+   for (Offset = 0; Offset < TotalLength; Offset += Length)
+   {
+       Length = ((TotalLength - Offset) < ChunkSize) ? (TotalLength - Offset) : ChunkSize;
+       Failure = I2cFlashRequestExpired(Request);
+       if (0 != Failure)
+       {
+           break;
+       }
+       Attempt = 0;
+    	do
+	   {
+	      trace_i2c_flash_xfer_start(Dev->name,Request->I2cFlashRequestId,PAGENO(Dev,(Request->I2cFlashRequestAddress + Offset)),Length,0);
+#ifdef LED_DYNAMIC
+          /* switch on led */
+          gpio_set_value_cansleep(26,1);
+#endif
+          /* Receive one chunk of data starting at its own address */
+	      Status = I2cFlashBusReadAt(Dev,(Request->I2cFlashRequestAddress + Offset),((Request->I2cFlashRequestBufferPtr) + Offset),Length);
+	      /* Switch off led */
+#ifdef LED_DYNAMIC
+	      gpio_set_value_cansleep(26,0);
+#endif
+	      trace_i2c_flash_xfer_end(Dev->name,Request->I2cFlashRequestId,PAGENO(Dev,(Request->I2cFlashRequestAddress + Offset)),Length,Status);
+          if (Length != Status)
+          {
+              Failure = I2cFlashRetryWait(Dev,Request,Status,++Attempt);
+              if (0 == Failure)
+              {
+                  trace_i2c_flash_retry(Dev->name,Request->I2cFlashRequestId,PAGENO(Dev,(Request->I2cFlashRequestAddress + Offset)),Length,Status);
+              }
+          }
+       }while((Length != Status) && (0 == Failure));
+       if (0 != Failure)
+       {
+           break;
+       }
+   }
+#ifndef LED_DYNAMIC
+   gpio_set_value_cansleep(26,0);
+#endif
+   Request->I2cFlashRequestProgress = Offset;
+   Request->I2cFlashRequestStatus = Failure;
+   Dev->Stats.I2cFlashBytesRead += Offset;
+   Dev->Stats.I2cFlashReadNs += ktime_to_ns(ktime_sub(ktime_get(),StartTime));
+   if (0 != Offset)
+   {
+       this_cpu_add(Dev->PcpuStats->PagesRead,(PAGENO(Dev,(Request->I2cFlashRequestAddress + Offset - 1)) - PAGENO(Dev,Request->I2cFlashRequestAddress) + 1));
+   }
+   I2cFlashHistAdd(Dev,HIST_READ,StartTime);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDedupReadBack
+ * CALLED BY:        I2cFlashWritePages
+ * DESCRIPTION:      in dedup mode 2, reads the bytes of the chunk of a
+ *                   write request about to be written back from the
+ *                   EEPROM with sequential reads, so that pages not known
+ *                   from the shadow image can be compared before writing.
+ *                   A sequential read of a page is much shorter than its
+ *                   write cycle.
+ * INPUT PARAMETERS: Request : write request to be executed
+ *                   Start : first byte of the chunk in the request
+ *                   Bytes : bytes of the chunk
+ * RETURN VALUES:    char * : current contents of the chunk, to be freed
+ *                            by the caller, NULL if not read
+ ***********************************************************************/
+static char *I2cFlashDedupReadBack(I2cFlashDevType *Dev, I2cFlashRequestType *Request, unsigned int Start, unsigned int Bytes)
+{
+	unsigned int Offset = 0; /* bytes read so far */
+	unsigned int Length = 0; /* bytes read in one transfer */
+	unsigned int ChunkSize = 0; /* max bytes per transfer */
+	unsigned int FirstPage = PAGENO(Dev,Request->I2cFlashRequestAddress + Start); /* first page of the chunk */
+	unsigned int EndPage = PAGENO(Dev,Request->I2cFlashRequestAddress + Start + Bytes - 1) + 1; /* page after the chunk */
+	char *ReadBack = NULL; /* current contents of the bytes */
+	if ((2 != I2cFlashDedupMode) || (find_next_zero_bit(Request->I2cFlashRequestUnchanged,EndPage,FirstPage) >= EndPage))
+	{
+		/* not enabled or every page is known from the shadow image */
+		return NULL;
+	}
+	ReadBack = kmalloc(Bytes,GFP_KERNEL);
+	if (NULL == ReadBack)
+	{
+		return NULL;
+	}
+	ChunkSize = I2cFlashReadChunkSize(Dev);
+	for (Offset = 0; Offset < Bytes; Offset += Length)
+	{
+		Length = ((Bytes - Offset) < ChunkSize) ? (Bytes - Offset) : ChunkSize;
+		if (Length != I2cFlashBusReadAt(Dev,(Request->I2cFlashRequestAddress + Start + Offset),(ReadBack + Offset),Length))
+		{
+			/* write every page */
+			kfree(ReadBack);
+			return NULL;
+		}
+	}
+	return ReadBack;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashChunkEnd
+ * CALLED BY:        I2cFlashWritePages, I2cFlashErasePages
+ * DESCRIPTION:      finds where the next chunk of a write or an erase
+ *                   ends, chunk_pages pages after the bytes already done
+ * INPUT PARAMETERS: Request : write or erase being executed
+ * RETURN VALUES:    unsigned int : byte of the request after the chunk
+ ***********************************************************************/
+static unsigned int I2cFlashChunkEnd(I2cFlashDevType *Dev, I2cFlashRequestType *Request)
+{
+	unsigned int End = Request->I2cFlashRequestProgress; /* byte after the pages counted so far */
+	unsigned int Pages = 0; /* pages of the chunk */
+	unsigned int ChunkPages = (0 == I2cFlashChunkPages) ? 1 : I2cFlashChunkPages;
+	for (Pages = 0; (Pages < ChunkPages) && (End < Request->I2cFlashRequestLength); Pages++)
+	{
+		End += I2cFlashPagePart(Dev,(Request->I2cFlashRequestAddress + End),(Request->I2cFlashRequestLength - End));
+	}
+	return End;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashChunkDone
+ * CALLED BY:        I2cFlashWritePages, I2cFlashErasePages
+ * DESCRIPTION:      records the bytes of a write or an erase done so far,
+ *                   under the ring lock since submit looks at them to
+ *                   let high priority reads go first
+ * INPUT PARAMETERS: Request : write or erase being executed
+ *                   End : byte of the request after the chunk done
+ * RETURN VALUES:    int : 1 if the request is complete, 0 otherwise
+ ***********************************************************************/
+static int I2cFlashChunkDone(I2cFlashDevType *Dev, I2cFlashRequestType *Request, unsigned int End)
+{
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	Request->I2cFlashRequestProgress = End;
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	return (End >= Request->I2cFlashRequestLength);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashWritePages
+ * CALLED BY:        I2cFlashWorkFunction
+ * DESCRIPTION:      writes the next chunk of a write request to the
+ *                   EEPROM, from where the previous chunk stopped.
+ *                   The data is split on page boundaries, a part of a
+ *                   page is written as it is since the EEPROM keeps the
+ *                   other bytes of the page untouched. Pages which
+ *                   already hold the data are skipped in dedup mode.
+ *                   The write stops at the first page it can not write
+ *                   before its deadline, within its retry budget or
+ *                   before it is cancelled, its progress tells where.
+ * INPUT PARAMETERS: Request : write request to be executed
+ * RETURN VALUES:    int : 1 once the complete request is written or it
+ *                         failed, 0 if chunks are left
+ ***********************************************************************/
+static int I2cFlashWritePages(I2cFlashDevType *Dev, I2cFlashRequestType *Request)
+{
+    unsigned int Start = Request->I2cFlashRequestProgress; /* first byte of this chunk */
+    unsigned int End = I2cFlashChunkEnd(Dev,Request); /* byte after this chunk */
+    unsigned int Offset = 0; /* bytes of the request written so far */
+    unsigned int Length = 0; /* bytes written in this page */
+    unsigned int EepromAddress = 0; /* address of the first byte in this page */
+    unsigned int PagesTotal = 0; /* pages touched by the request */
+    char *Data = NULL; /* bytes of this page, with room for the address in front */
+    unsigned char Frame[FRAME_HEADER + MAX_PAGESIZE]; /* for a request without page frames */
+    int Status = 0; /* For storing write status */
+    unsigned long PagesWritten = 0; /* pages sent to the EEPROM */
+    unsigned long PagesSkipped = 0; /* pages which already held the data */
+    char *ReadBack = NULL; /* current contents, NULL if not read back */
+    unsigned int Attempt = 0; /* failures of this transfer */
+    int Failure = 0; /* why the request is given up, 0 if it is not */
+    if (0 == Start)
+    {
+        /* write latency from the first chunk on, read back and high priority reads in between included */
+        Request->I2cFlashRequestStartTime = ktime_get();
+    }
+    ReadBack = I2cFlashDedupReadBack(Dev,Request,Start,(End - Start));
+#ifndef LED_DYNAMIC
+   gpio_set_value_cansleep(26,1);
+#endif
+   /* Join the address to the message */
+   for (Offset = Start; Offset < End; Offset += Length)
+   {
+        EepromAddress = Request->I2cFlashRequestAddress + Offset;
+        /* do not cross the page boundary, the EEPROM would wrap within the page */
+        Length = I2cFlashPagePart(Dev,EepromAddress,(Request->I2cFlashRequestLength - Offset));
+        Data = I2cFlashRequestData(Dev,Request,Offset);
+        /* nothing to do if the page already holds the data, saves a write cycle */
+        if (test_bit(PAGENO(Dev,EepromAddress),Request->I2cFlashRequestUnchanged) ||
+            ((NULL != ReadBack) && (0 == memcmp((ReadBack + Offset - Start),Data,Length))))
+        {
+            PagesSkipped++;
+            continue;
+        }
+        if (NULL == Request->I2cFlashRequestFrames)
+        {
+            /* the buffer has no room for the address */
+            memcpy(&Frame[FRAME_HEADER],Data,Length);
+            Data = (char *)&Frame[FRAME_HEADER];
+            this_cpu_add(Dev->PcpuStats->BytesCopied,Length);
+        }
+        Failure = I2cFlashRequestExpired(Request);
+        if (0 != Failure)
+        {
+            break;
+        }
+        Attempt = 0;
+	    do
+	    {
+	       trace_i2c_flash_xfer_start(Dev->name,Request->I2cFlashRequestId,PAGENO(Dev,EepromAddress),Length,0);
+#ifdef LED_DYNAMIC
+           gpio_set_value_cansleep(26,1);
+#endif
+           /* Send the data along with the adress pointer */
+	       Status = I2cFlashBusWritePage(Dev,EepromAddress,Data,Length);
+#ifdef LED_DYNAMIC
+	       gpio_set_value_cansleep(26,0);
+#endif
+	       trace_i2c_flash_xfer_end(Dev->name,Request->I2cFlashRequestId,PAGENO(Dev,EepromAddress),Length,Status);
+           if (Length != Status)
+           {
+               Failure = I2cFlashRetryWait(Dev,Request,Status,++Attempt);
+               if (0 == Failure)
+               {
+                   trace_i2c_flash_retry(Dev->name,Request->I2cFlashRequestId,PAGENO(Dev,EepromAddress),Length,Status);
+               }
+           }
+        }while((Length != Status) && (0 == Failure));
+        if (0 != Failure)
+        {
+            break;
+        }
+        PagesWritten++;
+    }
+#ifndef LED_DYNAMIC
+   gpio_set_value_cansleep(26,0);
+#endif
+   kfree(ReadBack);
+   Dev->Stats.I2cFlashWritePagesSkipped += PagesSkipped;
+   this_cpu_add(Dev->PcpuStats->PagesWritten,PagesWritten);
+   Request->I2cFlashRequestPagesDone += PagesWritten;
+   if (0 != Failure)
+   {
+       /* the page at Offset and the ones after it are not written */
+       Request->I2cFlashRequestStatus = Failure;
+       I2cFlashChunkDone(Dev,Request,Offset);
+       return 1;
+   }
+   if (!I2cFlashChunkDone(Dev,Request,End))
+   {
+       return 0;
+   }
+   PagesTotal = PAGENO(Dev,(Request->I2cFlashRequestAddress + Request->I2cFlashRequestLength - 1)) - PAGENO(Dev,Request->I2cFlashRequestAddress) + 1;
+   Dev->Stats.I2cFlashLastWritePagesWritten = Request->I2cFlashRequestPagesDone;
+   Dev->Stats.I2cFlashLastWritePagesSkipped = PagesTotal - Request->I2cFlashRequestPagesDone;
+   I2cFlashHistAdd(Dev,HIST_WRITE,Request->I2cFlashRequestStartTime);
+   return 1;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashErasePages
+ * CALLED BY:        I2cFlashWorkFunction
+ * DESCRIPTION:      writes 0xFF to the pages of the next chunk of an
+ *                   erase request which are not blank already, from
+ *                   where the previous chunk stopped. Like a write, it
+ *                   stops at the first page it can not erase in time.
+ * INPUT PARAMETERS: Request : erase request to be executed
+ * RETURN VALUES:    int : 1 once the complete range is erased or the
+ *                         erase failed, 0 if chunks are left
+ ***********************************************************************/
+static int I2cFlashErasePages(I2cFlashDevType *Dev, I2cFlashRequestType *Request)
+{
+    unsigned int End = I2cFlashChunkEnd(Dev,Request); /* byte after this chunk */
+    unsigned int PageNumber = 0; /* page being erased */
+    unsigned int PagesRequested = Request->I2cFlashRequestLength >> Dev->PageShift; /* pages of the erase */
+    int Status = 0; /* For storing write status */
+    unsigned long PagesErased = 0; /* pages actually written */
+    unsigned int Attempt = 0; /* failures of this transfer */
+    int Failure = 0; /* why the request is given up, 0 if it is not */
+    if (0 == Request->I2cFlashRequestProgress)
+    {
+        /* to report the erase duration, high priority reads in between included */
+        Request->I2cFlashRequestStartTime = ktime_get();
+    }
+#ifndef LED_DYNAMIC
+   gpio_set_value_cansleep(26,1);
+#endif
+   /* Join the address to the message */
+   for (PageNumber = PAGENO(Dev,Request->I2cFlashRequestAddress + Request->I2cFlashRequestProgress);
+        PageNumber < PAGENO(Dev,Request->I2cFlashRequestAddress + End); PageNumber++)
+   {
+       /* nothing to do for a page which is already blank */
+       if (!test_bit(PageNumber,Dev->DirtyPages))
+       {
+           continue;
+       }
+       Failure = I2cFlashRequestExpired(Request);
+       if (0 != Failure)
+       {
+           break;
+       }
+       Attempt = 0;
+	   do
+	   {
+	      trace_i2c_flash_xfer_start(Dev->name,Request->I2cFlashRequestId,PageNumber,Dev->PageSize,0);
+#ifdef LED_DYNAMIC
+           gpio_set_value_cansleep(26,1);
+#endif
+	      Status = I2cFlashBusWritePage(Dev,JOIN(Dev,PageNumber,0x00),(char *)&Dev->BlankFrame[FRAME_HEADER],Dev->PageSize);
+#ifdef LED_DYNAMIC
+	       gpio_set_value_cansleep(26,0);
+#endif
+	      trace_i2c_flash_xfer_end(Dev->name,Request->I2cFlashRequestId,PageNumber,Dev->PageSize,Status);
+          if (Dev->PageSize != Status)
+          {
+              Failure = I2cFlashRetryWait(Dev,Request,Status,++Attempt);
+              if (0 == Failure)
+              {
+                  trace_i2c_flash_retry(Dev->name,Request->I2cFlashRequestId,PageNumber,Dev->PageSize,Status);
+              }
+          }
+       }while((Dev->PageSize != Status) && (0 == Failure));
+       if (0 != Failure)
+       {
+           break;
+       }
+       PagesErased++;
+   }
+#ifndef LED_DYNAMIC
+   gpio_set_value_cansleep(26,0);
+#endif
+   this_cpu_add(Dev->PcpuStats->PagesErased,PagesErased);
+   Request->I2cFlashRequestPagesDone += PagesErased;
+   if (0 != Failure)
+   {
+       /* PageNumber and the pages after it are not erased */
+       Request->I2cFlashRequestStatus = Failure;
+       I2cFlashChunkDone(Dev,Request,(JOIN(Dev,PageNumber,0x00) - Request->I2cFlashRequestAddress));
+       return 1;
+   }
+   if (!I2cFlashChunkDone(Dev,Request,End))
+   {
+       return 0;
+   }
+   Dev->Stats.I2cFlashLastErasePagesErased = Request->I2cFlashRequestPagesDone;
+   Dev->Stats.I2cFlashLastErasePagesSkipped = PagesRequested - Request->I2cFlashRequestPagesDone;
+   Dev->Stats.I2cFlashErasePagesSkipped += PagesRequested - Request->I2cFlashRequestPagesDone;
+   Dev->Stats.I2cFlashLastEraseUs = ktime_to_us(ktime_sub(ktime_get(),Request->I2cFlashRequestStartTime));
+   I2cFlashHistAdd(Dev,HIST_ERASE,Request->I2cFlashRequestStartTime);
+#ifdef DEBUG
+   printk("\n Erase done : %lu pages erased, %lu skipped in %llu us",Request->I2cFlashRequestPagesDone,
+          Dev->Stats.I2cFlashLastErasePagesSkipped,Dev->Stats.I2cFlashLastEraseUs);
+#endif
+   return 1;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashScanBlankPages
+ * CALLED BY:        I2cFlashProbe
+ * DESCRIPTION:      reads the complete EEPROM with sequential reads and
+ *                   marks every page holding data other than 0xFF as
+ *                   dirty. If the EEPROM can not be read, all pages are
+ *                   taken as dirty so that erase still rewrites them.
+ *                   The data read fills the shadow image and the page
+ *                   CRCs as well.
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashScanBlankPages(I2cFlashDevType *Dev)
+{
+	unsigned int Offset = 0; /* bytes scanned so far */
+	unsigned int Length = 0; /* bytes read in one transfer */
+	unsigned int ChunkSize = 0; /* max bytes per transfer */
+	unsigned short PageNumber = 0; /* page being checked */
+	char *ScanBuffer = vmalloc(Dev->Size); /* image of the EEPROM */
+	bitmap_fill(Dev->DirtyPages,Dev->PageCount);
+	if (NULL == ScanBuffer)
+	{
+		return;
+	}
+	mutex_lock(&Dev->BusLock);
+	ChunkSize = I2cFlashReadChunkSize(Dev);
+	for (Offset = 0; Offset < Dev->Size; Offset += Length)
+	{
+		Length = ((Dev->Size - Offset) < ChunkSize) ? (Dev->Size - Offset) : ChunkSize;
+		if (Length != I2cFlashBusReadAt(Dev,Offset,(ScanBuffer + Offset),Length))
+		{
+			printk(KERN_WARNING "\n i2c_flash: blank check failed, erase rewrites every page");
+			break;
+		}
+	}
+	if (Dev->Size <= Offset)
+	{
+		for (PageNumber = 0; PageNumber < Dev->PageCount; PageNumber++)
+		{
+			if (NULL == memchr_inv((ScanBuffer + JOIN(Dev,PageNumber,0x00)),0xFF,Dev->PageSize))
+			{
+				__clear_bit(PageNumber,Dev->DirtyPages);
+			}
+		}
+		/* the scan has read the complete EEPROM, use it to fill the shadow image */
+		spin_lock(&Dev->Queue.I2cFlashRingLock);
+		I2cFlashShadowCopy(Dev,0,Dev->Size,ScanBuffer);
+		I2cFlashCrcUpdate(Dev,0,Dev->Size,ScanBuffer,0);
+		spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	}
+	mutex_unlock(&Dev->BusLock);
+	vfree(ScanBuffer);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashManifestDigest
+ * CALLED BY:        FLASHDIGEST of ioctl, I2cFlashManifestLoad and
+ *                   I2cFlashManifestStore
+ * DESCRIPTION:      CRC32C of the CRCs of a range of pages, each taken
+ *                   as 4 bytes little endian, so that a digest costs 4
+ *                   bytes per page instead of a read of the EEPROM
+ * INPUT PARAMETERS: FirstPage : first page of the range
+ *                   Count : pages of the range, all of them known
+ * RETURN VALUES:    u32 : digest
+ ***********************************************************************/
+static u32 I2cFlashManifestDigest(I2cFlashDevType *Dev, unsigned int FirstPage, unsigned int Count)
+{
+	unsigned int PageNumber = 0; /* page being added */
+	__le32 Entry = 0; /* its CRC as it is stored */
+	u32 Crc = ~0U;
+	for (PageNumber = FirstPage; PageNumber < (FirstPage + Count); PageNumber++)
+	{
+		Entry = cpu_to_le32(Dev->PageCrc[PageNumber]);
+		Crc = crc32c(Crc,&Entry,sizeof(Entry));
+	}
+	return ~Crc;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashManifestVerify
+ * CALLED BY:        FLASHVERIFY of ioctl
+ * DESCRIPTION:      reads back the pages of a range whose CRC is suspect
+ *                   or not known, through the queue like any read, and
+ *                   compares them with their CRC. The CRCs are then
+ *                   those of what the EEPROM holds. Pages written while
+ *                   they are read are read once more.
+ * INPUT PARAMETERS: FirstPage : first page of the range
+ *                   Count : pages of the range
+ * RETURN VALUES:    long : pages which did not match their CRC, or the
+ *                          error code of a failed or interrupted read
+ ***********************************************************************/
+static long I2cFlashManifestVerify(I2cFlashDevType *Dev, unsigned int FirstPage, unsigned int Count)
+{
+	DECLARE_BITMAP(Check, MAX_PAGECOUNT); /* pages to be read back */
+	I2cFlashRequestType *Request = NULL; /* read of a run of such pages */
+	unsigned int PageNumber = FirstPage; /* first page of the run */
+	unsigned int RunEnd = 0; /* page after the run */
+	unsigned int Index = 0; /* page being compared */
+	unsigned char Compared = 0; /* the run was read without a write in between */
+	long Mismatches = 0;
+	int RetValue = 0; /* outcome of a read */
+	u32 Crc = 0;
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	bitmap_complement(Check,Dev->CrcKnown,Dev->PageCount);
+	bitmap_or(Check,Check,Dev->CrcSuspect,Dev->PageCount);
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	while ((PageNumber = find_next_bit(Check,(FirstPage + Count),PageNumber)) < (FirstPage + Count))
+	{
+		/* at most a kernel page per read, like a fault of the mapped image */
+		RunEnd = find_next_zero_bit(Check,min(FirstPage + Count,PageNumber + (unsigned int)(PAGE_SIZE >> Dev->PageShift)),PageNumber);
+		Compared = 0;
+		while (0 == Compared)
+		{
+			Request = kzalloc(sizeof(I2cFlashRequestType),GFP_KERNEL);
+			if (NULL != Request)
+			{
+				Request->I2cFlashRequestBufferPtr = (char*)kmalloc(((RunEnd - PageNumber) << Dev->PageShift),GFP_KERNEL);
+			}
+			if ((NULL == Request) || (NULL == Request->I2cFlashRequestBufferPtr))
+			{
+				kfree(Request);
+				return -ENOMEM;
+			}
+			Request->I2cFlashRequestState = I2CFLASHREAD;
+			Request->I2cFlashRequestAddress = JOIN(Dev,PageNumber,0x00);
+			Request->I2cFlashRequestLength = (RunEnd - PageNumber) << Dev->PageShift;
+			RetValue = I2cFlashSubmitAndWait(Dev,Request,NULL);
+			if (-EINTR == RetValue)
+			{
+				/* killed, the work function frees the request */
+				return RetValue;
+			}
+			if ((0 == RetValue) && (0 != Request->I2cFlashRequestStatus))
+			{
+				RetValue = Request->I2cFlashRequestStatus;
+			}
+			if (0 != RetValue)
+			{
+				I2cFlashFreeRequest(Request);
+				return RetValue;
+			}
+			spin_lock(&Dev->Queue.I2cFlashRingLock);
+			if (Request->I2cFlashRequestShadowGeneration == Dev->ShadowGeneration)
+			{
+				for (Index = PageNumber; Index < RunEnd; Index++)
+				{
+					Crc = I2cFlashPageCrc(Dev,(Request->I2cFlashRequestBufferPtr + JOIN(Dev,(Index - PageNumber),0x00)));
+					if (test_bit(Index,Dev->CrcKnown) && (Crc != Dev->PageCrc[Index]))
+					{
+						Mismatches++;
+					}
+					Dev->PageCrc[Index] = Crc;
+					__set_bit(Index,Dev->CrcKnown);
+					__clear_bit(Index,Dev->CrcSuspect);
+				}
+				Compared = 1;
+			}
+			spin_unlock(&Dev->Queue.I2cFlashRingLock);
+			I2cFlashFreeRequest(Request);
+		}
+		PageNumber = RunEnd;
+	}
+	return Mismatches;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashManifestWrite
+ * CALLED BY:        I2cFlashManifestLoad, I2cFlashManifestStore with the
+ *                   bus lock held
+ * DESCRIPTION:      writes the first pages of the manifest to the pages
+ *                   kept for it, a NACK while the previous page is in
+ *                   its write cycle is tried again
+ * INPUT PARAMETERS: Manifest : header and table, whole pages
+ *                   Pages : pages to be written
+ * RETURN VALUES:    int : 0 if written, the bus error otherwise
+ ***********************************************************************/
+static int I2cFlashManifestWrite(I2cFlashDevType *Dev, const char *Manifest, unsigned int Pages)
+{
+	unsigned char Frame[FRAME_HEADER + MAX_PAGESIZE]; /* page with room for the address */
+	unsigned int Index = 0; /* page of the manifest */
+	unsigned int Attempt = 0; /* failures of this page */
+	int Status = 0;
+	for (Index = 0; Index < Pages; Index++)
+	{
+		memcpy(&Frame[FRAME_HEADER],(Manifest + JOIN(Dev,Index,0x00)),Dev->PageSize);
+		for (Attempt = 0; Attempt <= I2cFlashRetryBudget; Attempt++)
+		{
+			Status = I2cFlashBusWritePage(Dev,JOIN(Dev,(Dev->ManifestPage + Index),0x00),(char *)&Frame[FRAME_HEADER],Dev->PageSize);
+			if (Dev->PageSize == Status)
+			{
+				break;
+			}
+			I2cFlashSleepUntil(ktime_add_us(ktime_get(),I2cFlashAckPollIntervalUs));
+		}
+		if (Dev->PageSize != Status)
+		{
+			printk(KERN_WARNING "\n %s: manifest not stored, the next probe reads the whole chip",Dev->name);
+			return Status;
+		}
+	}
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashManifestLoad
+ * CALLED BY:        I2cFlashProbe
+ * DESCRIPTION:      takes the page CRCs from the manifest stored when
+ *                   the chip was last removed, instead of reading the
+ *                   whole chip. The blank pages follow from the CRCs.
+ *                   The stored manifest is marked as used right away,
+ *                   so that after a crash the next probe does not trust
+ *                   it anymore.
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    int : 1 if the CRCs are loaded, 0 if the chip has to
+ *                         be scanned
+ ***********************************************************************/
+static int I2cFlashManifestLoad(I2cFlashDevType *Dev)
+{
+	unsigned int Bytes = Dev->ManifestPages << Dev->PageShift; /* bytes of the manifest */
+	unsigned int Offset = 0; /* bytes read so far */
+	unsigned int Length = 0; /* bytes read in one transfer */
+	unsigned int ChunkSize = 0; /* max bytes per transfer */
+	unsigned int PageNumber = 0; /* page whose CRC is taken */
+	I2cFlashManifestHeaderType *Header = NULL; /* start of the manifest */
+	__le32 *Table = NULL; /* CRC of every page */
+	char *Manifest = NULL;
+	int Loaded = 0;
+	if (0 == Dev->ManifestPages)
+	{
+		return 0;
+	}
+	Manifest = kmalloc(Bytes,GFP_KERNEL);
+	if (NULL == Manifest)
+	{
+		return 0;
+	}
+	Header = (I2cFlashManifestHeaderType *)Manifest;
+	Table = (__le32 *)(Manifest + sizeof(I2cFlashManifestHeaderType));
+	mutex_lock(&Dev->BusLock);
+	ChunkSize = I2cFlashReadChunkSize(Dev);
+	for (Offset = 0; Offset < Bytes; Offset += Length)
+	{
+		Length = ((Bytes - Offset) < ChunkSize) ? (Bytes - Offset) : ChunkSize;
+		if (Length != I2cFlashBusReadAt(Dev,(JOIN(Dev,Dev->ManifestPage,0x00) + Offset),(Manifest + Offset),Length))
+		{
+			break;
+		}
+	}
+	if ((Bytes <= Offset) && (MANIFEST_MAGIC == le32_to_cpu(Header->Magic)) &&
+	    (Dev->PageCount == le16_to_cpu(Header->PageCount)) && (1 == Header->Clean))
+	{
+		for (PageNumber = 0; PageNumber < Dev->PageCount; PageNumber++)
+		{
+			Dev->PageCrc[PageNumber] = le32_to_cpu(Table[PageNumber]);
+		}
+		if (I2cFlashManifestDigest(Dev,0,Dev->PageCount) == le32_to_cpu(Header->TableCrc))
+		{
+			Header->Clean = 0;
+			Loaded = (0 == I2cFlashManifestWrite(Dev,Manifest,1));
+		}
+	}
+	if (Loaded)
+	{
+		bitmap_fill(Dev->CrcKnown,Dev->PageCount);
+		for (PageNumber = 0; PageNumber < Dev->PageCount; PageNumber++)
+		{
+			if (Dev->BlankCrc != Dev->PageCrc[PageNumber])
+			{
+				__set_bit(PageNumber,Dev->DirtyPages);
+			}
+		}
+	}
+	mutex_unlock(&Dev->BusLock);
+	kfree(Manifest);
+	return Loaded;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashManifestStore
+ * CALLED BY:        I2cFlashRemove once the queue is drained
+ * DESCRIPTION:      stores the page CRCs in the pages kept for them. It
+ *                   is marked clean only if every CRC is known to match
+ *                   the EEPROM, otherwise the next probe reads the chip.
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashManifestStore(I2cFlashDevType *Dev)
+{
+	char *Manifest = kzalloc((Dev->ManifestPages << Dev->PageShift),GFP_KERNEL); /* header and table */
+	I2cFlashManifestHeaderType *Header = (I2cFlashManifestHeaderType *)Manifest; /* start of the manifest */
+	__le32 *Table = (__le32 *)(Manifest + sizeof(I2cFlashManifestHeaderType)); /* CRC of every page */
+	unsigned int PageNumber = 0; /* page whose CRC is stored */
+	if (NULL == Manifest)
+	{
+		return;
+	}
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	Header->Magic = cpu_to_le32(MANIFEST_MAGIC);
+	Header->PageCount = cpu_to_le16(Dev->PageCount);
+	Header->Clean = (bitmap_full(Dev->CrcKnown,Dev->PageCount) && bitmap_empty(Dev->CrcSuspect,Dev->PageCount));
+	Header->TableCrc = cpu_to_le32(I2cFlashManifestDigest(Dev,0,Dev->PageCount));
+	for (PageNumber = 0; PageNumber < Dev->PageCount; PageNumber++)
+	{
+		Table[PageNumber] = cpu_to_le32(Dev->PageCrc[PageNumber]);
+	}
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	mutex_lock(&Dev->BusLock);
+	I2cFlashManifestWrite(Dev,Manifest,Dev->ManifestPages);
+	mutex_unlock(&Dev->BusLock);
+	kfree(Manifest);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashRequestFailed
+ * CALLED BY:        I2cFlashCompleteRequest with the ring lock held
+ * DESCRIPTION:      cleans up after a request which stopped before its
+ *                   last byte. The shadow image got the data of a write
+ *                   or erase when it was queued, the pages it did not
+ *                   reach are taken out of the image so that they are
+ *                   read from the EEPROM again and become suspect for
+ *                   FLASHVERIFY, and the page it stopped at may be
+ *                   written partly, queued writes may not skip them. The
+ *                   error of a write or erase is kept in its file for
+ *                   FLASHWAIT and fsync, a blocking write or erase
+ *                   also gets its own, reads give it right away.
+ * INPUT PARAMETERS: Request : request with a status other than 0
+ *                   Started : the work function has executed a part of it
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashRequestFailed(I2cFlashDevType *Dev, I2cFlashRequestType *Request, unsigned char Started)
+{
+	I2cFlashFileType *FilePrivate = Request->I2cFlashRequestFile; /* file which queued the request */
+	unsigned int Stopped = Request->I2cFlashRequestAddress + Request->I2cFlashRequestProgress; /* first byte not done */
+	if (-ETIMEDOUT == Request->I2cFlashRequestStatus)
+	{
+		this_cpu_inc(Dev->PcpuStats->Timeouts);
+	}
+	else if (-ECANCELED == Request->I2cFlashRequestStatus)
+	{
+		this_cpu_inc(Dev->PcpuStats->Cancellations);
+	}
+	else
+	{
+		this_cpu_inc(Dev->PcpuStats->Failures);
+	}
+	if (I2CFLASHREAD == Request->I2cFlashRequestState)
+	{
+		return;
+	}
+	if (Request->I2cFlashRequestProgress < Request->I2cFlashRequestLength)
+	{
+		bitmap_clear(Dev->ShadowValid,PAGENO(Dev,Stopped),
+		             (PAGENO(Dev,(Request->I2cFlashRequestAddress + Request->I2cFlashRequestLength - 1)) - PAGENO(Dev,Stopped) + 1));
+		/* their CRCs are those of the data asked for */
+		bitmap_set(Dev->CrcSuspect,PAGENO(Dev,Stopped),
+		           (PAGENO(Dev,(Request->I2cFlashRequestAddress + Request->I2cFlashRequestLength - 1)) - PAGENO(Dev,Stopped) + 1));
+		/* later writes of the same data were marked unchanged against it */
+		I2cFlashDedupForget(Dev,Stopped,(Request->I2cFlashRequestLength - Request->I2cFlashRequestProgress));
+		Dev->ShadowGeneration++;
+	}
+	if (Started && (Request->I2cFlashRequestProgress < Request->I2cFlashRequestLength))
+	{
+		/* only the work function changes the dirty pages */
+		__set_bit(PAGENO(Dev,Stopped),Dev->DirtyPages);
+	}
+	if ((NULL != FilePrivate) && (NULL == Request->I2cFlashRequestIocb))
+	{
+		/* the first error is kept until it is reported */
+		if (0 == FilePrivate->I2cFlashFileError)
+		{
+			FilePrivate->I2cFlashFileError = Request->I2cFlashRequestStatus;
+			FilePrivate->I2cFlashFileFirstErrorId = Request->I2cFlashRequestId;
+		}
+		FilePrivate->I2cFlashFileErrorId = Request->I2cFlashRequestId;
+		FilePrivate->I2cFlashFileErrorStatus = Request->I2cFlashRequestStatus;
+		FilePrivate->I2cFlashFileErrorProgress = Request->I2cFlashRequestProgress;
+	}
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashCompleteRequest
+ * CALLED BY:        I2cFlashWorkFunction, I2cFlashCancelRequests
+ * DESCRIPTION:      hands a request out of the queue, executed, failed
+ *                   or cancelled, back to whoever waits for it, or frees
+ *                   it if nobody does, and wakes up the readers, pollers
+ *                   and FLASHWAIT callers
+ * INPUT PARAMETERS: Request : request taken out of the queue
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashCompleteRequest(I2cFlashDevType *Dev, I2cFlashRequestType *Request)
+{
+	I2cFlashRequestType *IocbRequest = NULL; /* executed request of read_iter/write_iter */
+	unsigned char Started = 0; /* taken by the work function, not cancelled while queued */
+	trace_i2c_flash_complete(Dev->name,Request->I2cFlashRequestId,Request->I2cFlashRequestState,PAGENO(Dev,Request->I2cFlashRequestAddress),
+	                         Request->I2cFlashRequestLength,Request->I2cFlashRequestStatus);
+	/* Hand the request back to whoever waits for it */
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	if (Request == Dev->Queue.I2cFlashLongRequest)
+	{
+		Dev->Queue.I2cFlashLongRequest = NULL;
+	}
+	if (Request == Dev->Queue.I2cFlashActiveRequest)
+	{
+		Dev->Queue.I2cFlashActiveRequest = NULL;
+		Started = 1;
+	}
+	Dev->Queue.I2cFlashLastCompletedId = I2cFlashOldestPendingId(Dev) - 1;
+	if (0 != Request->I2cFlashRequestStatus)
+	{
+		I2cFlashRequestFailed(Dev,Request,Started);
+	}
+	if (NULL != Request->I2cFlashRequestIocb)
+	{
+		/* completed below, copying to the user may sleep */
+		IocbRequest = Request;
+		Request = NULL;
+	}
+	else if (NULL != Request->I2cFlashRequestDone)
+	{
+		if (I2CFLASHREAD == Request->I2cFlashRequestState)
+		{
+			Request->I2cFlashRequestState = I2CFLASHDATAREADY;
+		}
+		complete(Request->I2cFlashRequestDone);
+		Request = NULL;
+	}
+	else if ((I2CFLASHREAD == Request->I2cFlashRequestState) && (NULL != Request->I2cFlashRequestOwner))
+	{
+		/* Change the state to READ DATA READY state, data is collected by the read function */
+		Request->I2cFlashRequestState = I2CFLASHDATAREADY;
+		Request = NULL;
+	}
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	if (NULL != IocbRequest)
+	{
+		I2cFlashCompleteIocb(IocbRequest);
+	}
+	/* readers, pollers and FLASHWAIT callers are woken up, a slot of the queue is free too */
+	wake_up_interruptible_all(&Dev->Queue.I2cFlashWaitQueue);
+	/* Free up the memory which was allocated in the .write function or by the closed file */
+	if (NULL != Request)
+	{
+		I2cFlashFreeRequest(Request);
+	}
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashCancelMatches
+ * CALLED BY:        I2cFlashCancelRequests with the ring lock held
+ * DESCRIPTION:      tells whether a request is one FLASHCANCEL of a file
+ *                   asks for, a request of the file or one of its
+ *                   read-ahead windows, with the given id or any id
+ * INPUT PARAMETERS: Request : request in the queue
+ *                   FilePrivate : file cancelling
+ *                   RequestId : id to cancel, 0 for every request
+ * RETURN VALUES:    int : 1 if it is to be cancelled, 0 otherwise
+ ***********************************************************************/
+static int I2cFlashCancelMatches(I2cFlashRequestType *Request, I2cFlashFileType *FilePrivate, unsigned int RequestId)
+{
+	return ((NULL != Request) && ((FilePrivate == Request->I2cFlashRequestFile) || (FilePrivate == Request->I2cFlashRequestOwner)) &&
+	        ((0 == RequestId) || ((unsigned int)Request->I2cFlashRequestId == RequestId)));
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashCancelRing
+ * CALLED BY:        I2cFlashCancelRequests with the ring lock held
+ * DESCRIPTION:      takes the requests to be cancelled out of one ring
+ *                   buffer, the others close up in their order
+ * INPUT PARAMETERS: Ring : ring buffer
+ *                   ReadIndex, WriteIndex, Count : indexes and requests of
+ *                                                  the ring, updated
+ *                   Cancelled : filled with the requests taken out
+ *                   FilePrivate, RequestId : as for I2cFlashCancelMatches
+ * RETURN VALUES:    unsigned int : number of requests taken out
+ ***********************************************************************/
+static unsigned int I2cFlashCancelRing(I2cFlashDevType *Dev, I2cFlashRequestType **Ring, unsigned int *ReadIndex,
+                                       unsigned int *WriteIndex, unsigned int Count, I2cFlashRequestType **Cancelled,
+                                       I2cFlashFileType *FilePrivate, unsigned int RequestId)
+{
+	unsigned int Depth = Dev->Queue.I2cFlashRingDepth;
+	unsigned int Index = 0;
+	unsigned int Kept = 0; /* requests left in the ring */
+	unsigned int Taken = 0; /* requests taken out */
+	I2cFlashRequestType *Request = NULL;
+	for (Index = 0; Index < Count; Index++)
+	{
+		Request = Ring[(*ReadIndex + Index) % Depth];
+		if (I2cFlashCancelMatches(Request,FilePrivate,RequestId))
+		{
+			Cancelled[Taken++] = Request;
+		}
+		else
+		{
+			Ring[(*ReadIndex + Kept++) % Depth] = Request;
+		}
+	}
+	*WriteIndex = (*ReadIndex + Kept) % Depth;
+	return Taken;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashCancelRequests
+ * CALLED BY:        I2cFlashDriverIoctl for FLASHCANCEL, I2cFlashWaitResult
+ * DESCRIPTION:      cancels requests of a file. Those still in the queue
+ *                   are taken out and completed with -ECANCELED right
+ *                   away, without going to the bus. The one the work
+ *                   function is executing, or the write or erase paused
+ *                   between two chunks, stops before its next transfer
+ *                   and completes with -ECANCELED and the bytes it got
+ *                   done.
+ * INPUT PARAMETERS: FilePrivate : file cancelling
+ *                   RequestId : id of the request, 0 for every request
+ *                               of the file
+ * RETURN VALUES:    int : number of requests cancelled, -ENOMEM
+ ***********************************************************************/
+static int I2cFlashCancelRequests(I2cFlashFileType *FilePrivate, unsigned int RequestId)
+{
+	I2cFlashDevType *Dev = FilePrivate->I2cFlashFileDev; /* chip of the file */
+	I2cFlashRequestType **Cancelled = NULL; /* requests taken out of the queue */
+	unsigned int Taken = 0; /* requests taken out */
+	unsigned int Index = 0;
+	int Stopped = 0; /* requests being executed which stop */
+	Cancelled = kmalloc_array(Dev->Queue.I2cFlashRingDepth,sizeof(I2cFlashRequestType*),GFP_KERNEL);
+	if (NULL == Cancelled)
+	{
+		return -ENOMEM;
+	}
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	Taken = I2cFlashCancelRing(Dev,Dev->Queue.I2cFlashRequestRing,&Dev->Queue.I2cFlashRingReadIndex,&Dev->Queue.I2cFlashRingWriteIndex,
+	                           (Dev->Queue.I2cFlashRingCount - Dev->Queue.I2cFlashPriorityCount),Cancelled,FilePrivate,RequestId);
+	Index = I2cFlashCancelRing(Dev,Dev->Queue.I2cFlashPriorityRing,&Dev->Queue.I2cFlashPriorityReadIndex,
+	                           &Dev->Queue.I2cFlashPriorityWriteIndex,Dev->Queue.I2cFlashPriorityCount,(Cancelled + Taken),
+	                           FilePrivate,RequestId);
+	Dev->Queue.I2cFlashPriorityCount -= Index;
+	Taken += Index;
+	Dev->Queue.I2cFlashRingCount -= Taken;
+	if (I2cFlashCancelMatches(Dev->Queue.I2cFlashActiveRequest,FilePrivate,RequestId))
+	{
+		WRITE_ONCE(Dev->Queue.I2cFlashActiveRequest->I2cFlashRequestCancelled,1);
+		Stopped++;
+	}
+	if ((Dev->Queue.I2cFlashLongRequest != Dev->Queue.I2cFlashActiveRequest) &&
+	    I2cFlashCancelMatches(Dev->Queue.I2cFlashLongRequest,FilePrivate,RequestId))
+	{
+		WRITE_ONCE(Dev->Queue.I2cFlashLongRequest->I2cFlashRequestCancelled,1);
+		Stopped++;
+	}
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	for (Index = 0; Index < Taken; Index++)
+	{
+		Cancelled[Index]->I2cFlashRequestStatus = -ECANCELED;
+		I2cFlashCompleteRequest(Dev,Cancelled[Index]);
+	}
+	kfree(Cancelled);
+	return Taken + Stopped;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashWorkFunction
+ * CALLED BY:        Kernel work queue
+ * DESCRIPTION:      Executes the requests of the ring buffer back to back
+ *                   until it becomes empty. Writes and erases are done
+ *                   chunk_pages pages at a time, the high priority reads
+ *                   queued in the meantime go between two chunks. After
+ *                   queue_depth such reads the write or erase gets its
+ *                   next chunk anyway, so it is never starved.
+ * INPUT PARAMETERS: work ptr: Pointer to the work structure
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void I2cFlashWorkFunction(struct work_struct *work)
+{
+    I2cFlashDevType *Dev = container_of(work, I2cFlashDevType, Work); /* chip whose queue is drained */
+    I2cFlashRequestType *Request = NULL; /* request being executed */
+    unsigned long long CpuStart; /* cpu time of this thread when draining started */
+    unsigned long RequestId = 0; /* id of the request being executed */
+    unsigned int PriorityServed = 0; /* high priority reads done since the last chunk of a write or erase */
+    unsigned char Finished = 1; /* the request is done, not only a chunk of it */
+    mutex_lock(&Dev->BusLock);
+    CpuStart = current->se.sum_exec_runtime;
+    while (1)
+    {
+		spin_lock(&Dev->Queue.I2cFlashRingLock);
+		if ((0 != Dev->Queue.I2cFlashPriorityCount) &&
+		    ((NULL == Dev->Queue.I2cFlashLongRequest) || (PriorityServed < Dev->Queue.I2cFlashRingDepth)))
+		{
+			/* a high priority read goes first, even between two chunks of a write or an erase */
+			Request = Dev->Queue.I2cFlashPriorityRing[Dev->Queue.I2cFlashPriorityReadIndex];
+			Dev->Queue.I2cFlashPriorityReadIndex = (Dev->Queue.I2cFlashPriorityReadIndex + 1) % Dev->Queue.I2cFlashRingDepth;
+			Dev->Queue.I2cFlashPriorityCount--;
+			Dev->Queue.I2cFlashRingCount--;
+			if ((NULL != Dev->Queue.I2cFlashLongRequest) && (0 == PriorityServed++))
+			{
+				this_cpu_inc(Dev->PcpuStats->Preemptions);
+			}
+		}
+		else if (NULL != Dev->Queue.I2cFlashLongRequest)
+		{
+			/* resume the write or erase where its last chunk stopped */
+			Request = Dev->Queue.I2cFlashLongRequest;
+			PriorityServed = 0;
+		}
+		else if (Dev->Queue.I2cFlashRingCount > Dev->Queue.I2cFlashPriorityCount)
+		{
+			/* Take the oldest request out of the ring buffer */
+			Request = Dev->Queue.I2cFlashRequestRing[Dev->Queue.I2cFlashRingReadIndex];
+			Dev->Queue.I2cFlashRingReadIndex = (Dev->Queue.I2cFlashRingReadIndex + 1) % Dev->Queue.I2cFlashRingDepth;
+			Dev->Queue.I2cFlashRingCount--;
+			if ((I2CFLASHWRITE == Request->I2cFlashRequestState) || (I2CFLASHERASE == Request->I2cFlashRequestState))
+			{
+				Dev->Queue.I2cFlashLongRequest = Request;
+			}
+		}
+		else
+		{
+			/* Be the last statement, EEPROM is free for new requests */
+			Dev->Queue.I2cFlashReadOrWrite = NONE;
+			spin_unlock(&Dev->Queue.I2cFlashRingLock);
+			break;
+		}
+		Dev->Queue.I2cFlashReadOrWrite = Request->I2cFlashRequestState;
+		Dev->Queue.I2cFlashActiveRequest = Request;
+		spin_unlock(&Dev->Queue.I2cFlashRingLock);
+		RequestId = Request->I2cFlashRequestId;
+		Dev->ActiveRequestId = RequestId;
+		if (0 == Request->I2cFlashRequestProgress)
+		{
+			trace_i2c_flash_dequeue(Dev->name,RequestId,Request->I2cFlashRequestState,PAGENO(Dev,Request->I2cFlashRequestAddress),
+			                        Request->I2cFlashRequestLength,Dev->Queue.I2cFlashRingCount);
+		}
+        /* Check if READ was requested that resulted the work queue */
+		if (I2CFLASHREAD == Request->I2cFlashRequestState)
+		{
+			I2cFlashReadPages(Dev,Request);
+			if (0 == Request->I2cFlashRequestStatus)
+			{
+				spin_lock(&Dev->Queue.I2cFlashRingLock);
+				I2cFlashShadowFill(Dev,Request);
+				spin_unlock(&Dev->Queue.I2cFlashRingLock);
+			}
+			Finished = 1;
+		}
+		else if (I2CFLASHWRITE == Request->I2cFlashRequestState)
+		{
+			Finished = I2cFlashWritePages(Dev,Request);
+		}
+		else if (I2CFLASHERASE == Request->I2cFlashRequestState)
+		{
+			Finished = I2cFlashErasePages(Dev,Request);
+		}
+		else
+		{
+			/* Work function need not to do anything in I2CFLASHDATAREADY or NONE */
+			Finished = 1;
+		}
+		Dev->ActiveRequestId = 0;
+		if (!Finished)
+		{
+			/* the write or erase left the ring buffer when it started, its slot is free */
+			wake_up_interruptible_all(&Dev->Queue.I2cFlashWaitQueue);
+			/* the next chunk comes after the high priority reads queued meanwhile */
+			continue;
+		}
+		I2cFlashCompleteRequest(Dev,Request);
+	}
+	Dev->Stats.I2cFlashWorkerCpuNs += (current->se.sum_exec_runtime - CpuStart);
+	mutex_unlock(&Dev->BusLock);
+}
+/* *********************************************************************
+ * NAME:             I2cFlashDriverWrite
+ * CALLED BY:        User App through kernel
+ * DESCRIPTION:      queues the data to be written to the EEPROM. A file
+ *                   opened without O_NONBLOCK also sleeps until the data
+ *                   is in the EEPROM, a signal cancels the rest.
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   buf : pointer to the user data
+ *                   count : no of bytes to be written
+ *                   offp: byte offset in the EEPROM, moved by count
+ * RETURN VALUES:    ssize_t : number of bytes queued, or written for a
+ *                             blocking file, fewer if the write stopped
+ *                             part way. EBUSY if the request queue is
+ *                             full (O_NONBLOCK only), ENOSPC at the end
+ *                             of the EEPROM, ETIMEDOUT, ECANCELED or the
+ *                             bus error if it failed (blocking only)
+ ***********************************************************************/
+ssize_t I2cFlashDriverWrite(struct file *filept, const char *buf,size_t count, loff_t *offp)
+{
+	I2cFlashDevType *Dev = ((I2cFlashFileType*)(filept->private_data))->I2cFlashFileDev; /* chip of the file */
+	ssize_t RetValue =  0; /* Error code sent when the buffer is full */
+	I2cFlashRequestType *Request = NULL; /* new write request */
+	unsigned int Offset = 0; /* bytes copied from the user so far */
+	unsigned int Length = 0; /* bytes copied into one page frame */
+	if (0 == count)
+	{
+		return 0;
+	}
+	if ((*offp < 0) || (*offp >= Dev->Size))
+	{
+		return -ENOSPC;
+	}
+	if (count > (Dev->Size - *offp))
+	{
+		count = Dev->Size - *offp;
+	}
+	Request = I2cFlashAllocRequest(Dev,*offp,count,1);
+	if (NULL == Request)
+	{
+		return -ENOMEM;
+	}
+    Request->I2cFlashRequestState = I2CFLASHWRITE;
+    Request->I2cFlashRequestAddress = *offp;
+    Request->I2cFlashRequestLength = count;
+	/* copy the data sent by the user straight to its place in the page frames */
+	for (Offset = 0; Offset < count; Offset += Length)
+	{
+		Length = I2cFlashPagePart(Dev,(*offp + Offset),(count - Offset));
+		if (copy_from_user(I2cFlashRequestData(Dev,Request,Offset),(buf + Offset),Length))
+		{
+			printk(" \nError copying from user space");
+			I2cFlashFreeRequest(Request);
+			return -EFAULT;
+		}
+	}
+	this_cpu_add(Dev->PcpuStats->BytesCopied,count);
+    /* Work function frees the request after writing it */
+    RetValue = I2cFlashSubmitFromFile(filept,Request);
+	if (RetValue)
+	{
+		/* Request queue is full so return -1 with EBUSY */
+		I2cFlashFreeRequest(Request);
+		return RetValue;
+	}
+	if (!(filept->f_flags & O_NONBLOCK))
+	{
+		/* a later request of this file also covers this one, FLASHWAIT waits for every id up to it */
+		RetValue = I2cFlashWaitResult((I2cFlashFileType*)(filept->private_data),count);
+		if (RetValue > 0)
+		{
+			*offp += RetValue;
+		}
+		return RetValue;
+	}
+	*offp += count;
+    return count;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDriverRead
+ * CALLED BY:        User App through kernel
+ * DESCRIPTION:      reads chunk of data from the EEPROM. A file opened
+ *                   with O_NONBLOCK gets -EAGAIN until the work function
+ *                   has read the pages, otherwise the caller sleeps for
+ *                   them. A file read front to back is served from its
+ *                   read-ahead windows.
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   buf : pointer to the user data
+ *                   count : no of bytes to be copied to the user buffer
+ *                   offp: byte offset in the EEPROM, moved by the bytes
+ *                         read
+ * RETURN VALUES:    ssize_t : number of bytes written to the user space
+ *                  -EAGAIN, if the request is submitted to the workqueue
+ *                           or this file's request is still in the queue
+ *                           (O_NONBLOCK only)
+ *                  -EBUSY, if the request queue is full (O_NONBLOCK only)
+ *                  -ETIMEDOUT, -ECANCELED or the bus error if the read
+ *                           failed before its first byte, fewer bytes
+ *                           if it failed later
+ ***********************************************************************/
+ssize_t I2cFlashDriverRead(struct file *filept, char *buf,size_t count, loff_t *offp)
+{
+	ssize_t RetValue = -1;
+	I2cFlashFileType *FilePrivate = (I2cFlashFileType*)(filept->private_data);
+	I2cFlashDevType *Dev = FilePrivate->I2cFlashFileDev; /* chip of the file */
+	I2cFlashRequestType *Request = NULL;
+	unsigned int Pages = 0; /* pages touched by the read */
+
+	if ((0 == count) || (*offp < 0) || (*offp >= Dev->Size))
+	{
+		/* end of the EEPROM */
+		return 0;
+	}
+	if (count > (Dev->Size - *offp))
+	{
+		count = Dev->Size - *offp;
+	}
+	/* a sequential read may already be in memory */
+	RetValue = I2cFlashReadAheadRead(filept,buf,count,offp);
+	if (0 != RetValue)
+	{
+		return RetValue;
+	}
+	Request = FilePrivate->I2cFlashFileReadRequest;
+	if ((NULL != Request) &&
+	    ((Request->I2cFlashRequestAddress != *offp) || (Request->I2cFlashRequestLength != count)))
+	{
+		/* the pending request was for some other offset, it is not wanted anymore */
+		I2cFlashDropReadRequest(FilePrivate);
+		Request = NULL;
+	}
+	if (NULL == Request)
+	{
+		/* No Read operation is pending for this file */
+		Request = kzalloc(sizeof(I2cFlashRequestType),GFP_KERNEL);
+		if (NULL == Request)
+		{
+			return -ENOMEM;
+		}
+        Request->I2cFlashRequestBufferPtr = (char*)kzalloc(count,GFP_KERNEL);
+		if (NULL == Request->I2cFlashRequestBufferPtr)
+		{
+			kfree(Request);
+			return -ENOMEM;
+		}
+        Request->I2cFlashRequestState = I2CFLASHREAD;
+        Request->I2cFlashRequestAddress = *offp;
+        Request->I2cFlashRequestLength = count;
+        Request->I2cFlashRequestOwner = FilePrivate;
+        Request->I2cFlashRequestPriority = FilePrivate->I2cFlashFilePriority;
+        FilePrivate->I2cFlashFileReadRequest = Request;
+        RetValue = I2cFlashSubmitFromFile(filept,Request);
+        if (RetValue)
+        {
+			/* The request queue is full so return -1 with EBUSY */
+			FilePrivate->I2cFlashFileReadRequest = NULL;
+			I2cFlashFreeRequest(Request);
+			return RetValue;
+		}
+		if ((0 != I2cFlashReadAheadPages) && (*offp == FilePrivate->I2cFlashFileNextOffset))
+		{
+			/* sequential but not in memory, start fetching the two windows behind this read */
+			this_cpu_inc(Dev->PcpuStats->ReadAheadMisses);
+			Pages = PAGENO(Dev,*offp + count - 1) - PAGENO(Dev,*offp) + 1;
+			if (FilePrivate->I2cFlashFileReadAheadPages < Pages)
+			{
+				FilePrivate->I2cFlashFileReadAheadPages = min(Pages,max(I2cFlashReadAheadPages,(unsigned int)READAHEAD_MIN));
+			}
+			if (NULL == FilePrivate->I2cFlashFileReadAhead)
+			{
+				I2cFlashReadAheadSubmit(FilePrivate,&FilePrivate->I2cFlashFileReadAhead,(*offp + count));
+			}
+			if ((NULL != FilePrivate->I2cFlashFileReadAhead) && (NULL == FilePrivate->I2cFlashFileReadAheadNext))
+			{
+				I2cFlashReadAheadSubmit(FilePrivate,&FilePrivate->I2cFlashFileReadAheadNext,
+				                        (FilePrivate->I2cFlashFileReadAhead->I2cFlashRequestAddress +
+				                         FilePrivate->I2cFlashFileReadAhead->I2cFlashRequestLength));
+			}
+		}
+	}
+	if (!(filept->f_flags & O_NONBLOCK) &&
+	    wait_event_interruptible(Dev->Queue.I2cFlashWaitQueue,
+	                             (I2CFLASHDATAREADY == READ_ONCE(Request->I2cFlashRequestState))))
+	{
+		/* the request stays pending, the restarted read picks it up */
+		return -ERESTARTSYS;
+	}
+
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+    if (I2CFLASHDATAREADY == Request->I2cFlashRequestState)
+    {
+		FilePrivate->I2cFlashFileReadRequest = NULL;
+		spin_unlock(&Dev->Queue.I2cFlashRingLock);
+		/* a read which stopped part way gives the bytes it got, or why it got none */
+		RetValue = (0 == Request->I2cFlashRequestStatus) ? Request->I2cFlashRequestLength : Request->I2cFlashRequestProgress;
+		/* The data for previous Read request is ready so copy to the user space */
+        /* Copy to the user space*/
+        if (0 == RetValue)
+        {
+            RetValue = Request->I2cFlashRequestStatus;
+        }
+        else if(copy_to_user(buf, (Request->I2cFlashRequestBufferPtr),RetValue))
+        {
+            printk("\n Buffer writing failed ");
+            RetValue = -EFAULT;
+	    }
+	    else
+	    {
+		    *offp += RetValue;
+		    FilePrivate->I2cFlashFileNextOffset = *offp;
+		}
+	    /* No the read buffer can be freed */
+	    I2cFlashFreeRequest(Request);
+	}
+	else
+	{
+		spin_unlock(&Dev->Queue.I2cFlashRingLock);
+		/* The read request of this file is still in the queue */
+		RetValue = -EAGAIN;
+	}
+    return RetValue;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashIocbReserve
+ * CALLED BY:        read_iter and write_iter
+ * DESCRIPTION:      sets a slot of the queue aside for the request of a
+ *                   kiocb, sleeping for one unless it is IOCB_NOWAIT.
+ *                   io_uring only retries a request from its workers on
+ *                   -EAGAIN, so a full queue is not -EBUSY here.
+ * INPUT PARAMETERS: iocb : kernel I/O control block of the request
+ * RETURN VALUES:    int : 0 if reserved, -EAGAIN if the queue is full
+ *                         and the kiocb is IOCB_NOWAIT, -ERESTARTSYS on
+ *                         a signal
+ ***********************************************************************/
+static int I2cFlashIocbReserve(I2cFlashDevType *Dev, struct kiocb *iocb)
+{
+	int RetValue = I2cFlashReserveSlot(Dev,((iocb->ki_flags & IOCB_NOWAIT) ? 0 : 1));
+	return (-EBUSY == RetValue) ? -EAGAIN : RetValue;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDriverReadIter
+ * CALLED BY:        kernel for readv/preadv, aio and io_uring reads
+ * DESCRIPTION:      reads bytes of the EEPROM at the position of the
+ *                   kiocb. A synchronous caller sleeps until the data is
+ *                   copied. An asynchronous read is only queued, the
+ *                   work function copies the data and completes the
+ *                   kiocb, so several reads can be in flight at once.
+ * INPUT PARAMETERS: iocb : kernel I/O control block of the read
+ *                   to : user buffers
+ * RETURN VALUES:    ssize_t : number of bytes read, -EIOCBQUEUED if
+ *                             queued, -EAGAIN if the request queue is
+ *                             full and the kiocb is IOCB_NOWAIT, -EBUSY
+ *                             if it is full and the file is O_NONBLOCK
+ ***********************************************************************/
+ssize_t I2cFlashDriverReadIter(struct kiocb *iocb, struct iov_iter *to)
+{
+	I2cFlashDevType *Dev = ((I2cFlashFileType*)(iocb->ki_filp->private_data))->I2cFlashFileDev; /* chip of the file */
+	ssize_t RetValue = 0;
+	size_t count = iov_iter_count(to); /* bytes requested */
+	I2cFlashRequestType *Request = NULL; /* new read request */
+	if ((0 == count) || (iocb->ki_pos < 0) || (iocb->ki_pos >= Dev->Size))
+	{
+		/* end of the EEPROM */
+		return 0;
+	}
+	if (count > (Dev->Size - iocb->ki_pos))
+	{
+		count = Dev->Size - iocb->ki_pos;
+	}
+	if (is_sync_kiocb(iocb) && (iocb->ki_flags & IOCB_NOWAIT))
+	{
+		return -EAGAIN;
+	}
+	Request = kzalloc(sizeof(I2cFlashRequestType),GFP_KERNEL);
+	if (NULL == Request)
+	{
+		return -ENOMEM;
+	}
+	Request->I2cFlashRequestBufferPtr = (char*)kzalloc(count,GFP_KERNEL);
+	if (NULL == Request->I2cFlashRequestBufferPtr)
+	{
+		kfree(Request);
+		return -ENOMEM;
+	}
+	Request->I2cFlashRequestState = I2CFLASHREAD;
+	Request->I2cFlashRequestAddress = iocb->ki_pos;
+	Request->I2cFlashRequestLength = count;
+	/* the file or the request itself (real time io priority, e.g. the ioprio of an io_uring sqe) can ask to go first */
+	if ((PRIORITYHIGH == ((I2cFlashFileType*)(iocb->ki_filp->private_data))->I2cFlashFilePriority) ||
+	    (IOPRIO_CLASS_RT == IOPRIO_PRIO_CLASS(iocb->ki_ioprio)))
+	{
+		Request->I2cFlashRequestPriority = PRIORITYHIGH;
+	}
+	if (is_sync_kiocb(iocb))
+	{
+		RetValue = I2cFlashReserveSlot(Dev,((iocb->ki_filp->f_flags & O_NONBLOCK) ? 0 : 1));
+		if (0 == RetValue)
+		{
+			Request->I2cFlashRequestReserved = 1;
+			RetValue = I2cFlashSubmitAndWait(Dev,Request,(I2cFlashFileType*)(iocb->ki_filp->private_data));
+		}
+		if (-EINTR == RetValue)
+		{
+			/* killed, the work function frees the request */
+			return RetValue;
+		}
+		if ((0 == RetValue) && (0 != Request->I2cFlashRequestStatus))
+		{
+			/* stopped part way */
+			count = Request->I2cFlashRequestProgress;
+			RetValue = (0 != count) ? 0 : Request->I2cFlashRequestStatus;
+		}
+		if ((0 == RetValue) && (0 != count))
+		{
+			if (copy_to_iter(Request->I2cFlashRequestBufferPtr,count,to) != count)
+			{
+				RetValue = -EFAULT;
+			}
+			else
+			{
+				iocb->ki_pos += count;
+				RetValue = count;
+			}
+		}
+		I2cFlashFreeRequest(Request);
+		return RetValue;
+	}
+	/* the iterator is used after this call returns, keep a copy of its iovec array */
+	Request->I2cFlashRequestIovCopy = dup_iter(&Request->I2cFlashRequestIter,to,GFP_KERNEL);
+	if ((NULL == Request->I2cFlashRequestIovCopy) && !iter_is_ubuf(to))
+	{
+		I2cFlashFreeRequest(Request);
+		return -ENOMEM;
+	}
+	RetValue = I2cFlashIocbReserve(Dev,iocb);
+	if (RetValue)
+	{
+		I2cFlashFreeRequest(Request);
+		return RetValue;
+	}
+	Request->I2cFlashRequestReserved = 1;
+	Request->I2cFlashRequestIocb = iocb;
+	Request->I2cFlashRequestMm = current->mm;
+	mmgrab(current->mm);
+	/* moved before submitting since the kiocb may be completed right away */
+	iocb->ki_pos += count;
+	I2cFlashSubmitRequest(Dev,Request,(I2cFlashFileType*)(iocb->ki_filp->private_data));
+	return -EIOCBQUEUED;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDriverWriteIter
+ * CALLED BY:        kernel for writev/pwritev, aio and io_uring writes
+ * DESCRIPTION:      queues the bytes to be written at the position of the
+ *                   kiocb. A synchronous caller behaves like write, it
+ *                   waits for the data to be written unless the file is
+ *                   O_NONBLOCK or the kiocb is IOCB_NOWAIT. An asynchronous kiocb is
+ *                   completed by the work function after the pages are
+ *                   written.
+ * INPUT PARAMETERS: iocb : kernel I/O control block of the write
+ *                   from : user buffers
+ * RETURN VALUES:    ssize_t : number of bytes queued, -EIOCBQUEUED if
+ *                             completed later, -EAGAIN if the request
+ *                             queue is full and the kiocb is IOCB_NOWAIT,
+ *                             -EBUSY if it is full and the file is
+ *                             O_NONBLOCK, -ENOSPC at the end of the
+ *                             EEPROM
+ ***********************************************************************/
+ssize_t I2cFlashDriverWriteIter(struct kiocb *iocb, struct iov_iter *from)
+{
+	I2cFlashDevType *Dev = ((I2cFlashFileType*)(iocb->ki_filp->private_data))->I2cFlashFileDev; /* chip of the file */
+	ssize_t RetValue = 0;
+	size_t count = iov_iter_count(from); /* bytes to be written */
+	unsigned char Async = is_sync_kiocb(iocb) ? 0 : 1; /* kiocb is completed by the work function */
+	I2cFlashRequestType *Request = NULL; /* new write request */
+	unsigned int Offset = 0; /* bytes copied from the user so far */
+	unsigned int Length = 0; /* bytes copied into one page frame */
+	if (0 == count)
+	{
+		return 0;
+	}
+	if ((iocb->ki_pos < 0) || (iocb->ki_pos >= Dev->Size))
+	{
+		return -ENOSPC;
+	}
+	if (count > (Dev->Size - iocb->ki_pos))
+	{
+		count = Dev->Size - iocb->ki_pos;
+	}
+	Request = I2cFlashAllocRequest(Dev,iocb->ki_pos,count,1);
+	if (NULL == Request)
+	{
+		return -ENOMEM;
+	}
+	Request->I2cFlashRequestState = I2CFLASHWRITE;
+	Request->I2cFlashRequestAddress = iocb->ki_pos;
+	Request->I2cFlashRequestLength = count;
+	/* copy the user buffers straight to their place in the page frames */
+	for (Offset = 0; Offset < count; Offset += Length)
+	{
+		Length = I2cFlashPagePart(Dev,(iocb->ki_pos + Offset),(count - Offset));
+		if (copy_from_iter(I2cFlashRequestData(Dev,Request,Offset),Length,from) != Length)
+		{
+			I2cFlashFreeRequest(Request);
+			return -EFAULT;
+		}
+	}
+	this_cpu_add(Dev->PcpuStats->BytesCopied,count);
+	if (Async)
+	{
+		Request->I2cFlashRequestIocb = iocb;
+	}
+	iocb->ki_pos += count;
+	/* Work function frees the request after writing it */
+	if (Async || (iocb->ki_flags & IOCB_NOWAIT))
+	{
+		RetValue = I2cFlashIocbReserve(Dev,iocb);
+		if (0 == RetValue)
+		{
+			Request->I2cFlashRequestReserved = 1;
+			I2cFlashSubmitRequest(Dev,Request,(I2cFlashFileType*)(iocb->ki_filp->private_data));
+		}
+	}
+	else
+	{
+		RetValue = I2cFlashSubmitFromFile(iocb->ki_filp,Request);
+	}
+	if (RetValue)
+	{
+		iocb->ki_pos -= count;
+		I2cFlashFreeRequest(Request);
+		return RetValue;
+	}
+	if (!Async && !(iocb->ki_flags & IOCB_NOWAIT) && !(iocb->ki_filp->f_flags & O_NONBLOCK))
+	{
+		RetValue = I2cFlashWaitResult((I2cFlashFileType*)(iocb->ki_filp->private_data),count);
+		/* the position only covers the bytes written */
+		iocb->ki_pos -= count - ((RetValue > 0) ? RetValue : 0);
+		return RetValue;
+	}
+	return Async ? -EIOCBQUEUED : count;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashSeek
+ * CALLED BY:        llseek of the chip and of the striped device
+ * DESCRIPTION:      moves the byte offset of the file within a device of
+ *                   the given size
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   offset : new offset, relative to whence
+ *                   whence : SEEK_SET, SEEK_CUR or SEEK_END
+ *                   Size : size of the device in bytes
+ * RETURN VALUES:    loff_t : new offset, -EINVAL if out of the device
+ ***********************************************************************/
+static loff_t I2cFlashSeek(struct file *filept, loff_t offset, int whence, unsigned int Size)
+{
+	loff_t NewPosition = 0; /* offset after seeking */
+	if (SEEK_SET == whence)
+	{
+		NewPosition = offset;
+	}
+	else if (SEEK_CUR == whence)
+	{
+		NewPosition = filept->f_pos + offset;
+	}
+	else if (SEEK_END == whence)
+	{
+		NewPosition = Size + offset;
+	}
+	else
+	{
+		return -EINVAL;
+	}
+	if ((NewPosition < 0) || (NewPosition > Size))
+	{
+		return -EINVAL;
+	}
+	filept->f_pos = NewPosition;
+	return NewPosition;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDriverLlseek
+ * CALLED BY:        User App through kernel
+ * DESCRIPTION:      moves the byte offset of the file within the EEPROM
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   offset : new offset, relative to whence
+ *                   whence : SEEK_SET, SEEK_CUR or SEEK_END
+ * RETURN VALUES:    loff_t : new offset, -EINVAL if out of the EEPROM
+ ***********************************************************************/
+loff_t I2cFlashDriverLlseek(struct file *filept, loff_t offset, int whence)
+{
+	I2cFlashDevType *Dev = ((I2cFlashFileType*)(filept->private_data))->I2cFlashFileDev; /* chip of the file */
+	return I2cFlashSeek(filept,offset,whence,Dev->Size);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashMmapWriteBack
+ * CALLED BY:        fsync (msync) and close of a mapping
+ * DESCRIPTION:      compares the faulted in pages of the mapped image
+ *                   with the EEPROM data page by page and writes the
+ *                   runs of pages which were changed through the mapping
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    int : 0 once written, error code otherwise
+ ***********************************************************************/
+static int I2cFlashMmapWriteBack(I2cFlashDevType *Dev)
+{
+	unsigned int Address = 0; /* page being compared */
+	unsigned int Start = 0; /* first page of a run of dirty pages */
+	I2cFlashRequestType *Request = NULL; /* write request of one run */
+	int Status = 0; /* outcome of the write of one run */
+	int RetValue = 0;
+	mutex_lock(&Dev->MmapLock);
+	for (Address = 0; (NULL != Dev->MmapImage) && (Address < Dev->Size); Address += Dev->PageSize)
+	{
+		if (!test_bit((Address >> PAGE_SHIFT),Dev->MmapLoaded) ||
+		    (0 == memcmp((Dev->MmapImage + Address),(Dev->MmapReference + Address),Dev->PageSize)))
+		{
+			continue;
+		}
+		/* extend the run as long as the next pages are dirty too */
+		Start = Address;
+		while (((Address + Dev->PageSize) < Dev->Size) && test_bit(((Address + Dev->PageSize) >> PAGE_SHIFT),Dev->MmapLoaded) &&
+		       memcmp((Dev->MmapImage + Address + Dev->PageSize),(Dev->MmapReference + Address + Dev->PageSize),Dev->PageSize))
+		{
+			Address += Dev->PageSize;
+		}
+		Request = kzalloc(sizeof(I2cFlashRequestType),GFP_KERNEL);
+		if (NULL != Request)
+		{
+			Request->I2cFlashRequestBufferPtr = (char*)kmalloc((Address + Dev->PageSize - Start),GFP_KERNEL);
+		}
+		if ((NULL == Request) || (NULL == Request->I2cFlashRequestBufferPtr))
+		{
+			kfree(Request);
+			RetValue = -ENOMEM;
+			break;
+		}
+		memcpy(Request->I2cFlashRequestBufferPtr,(Dev->MmapImage + Start),(Address + Dev->PageSize - Start));
+		Request->I2cFlashRequestState = I2CFLASHWRITE;
+		Request->I2cFlashRequestAddress = Start;
+		Request->I2cFlashRequestLength = Address + Dev->PageSize - Start;
+		/* the submission updates the reference of the image as well */
+		Status = I2cFlashSubmitAndWait(Dev,Request,NULL);
+		if (-EINTR == Status)
+		{
+			/* killed, the run is still written and freed by the work function */
+			continue;
+		}
+		if (0 == Status)
+		{
+			Status = Request->I2cFlashRequestStatus;
+		}
+		if (0 != Status)
+		{
+			/* the other runs are still written, the first error is reported */
+			RetValue = (0 != RetValue) ? RetValue : Status;
+		}
+		I2cFlashFreeRequest(Request);
+	}
+	mutex_unlock(&Dev->MmapLock);
+	return RetValue;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashVmFault
+ * CALLED BY:        memory manager on the first access to a mapped page
+ * DESCRIPTION:      reads the EEPROM bytes behind the kernel page into
+ *                   the mapped image (through the request queue so that
+ *                   queued writes are seen) and maps the page
+ * INPUT PARAMETERS: vmf : fault information
+ * RETURN VALUES:    vm_fault_t : 0 if mapped, VM_FAULT_SIGBUS/OOM otherwise
+ ***********************************************************************/
+static vm_fault_t I2cFlashVmFault(struct vm_fault *vmf)
+{
+	I2cFlashDevType *Dev = (I2cFlashDevType*)(vmf->vma->vm_private_data); /* chip which is mapped */
+	unsigned int Address = vmf->pgoff << PAGE_SHIFT; /* first EEPROM byte of the page */
+	I2cFlashRequestType *Request = NULL; /* read request of the page */
+	int Status = 0; /* outcome of the submission */
+	unsigned char Loaded = 0; /* set once the page holds up to date data */
+	if (Address >= Dev->Size)
+	{
+		return VM_FAULT_SIGBUS;
+	}
+	mutex_lock(&Dev->MmapLock);
+	while (!test_bit(vmf->pgoff,Dev->MmapLoaded) && (0 == Loaded))
+	{
+		Request = kzalloc(sizeof(I2cFlashRequestType),GFP_KERNEL);
+		if (NULL != Request)
+		{
+			Request->I2cFlashRequestBufferPtr = (char*)kmalloc(min_t(unsigned int,PAGE_SIZE,(Dev->Size - Address)),GFP_KERNEL);
+		}
+		if ((NULL == Request) || (NULL == Request->I2cFlashRequestBufferPtr))
+		{
+			kfree(Request);
+			mutex_unlock(&Dev->MmapLock);
+			return VM_FAULT_OOM;
+		}
+		Request->I2cFlashRequestState = I2CFLASHREAD;
+		Request->I2cFlashRequestAddress = Address;
+		Request->I2cFlashRequestLength = min_t(unsigned int,PAGE_SIZE,(Dev->Size - Address));
+		Status = I2cFlashSubmitAndWait(Dev,Request,NULL);
+		if (0 != Status)
+		{
+			/* a signal, the access faults again once it is handled. If killed the work function frees the request */
+			if (-EINTR != Status)
+			{
+				I2cFlashFreeRequest(Request);
+			}
+			mutex_unlock(&Dev->MmapLock);
+			return VM_FAULT_NOPAGE;
+		}
+		if (0 != Request->I2cFlashRequestStatus)
+		{
+			/* the chip does not answer within the retry budget */
+			I2cFlashFreeRequest(Request);
+			mutex_unlock(&Dev->MmapLock);
+			return VM_FAULT_SIGBUS;
+		}
+		spin_lock(&Dev->Queue.I2cFlashRingLock);
+		/* if something was written after the read was queued, read once more */
+		if (Request->I2cFlashRequestShadowGeneration == Dev->ShadowGeneration)
+		{
+			memcpy((Dev->MmapImage + Address),Request->I2cFlashRequestBufferPtr,Request->I2cFlashRequestLength);
+			memcpy((Dev->MmapReference + Address),Request->I2cFlashRequestBufferPtr,Request->I2cFlashRequestLength);
+			__set_bit(vmf->pgoff,Dev->MmapLoaded);
+			Loaded = 1;
+		}
+		spin_unlock(&Dev->Queue.I2cFlashRingLock);
+		I2cFlashFreeRequest(Request);
+	}
+	mutex_unlock(&Dev->MmapLock);
+	vmf->page = vmalloc_to_page(Dev->MmapImage + Address);
+	get_page(vmf->page);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashVmClose
+ * CALLED BY:        memory manager on munmap
+ * DESCRIPTION:      writes back the pages dirtied through the mapping
+ * INPUT PARAMETERS: vma : mapping being removed
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashVmClose(struct vm_area_struct *vma)
+{
+	I2cFlashDevType *Dev = (I2cFlashDevType*)(vma->vm_private_data); /* chip which is mapped */
+	I2cFlashMmapWriteBack(Dev);
+}
+
+/* Operations of the mapped EEPROM image */
+static const struct vm_operations_struct I2cFlashVmOps = {
+	.fault = I2cFlashVmFault,
+	.close = I2cFlashVmClose,
+};
+
+/* *********************************************************************
+ * NAME:             I2cFlashDriverMmap
+ * CALLED BY:        User App through kernel
+ * DESCRIPTION:      maps the image of the EEPROM to the user, the pages
+ *                   are read from the EEPROM when first touched
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   vma : mapping requested by the user
+ * RETURN VALUES:    int : 0 if mapped, error code otherwise
+ ***********************************************************************/
+int I2cFlashDriverMmap(struct file *filept, struct vm_area_struct *vma)
+{
+	I2cFlashDevType *Dev = ((I2cFlashFileType*)(filept->private_data))->I2cFlashFileDev; /* chip of the file */
+	if (((vma->vm_pgoff << PAGE_SHIFT) + (vma->vm_end - vma->vm_start)) > PAGE_ALIGN(Dev->Size))
+	{
+		return -EINVAL;
+	}
+	mutex_lock(&Dev->MmapLock);
+	if (NULL == Dev->MmapImage)
+	{
+		/* allocated on the first mmap, kept until the driver is removed */
+		Dev->MmapReference = vmalloc(PAGE_ALIGN(Dev->Size));
+		Dev->MmapImage = (NULL != Dev->MmapReference) ? vmalloc_user(PAGE_ALIGN(Dev->Size)) : NULL;
+		if (NULL == Dev->MmapImage)
+		{
+			vfree(Dev->MmapReference);
+			Dev->MmapReference = NULL;
+			mutex_unlock(&Dev->MmapLock);
+			return -ENOMEM;
+		}
+	}
+	mutex_unlock(&Dev->MmapLock);
+	vma->vm_ops = &I2cFlashVmOps;
+	vma->vm_private_data = Dev;
+	vm_flags_set(vma,(VM_DONTEXPAND | VM_DONTDUMP));
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDriverFsync
+ * CALLED BY:        User App through kernel (fsync, msync)
+ * DESCRIPTION:      writes back the pages dirtied through the mapping and
+ *                   waits for them to be written to the EEPROM, and
+ *                   reports a write or erase of the file which failed
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   start, end : byte range to be synced (all is synced)
+ *                   datasync : not used
+ * RETURN VALUES:    int : 0 once written, error code otherwise
+ ***********************************************************************/
+int I2cFlashDriverFsync(struct file *filept, loff_t start, loff_t end, int datasync)
+{
+	I2cFlashDevType *Dev = ((I2cFlashFileType*)(filept->private_data))->I2cFlashFileDev; /* chip of the file */
+	int RetValue = I2cFlashMmapWriteBack(Dev);
+	int Error = I2cFlashTakeError((I2cFlashFileType*)(filept->private_data)); /* failed write of this file */
+	return (0 != RetValue) ? RetValue : Error;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDriverPoll
+ * CALLED BY:        User App through kernel (poll, select, epoll)
+ * DESCRIPTION:      reports POLLIN when the data of this file's read
+ *                   request is ready and POLLOUT when the request queue
+ *                   can take a new request
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   wait : poll table of the caller
+ * RETURN VALUES:    unsigned int : poll mask
+ ***********************************************************************/
+unsigned int I2cFlashDriverPoll(struct file *filept, poll_table *wait)
+{
+	I2cFlashFileType *FilePrivate = (I2cFlashFileType*)(filept->private_data);
+	I2cFlashDevType *Dev = FilePrivate->I2cFlashFileDev; /* chip of the file */
+	unsigned int Mask = 0; /* events ready */
+	poll_wait(filept,&Dev->Queue.I2cFlashWaitQueue,wait);
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	if ((NULL != FilePrivate->I2cFlashFileReadRequest) &&
+	    (I2CFLASHDATAREADY == FilePrivate->I2cFlashFileReadRequest->I2cFlashRequestState))
+	{
+		Mask |= POLLIN | POLLRDNORM;
+	}
+	if ((NULL != FilePrivate->I2cFlashFileReadAhead) &&
+	    (I2CFLASHDATAREADY == FilePrivate->I2cFlashFileReadAhead->I2cFlashRequestState))
+	{
+		/* the next sequential read is answered from memory */
+		Mask |= POLLIN | POLLRDNORM;
+	}
+	if ((Dev->Queue.I2cFlashRingCount + Dev->Queue.I2cFlashRingReserved) < Dev->Queue.I2cFlashRingDepth)
+	{
+		Mask |= POLLOUT | POLLWRNORM;
+	}
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	return Mask;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashIoctlOrder
+ * CALLED BY:        ioctl of a chip and of the striped device
+ * DESCRIPTION:      the first four commands come as ioctl(fd, argument,
+ *                   command), the later ones the usual way round. The
+ *                   later ones are turned into the order of the first
+ *                   four, so both are handled alike. A page number is
+ *                   never as big as a command number of FLASHMAGIC.
+ * INPUT PARAMETERS: pageposition : cmd of the kernel, the argument on
+ *                                  return
+ *                   Request : arg of the kernel, the command on return
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashIoctlOrder(unsigned int *pageposition, unsigned long *Request)
+{
+	unsigned int Command = *pageposition;
+	if (FLASHMAGIC == _IOC_TYPE(Command))
+	{
+		*pageposition = (unsigned int)*Request;
+		*Request = Command;
+	}
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashPageRange
+ * CALLED BY:        FLASHDIGEST and FLASHVERIFY of ioctl
+ * DESCRIPTION:      checks a range of pages given like the one of
+ *                   FLASHERASERANGE, 0 stands for the whole chip
+ * INPUT PARAMETERS: Range : (count << 16 | first page), 0 replaced by the
+ *                           whole chip
+ * RETURN VALUES:    int : 0 if within the chip, -EINVAL otherwise
+ ***********************************************************************/
+static int I2cFlashPageRange(I2cFlashDevType *Dev, unsigned int *Range)
+{
+	if (0 == *Range)
+	{
+		*Range = Dev->PageCount << 16;
+	}
+	if ((0 == ERASERANGECOUNT(*Range)) || ((ERASERANGESTART(*Range) + ERASERANGECOUNT(*Range)) > Dev->PageCount))
+	{
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDigestIoctl
+ * CALLED BY:        I2cFlashDriverIoctl for FLASHDIGEST
+ * DESCRIPTION:      gives the digest of a range of pages from their
+ *                   known CRCs, without reading the EEPROM. All 32 bits
+ *                   are copied to the user, none is lost to make room for
+ *                   an error code.
+ * INPUT PARAMETERS: Value : user u32, the range like FLASHERASERANGE on
+ *                           entry (0 for the whole chip), the digest on
+ *                           return
+ * RETURN VALUES:    long : 0, -EAGAIN if a CRC of the range is not known
+ *                          (FLASHVERIFY first), -EINVAL or -EFAULT
+ ***********************************************************************/
+static long I2cFlashDigestIoctl(I2cFlashDevType *Dev, u32 __user *Value)
+{
+	unsigned int Range = 0; /* (count << 16 | first page) */
+	unsigned int End = 0; /* page after the range */
+	u32 Digest = 0;
+	long RetValue = 0;
+	if (copy_from_user(&Range,Value,sizeof(Range)))
+	{
+		return -EFAULT;
+	}
+	if (I2cFlashPageRange(Dev,&Range))
+	{
+		return -EINVAL;
+	}
+	End = ERASERANGESTART(Range) + ERASERANGECOUNT(Range);
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	if ((find_next_zero_bit(Dev->CrcKnown,End,ERASERANGESTART(Range)) < End) ||
+	    (find_next_bit(Dev->CrcSuspect,End,ERASERANGESTART(Range)) < End))
+	{
+		/* FLASHVERIFY first */
+		RetValue = -EAGAIN;
+	}
+	else
+	{
+		Digest = I2cFlashManifestDigest(Dev,ERASERANGESTART(Range),ERASERANGECOUNT(Range));
+	}
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	if ((0 == RetValue) && copy_to_user(Value,&Digest,sizeof(Digest)))
+	{
+		RetValue = -EFAULT;
+	}
+	return RetValue;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDriverIoctl
+ * CALLED BY:        User App through kernel
+ * DESCRIPTION:      Does Iocntrl like setting the pointer,status,erase
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   pagepostion : page for FLASHSETP, the command for the
+ *                                 later ones whose argument is in Request :
+ *                                 (count << 16 | first page) for FLASHERASERANGE,
+ *                                 CACHEDISABLE/ENABLE/INVALIDATE for FLASHCACHE,
+ *                                 request id for FLASHWAIT (0 for the last
+ *                                 request queued by this file),
+ *                                 PRIORITYNORMAL/HIGH for FLASHPRIORITY,
+ *                                 deadline in ms (0 for none) for FLASHDEADLINE,
+ *                                 retry budget for FLASHRETRIES,
+ *                                 request id for FLASHCANCEL (0 for every
+ *                                 request of this file),
+ *                                 (count << 16 | first page) for FLASHVERIFY,
+ *                                 0 for the whole chip, the user pointer of
+ *                                 FLASHDIGEST
+ *                   Request : FLASHGETS, FLASHGETP, FLASHSETP or FLASHERASE,
+ *                             the argument of a later command
+ * RETURN VALUES:    long : error codes / return success, the pages found
+ *                          changed by FLASHVERIFY
+ ***********************************************************************/
+long I2cFlashDriverIoctl(struct file *filept,unsigned int pageposition, unsigned long Request)
+{
+	I2cFlashDevType *Dev = ((I2cFlashFileType*)(filept->private_data))->I2cFlashFileDev; /* chip of the file */
+	int RetValue =  -1; /* Error code by default */
+	I2cFlashRequestType *EraseRequest = NULL; /* request queued for erase */
+	if (FLASHDIGEST == pageposition)
+	{
+		return I2cFlashDigestIoctl(Dev,(u32 __user *)Request);
+	}
+	I2cFlashIoctlOrder(&pageposition,&Request);
+	/* is the request for get status */
+	if (FLASHGETS == Request)
+	{
+		if (NONE == Dev->Queue.I2cFlashReadOrWrite)
+		{
+			RetValue = 0;
+		}
+		else
+		{
+			RetValue = -EBUSY;
+		}
+	}
+	else if (FLASHGETP == Request)
+	{
+		/* is the request for getting page pointer of this file */
+		RetValue = PAGENO(Dev,filept->f_pos);
+	}
+	else if (FLASHSETP == Request)
+	{
+		/* is the request for setting the page pointer of this file */
+		if (pageposition < Dev->PageCount)
+		{
+			filept->f_pos = JOIN(Dev,pageposition,0x00);
+			RetValue = 0;
+		}
+		else
+		{
+			RetValue = -1;
+		}
+	}
+	else if ((FLASHERASE == Request) || (FLASHERASERANGE == Request))
+	{
+		/* is the request for erase, either the complete EEPROM or a range of pages */
+		if ((FLASHERASERANGE == Request) &&
+		    ((0 == ERASERANGECOUNT(pageposition)) || ((ERASERANGESTART(pageposition) + ERASERANGECOUNT(pageposition)) > Dev->PageCount)))
+		{
+			return -EINVAL;
+		}
+		EraseRequest = I2cFlashAllocRequest(Dev,0,0,0);
+		if (NULL == EraseRequest)
+		{
+			return -ENOMEM;
+		}
+		/* change the state to ERASE */
+		EraseRequest->I2cFlashRequestState = I2CFLASHERASE;
+		if (FLASHERASE == Request)
+		{
+			EraseRequest->I2cFlashRequestAddress = 0;
+			EraseRequest->I2cFlashRequestLength = Dev->Size;
+		}
+		else
+		{
+			EraseRequest->I2cFlashRequestAddress = JOIN(Dev,ERASERANGESTART(pageposition),0x00);
+			EraseRequest->I2cFlashRequestLength = ERASERANGECOUNT(pageposition) << Dev->PageShift;
+		}
+		RetValue = I2cFlashSubmitFromFile(filept,EraseRequest);
+		if (RetValue)
+		{
+			/* request queue is full */
+			I2cFlashFreeRequest(EraseRequest);
+			return RetValue;
+		}
+		if (FLASHERASE == Request)
+		{
+			/* bring up the pointer of this file to 0 */
+			filept->f_pos = 0;
+		}
+		if (!(filept->f_flags & O_NONBLOCK))
+		{
+			/* a blocking caller returns once the pages are blank, FLASHPROGRESS tells how far a failed erase got */
+			RetValue = I2cFlashWaitResult((I2cFlashFileType*)(filept->private_data),0);
+		}
+	}
+	else if (FLASHWAIT == Request)
+	{
+		/* sleep until the request is executed */
+		RetValue = I2cFlashWaitRequest(Dev,(0 != pageposition) ? pageposition :
+		                               ((I2cFlashFileType*)(filept->private_data))->I2cFlashFileLastRequestId);
+		if (0 == RetValue)
+		{
+			/* a write or erase of this file which failed in the meantime */
+			RetValue = I2cFlashTakeError((I2cFlashFileType*)(filept->private_data));
+		}
+	}
+	else if (FLASHGETID == Request)
+	{
+		/* id of the last request queued by this file */
+		RetValue = ((I2cFlashFileType*)(filept->private_data))->I2cFlashFileLastRequestId;
+	}
+	else if (FLASHREADAHEAD == Request)
+	{
+		/* pages of the next read-ahead window of this file */
+		RetValue = ((I2cFlashFileType*)(filept->private_data))->I2cFlashFileReadAheadPages;
+	}
+	else if (FLASHPRIORITY == Request)
+	{
+		/* priority of the reads of this file, high priority reads go between the chunks of writes and erases */
+		if (PRIORITYHIGH < pageposition)
+		{
+			return -EINVAL;
+		}
+		((I2cFlashFileType*)(filept->private_data))->I2cFlashFilePriority = pageposition;
+		RetValue = 0;
+	}
+	else if (FLASHDEADLINE == Request)
+	{
+		/* every later request of this file fails with -ETIMEDOUT once this many ms have passed since it was queued */
+		((I2cFlashFileType*)(filept->private_data))->I2cFlashFileDeadlineMs = pageposition;
+		RetValue = 0;
+	}
+	else if (FLASHRETRIES == Request)
+	{
+		/* failed transfers every later request of this file may repeat */
+		((I2cFlashFileType*)(filept->private_data))->I2cFlashFileRetries = pageposition;
+		RetValue = 0;
+	}
+	else if (FLASHCANCEL == Request)
+	{
+		/* the request with this id, or every request of this file */
+		RetValue = I2cFlashCancelRequests((I2cFlashFileType*)(filept->private_data),pageposition);
+	}
+	else if (FLASHPROGRESS == Request)
+	{
+		/* bytes done by the last request of this file which failed */
+		spin_lock(&Dev->Queue.I2cFlashRingLock);
+		RetValue = ((I2cFlashFileType*)(filept->private_data))->I2cFlashFileErrorProgress;
+		spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	}
+	else if (FLASHCACHE == Request)
+	{
+		/* enable, disable or invalidate the shadow image */
+		if ((CACHEENABLE == pageposition) && (NULL == Dev->Shadow))
+		{
+			return -ENOMEM;
+		}
+		if (CACHEINVALIDATE < pageposition)
+		{
+			return -EINVAL;
+		}
+		spin_lock(&Dev->Queue.I2cFlashRingLock);
+		if (CACHEINVALIDATE != pageposition)
+		{
+			Dev->ShadowEnable = (CACHEENABLE == pageposition);
+		}
+		bitmap_zero(Dev->ShadowValid,Dev->PageCount);
+		if (CACHEINVALIDATE == pageposition)
+		{
+			/* the EEPROM may have been changed behind the driver, FLASHVERIFY finds out */
+			bitmap_fill(Dev->CrcSuspect,Dev->PageCount);
+		}
+		Dev->ShadowGeneration++;
+		spin_unlock(&Dev->Queue.I2cFlashRingLock);
+		RetValue = 0;
+	}
+	else if (FLASHPAGESIZE == Request)
+	{
+		/* bytes of a page, the unit of FLASHSETP, FLASHERASERANGE and FLASHDIGEST */
+		RetValue = Dev->PageSize;
+	}
+	else if (FLASHVERIFY == Request)
+	{
+		/* a range of pages like FLASHERASERANGE, 0 for the whole chip */
+		if (I2cFlashPageRange(Dev,&pageposition))
+		{
+			return -EINVAL;
+		}
+		return I2cFlashManifestVerify(Dev,ERASERANGESTART(pageposition),ERASERANGECOUNT(pageposition));
+	}
+	else
+	{
+		/* not a command of this driver, an old number of a later command included */
+		RetValue = -ENOTTY;
+	}
+	return RetValue;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashStatsShow
+ * CALLED BY:        sysfs, when the stats attribute is read
+ * DESCRIPTION:      prints the bus counters along with the bus
+ *                   transactions and cpu time spent per page
+ * INPUT PARAMETERS: dev : device of the attribute
+ *                   attr : stats attribute
+ *                   buf : page sized buffer to be filled
+ * RETURN VALUES:    ssize_t : number of characters written to buf
+ ***********************************************************************/
+static ssize_t I2cFlashStatsShow(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	I2cFlashDevType *Dev = (I2cFlashDevType*)dev_get_drvdata(dev); /* chip of the attribute */
+	unsigned long Pages = (Dev->Stats.I2cFlashBytesRead >> Dev->PageShift) + Dev->Stats.I2cFlashPagesWritten;
+	if (0 == Pages)
+	{
+		/* avoid division by zero */
+		Pages = 1;
+	}
+	return scnprintf(buf,PAGE_SIZE,
+	                 "bytes_read %lu\nbytes_written %lu\npages_written %lu\nbus_transactions %lu\nack_polls %lu\n"
+	                 "write_cycle_timeouts %lu\nworker_cpu_ns %llu\n"
+	                 "bus_transactions_per_page %lu\nworker_cpu_ns_per_page %llu\n"
+	                 "read_bytes_per_sec %llu\nerase_pages_skipped %lu\n"
+	                 "last_erase_pages_erased %lu\nlast_erase_pages_skipped %lu\nlast_erase_us %llu\n"
+	                 "cache_hits %lu\ncache_misses %lu\n"
+	                 "write_pages_skipped %lu\nlast_write_pages_written %lu\nlast_write_pages_skipped %lu\n",
+	                 Dev->Stats.I2cFlashBytesRead,Dev->Stats.I2cFlashBytesWritten,Dev->Stats.I2cFlashPagesWritten,
+	                 Dev->Stats.I2cFlashBusTransactions,Dev->Stats.I2cFlashAckPolls,
+	                 Dev->Stats.I2cFlashWriteCycleTimeouts,Dev->Stats.I2cFlashWorkerCpuNs,
+	                 (Dev->Stats.I2cFlashBusTransactions / Pages),
+	                 div_u64(Dev->Stats.I2cFlashWorkerCpuNs,Pages),
+	                 (0 == Dev->Stats.I2cFlashReadNs) ? 0ULL :
+	                 div64_u64(((unsigned long long)Dev->Stats.I2cFlashBytesRead * 1000000000ULL),Dev->Stats.I2cFlashReadNs),
+	                 Dev->Stats.I2cFlashErasePagesSkipped,Dev->Stats.I2cFlashLastErasePagesErased,
+	                 Dev->Stats.I2cFlashLastErasePagesSkipped,Dev->Stats.I2cFlashLastEraseUs,
+	                 Dev->Stats.I2cFlashCacheHits,Dev->Stats.I2cFlashCacheMisses,
+	                 Dev->Stats.I2cFlashWritePagesSkipped,Dev->Stats.I2cFlashLastWritePagesWritten,
+	                 Dev->Stats.I2cFlashLastWritePagesSkipped);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashStatsStore
+ * CALLED BY:        sysfs, when the stats attribute is written
+ * DESCRIPTION:      clears all the bus counters
+ * INPUT PARAMETERS: dev : device of the attribute
+ *                   attr : stats attribute
+ *                   buf : data written by the user (ignored)
+ *                   count : length of the data
+ * RETURN VALUES:    ssize_t : count
+ ***********************************************************************/
+static ssize_t I2cFlashStatsStore(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	I2cFlashDevType *Dev = (I2cFlashDevType*)dev_get_drvdata(dev); /* chip of the attribute */
+	mutex_lock(&Dev->BusLock);
+	memset(&Dev->Stats,0,sizeof(Dev->Stats));
+	mutex_unlock(&Dev->BusLock);
+	return count;
+}
+
+static DEVICE_ATTR(stats, S_IRUGO | S_IWUSR, I2cFlashStatsShow, I2cFlashStatsStore);
+
+/*
+ * Root of the debugfs directories of the chips, /sys/kernel/debug/i2c_flash
+ */
+static struct dentry *I2cFlashDebugRoot = NULL;
+
+/* *********************************************************************
+ * NAME:             I2cFlashPcpuSum
+ * CALLED BY:        debugfs show functions
+ * DESCRIPTION:      adds up the counters and histograms of all the cpus
+ * INPUT PARAMETERS: Dev : chip
+ *                   Sum : filled with the totals
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashPcpuSum(I2cFlashDevType *Dev, I2cFlashPcpuStatsType *Sum)
+{
+	I2cFlashPcpuStatsType *Cpu = NULL; /* counters of one cpu */
+	unsigned int Hist = 0, Bucket = 0;
+	int CpuNumber = 0;
+	memset(Sum,0,sizeof(I2cFlashPcpuStatsType));
+	for_each_possible_cpu(CpuNumber)
+	{
+		Cpu = per_cpu_ptr(Dev->PcpuStats,CpuNumber);
+		Sum->PagesRead += Cpu->PagesRead;
+		Sum->PagesWritten += Cpu->PagesWritten;
+		Sum->PagesErased += Cpu->PagesErased;
+		Sum->Nacks += Cpu->Nacks;
+		Sum->BusErrors += Cpu->BusErrors;
+		Sum->Retries += Cpu->Retries;
+		Sum->Submitted += Cpu->Submitted;
+		Sum->EbusyRejections += Cpu->EbusyRejections;
+		Sum->BytesQueued += Cpu->BytesQueued;
+		Sum->Allocations += Cpu->Allocations;
+		Sum->BytesCopied += Cpu->BytesCopied;
+		Sum->ReadAheadHits += Cpu->ReadAheadHits;
+		Sum->ReadAheadLate += Cpu->ReadAheadLate;
+		Sum->ReadAheadMisses += Cpu->ReadAheadMisses;
+		Sum->ReadAheadBytes += Cpu->ReadAheadBytes;
+		Sum->ReadAheadWasted += Cpu->ReadAheadWasted;
+		Sum->PriorityReads += Cpu->PriorityReads;
+		Sum->PriorityDeferred += Cpu->PriorityDeferred;
+		Sum->Preemptions += Cpu->Preemptions;
+		Sum->Timeouts += Cpu->Timeouts;
+		Sum->Cancellations += Cpu->Cancellations;
+		Sum->Failures += Cpu->Failures;
+		for (Hist = 0; Hist < HIST_COUNT; Hist++)
+		{
+			for (Bucket = 0; Bucket < HIST_BUCKETS; Bucket++)
+			{
+				Sum->Latency[Hist][Bucket] += Cpu->Latency[Hist][Bucket];
+			}
+		}
+	}
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDebugCountersShow
+ * CALLED BY:        seq_file, when debugfs counters is read
+ * DESCRIPTION:      prints the counters and the queue depth of a chip
+ * INPUT PARAMETERS: Seq : output
+ *                   Unused : not used
+ * RETURN VALUES:    int : 0
+ ***********************************************************************/
+static int I2cFlashDebugCountersShow(struct seq_file *Seq, void *Unused)
+{
+	I2cFlashDevType *Dev = (I2cFlashDevType*)Seq->private;
+	I2cFlashPcpuStatsType *Sum = kmalloc(sizeof(I2cFlashPcpuStatsType),GFP_KERNEL); /* too big for the stack */
+	I2cFlashFileType *FilePrivate = NULL; /* open file of the chip */
+	unsigned int WindowMax = 0; /* largest read-ahead window of the open files */
+	if (NULL == Sum)
+	{
+		return -ENOMEM;
+	}
+	I2cFlashPcpuSum(Dev,Sum);
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	list_for_each_entry(FilePrivate,&Dev->Files,I2cFlashFileNode)
+	{
+		WindowMax = max(WindowMax,FilePrivate->I2cFlashFileReadAheadPages);
+	}
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	seq_printf(Seq,"pages_read %lu\npages_written %lu\npages_erased %lu\nbus_transactions %lu\n"
+	               "nacks %lu\nbus_errors %lu\nretries %lu\nrequests_submitted %lu\nebusy_rejections %lu\n"
+	               "queue_depth %u\nqueue_depth_max %u\nqueue_size %u\n"
+	               "write_bytes_queued %lu\nwrite_allocations %lu\nwrite_bytes_copied %lu\n"
+	               "write_allocations_per_mb %llu\nwrite_bytes_copied_per_mb %llu\n"
+	               "readahead_hits %lu\nreadahead_late %lu\nreadahead_misses %lu\nreadahead_hit_rate_pct %lu\n"
+	               "readahead_bytes %lu\nreadahead_wasted_bytes %lu\nreadahead_window_max %u\n"
+	               "priority_reads %lu\npriority_deferred %lu\npreemptions %lu\npriority_queue_depth %u\n"
+	               "requests_timed_out %lu\nrequests_cancelled %lu\nrequests_failed %lu\n"
+	               "crc_known_pages %u\ncrc_suspect_pages %u\n",
+	           Sum->PagesRead,Sum->PagesWritten,Sum->PagesErased,Dev->Stats.I2cFlashBusTransactions,
+	           Sum->Nacks,Sum->BusErrors,Sum->Retries,Sum->Submitted,Sum->EbusyRejections,
+	           READ_ONCE(Dev->Queue.I2cFlashRingCount),READ_ONCE(Dev->Queue.I2cFlashRingMaxCount),Dev->Queue.I2cFlashRingDepth,
+	           Sum->BytesQueued,Sum->Allocations,Sum->BytesCopied,
+	           (0 == Sum->BytesQueued) ? 0ULL : div64_u64(((unsigned long long)Sum->Allocations << 20),Sum->BytesQueued),
+	           (0 == Sum->BytesQueued) ? 0ULL : div64_u64(((unsigned long long)Sum->BytesCopied << 20),Sum->BytesQueued),
+	           Sum->ReadAheadHits,Sum->ReadAheadLate,Sum->ReadAheadMisses,
+	           (0 == (Sum->ReadAheadHits + Sum->ReadAheadLate + Sum->ReadAheadMisses)) ? 0UL :
+	           ((100 * (Sum->ReadAheadHits + Sum->ReadAheadLate)) / (Sum->ReadAheadHits + Sum->ReadAheadLate + Sum->ReadAheadMisses)),
+	           Sum->ReadAheadBytes,Sum->ReadAheadWasted,WindowMax,
+	           Sum->PriorityReads,Sum->PriorityDeferred,Sum->Preemptions,READ_ONCE(Dev->Queue.I2cFlashPriorityCount),
+	           Sum->Timeouts,Sum->Cancellations,Sum->Failures,
+	           bitmap_weight(Dev->CrcKnown,Dev->PageCount),bitmap_weight(Dev->CrcSuspect,Dev->PageCount));
+	kfree(Sum);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDebugHistogramsShow
+ * CALLED BY:        seq_file, when debugfs histograms is read
+ * DESCRIPTION:      prints the latency histograms of a chip, one row per
+ *                   power of two micro seconds
+ * INPUT PARAMETERS: Seq : output
+ *                   Unused : not used
+ * RETURN VALUES:    int : 0
+ ***********************************************************************/
+static int I2cFlashDebugHistogramsShow(struct seq_file *Seq, void *Unused)
+{
+	I2cFlashDevType *Dev = (I2cFlashDevType*)Seq->private;
+	I2cFlashPcpuStatsType *Sum = kmalloc(sizeof(I2cFlashPcpuStatsType),GFP_KERNEL); /* too big for the stack */
+	unsigned int Bucket = 0;
+	if (NULL == Sum)
+	{
+		return -ENOMEM;
+	}
+	I2cFlashPcpuSum(Dev,Sum);
+	seq_printf(Seq,"%-10s %-10s %10s %10s %10s %12s\n","from_us","to_us","read","write","erase","write_cycle");
+	for (Bucket = 0; Bucket < HIST_BUCKETS; Bucket++)
+	{
+		seq_printf(Seq,"%-10lu ",(0 == Bucket) ? 0UL : (1UL << (Bucket - 1)));
+		if ((HIST_BUCKETS - 1) == Bucket)
+		{
+			seq_printf(Seq,"%-10s ","-");
+		}
+		else
+		{
+			seq_printf(Seq,"%-10lu ",((1UL << Bucket) - 1));
+		}
+		seq_printf(Seq,"%10lu %10lu %10lu %12lu\n",Sum->Latency[HIST_READ][Bucket],Sum->Latency[HIST_WRITE][Bucket],
+		           Sum->Latency[HIST_ERASE][Bucket],Sum->Latency[HIST_WRITE_CYCLE][Bucket]);
+	}
+	kfree(Sum);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDebugCountersOpen/I2cFlashDebugHistogramsOpen
+ * CALLED BY:        debugfs
+ * DESCRIPTION:      open the seq_file of the chip stored in the inode
+ * INPUT PARAMETERS: inode pointer:pointer to the inode of the caller
+ *                   filept:file pointer used by this inode
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+static int I2cFlashDebugCountersOpen(struct inode *inode, struct file *filept)
+{
+	return single_open(filept,I2cFlashDebugCountersShow,inode->i_private);
+}
+
+static int I2cFlashDebugHistogramsOpen(struct inode *inode, struct file *filept)
+{
+	return single_open(filept,I2cFlashDebugHistogramsShow,inode->i_private);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashDebugResetWrite
+ * CALLED BY:        debugfs, when reset is written
+ * DESCRIPTION:      clears the counters and histograms of every cpu. An
+ *                   increment racing with the reset may survive it.
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   buf : data written by the user (ignored)
+ *                   count : length of the data
+ *                   offp : not used
+ * RETURN VALUES:    ssize_t : count
+ ***********************************************************************/
+static ssize_t I2cFlashDebugResetWrite(struct file *filept, const char __user *buf, size_t count, loff_t *offp)
+{
+	I2cFlashDevType *Dev = (I2cFlashDevType*)(filept->f_inode->i_private);
+	int CpuNumber = 0;
+	for_each_possible_cpu(CpuNumber)
+	{
+		memset(per_cpu_ptr(Dev->PcpuStats,CpuNumber),0,sizeof(I2cFlashPcpuStatsType));
+	}
+	spin_lock(&Dev->Queue.I2cFlashRingLock);
+	Dev->Queue.I2cFlashRingMaxCount = Dev->Queue.I2cFlashRingCount;
+	spin_unlock(&Dev->Queue.I2cFlashRingLock);
+	return count;
+}
+
+/* debugfs files of a chip */
+static const struct file_operations I2cFlashDebugCountersFops = {
+    .owner = THIS_MODULE,
+    .open = I2cFlashDebugCountersOpen,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static const struct file_operations I2cFlashDebugHistogramsFops = {
+    .owner = THIS_MODULE,
+    .open = I2cFlashDebugHistogramsOpen,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static const struct file_operations I2cFlashDebugResetFops = {
+    .owner = THIS_MODULE,
+    .write = I2cFlashDebugResetWrite,
+};
+
+/* Assigning operations to file operation structure */
+static struct file_operations I2cFlashFops = {
+    .owner = THIS_MODULE, /* Owner */
+    .llseek = I2cFlashDriverLlseek, /* Seek method, used by pread/pwrite too */
+    .open = I2cFlashDriverOpen, /* Open method */
+    .release = I2cFlashDriverRelease, /* Release method */
+    .write = I2cFlashDriverWrite, /* Write method */
+    .read = I2cFlashDriverRead, /* Read method */
+    .write_iter = I2cFlashDriverWriteIter, /* writev, aio and io_uring writes */
+    .read_iter = I2cFlashDriverReadIter, /* readv, aio and io_uring reads */
+    .unlocked_ioctl = I2cFlashDriverIoctl,
+    .poll = I2cFlashDriverPoll, /* Poll method, POLLIN when read data is ready */
+    .mmap = I2cFlashDriverMmap, /* Maps the image of the EEPROM */
+    .fsync = I2cFlashDriverFsync, /* Writes back the mapped image */
+};
+
+/* *********************************************************************
+ * NAME:             I2cFlashFreeDev
+ * CALLED BY:        I2cFlashProbe on failure and I2cFlashRemove
+ * DESCRIPTION:      stops the worker of a chip once its queue is drained
+ *                   and frees the chip data along with its minor number
+ * INPUT PARAMETERS: Dev : chip data
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashFreeDev(I2cFlashDevType *Dev)
+{
+	debugfs_remove_recursive(Dev->DebugDir);
+	if (NULL != Dev->WorkQueue)
+	{
+		/* let the work function drain the requests which are still queued */
+		flush_workqueue(Dev->WorkQueue);
+		destroy_workqueue(Dev->WorkQueue);
+	}
+	/* free the ring buffers, the work function has emptied them */
+	kfree(Dev->Queue.I2cFlashRequestRing);
+	kfree(Dev->Queue.I2cFlashPriorityRing);
+	vfree(Dev->Shadow);
+	vfree(Dev->MmapImage);
+	vfree(Dev->MmapReference);
+	free_percpu(Dev->PcpuStats);
+	vfree(Dev->PoolFrames);
+	bitmap_free(Dev->PoolFrameMap);
+	kfree(Dev->PoolRequests);
+	kfree(Dev->PoolFree);
+	if (NULL != Dev->Client)
+	{
+		i2c_set_clientdata(Dev->Client,NULL);
+	}
+	mutex_lock(&I2cFlashMinorLock);
+	clear_bit(Dev->Minor,I2cFlashMinors);
+	mutex_unlock(&I2cFlashMinorLock);
+	kfree(Dev);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashProbe
+ * CALLED BY:        i2c-core
+ * DESCRIPTION:      this is called for every chip created by this module.
+ *                   Sets up the request queue, the worker and the shadow
+ *                   image of the chip and creates its device node,
+ *                   /dev/i2c_flash for the first chip, /dev/i2c_flash1
+ *                   and so on for the others.
+ * INPUT PARAMETERS: Client pointer:pointer to the client of the chip
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+int I2cFlashProbe(struct i2c_client *ReceivedClient)
+{
+	const struct i2c_device_id *ReceivedDeviceIdInfo = i2c_client_get_device_id(ReceivedClient); /* NULL if matched by device tree */
+	I2cFlashDevType *Dev = NULL; /* data of the new chip */
+	int Ret = 0;
 #ifdef DEBUG
-		      printk("\n Inside do while");
-#endif
-#ifdef LED_DYNAMIC
-               gpio_set_value_cansleep(26,1);
-#endif
-		      Status = i2c_master_send(I2cFlashClient,(const char *)I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr,(PAGESIZE + 2));
-#ifdef LED_DYNAMIC
-		       gpio_set_value_cansleep(26,0);
+    printk(KERN_INFO "\n I2cFlashProbe function called for chip address %d\n",ReceivedClient->addr);
 #endif
+	Dev = kzalloc(sizeof(I2cFlashDevType),GFP_KERNEL);
+	if (NULL == Dev)
+	{
+		printk(KERN_INFO "\nI2cFlash device not allocated\n");
+		return -ENOMEM;
+	}
+	mutex_lock(&I2cFlashMinorLock);
+	Dev->Minor = find_first_zero_bit(I2cFlashMinors,NUMBER_OF_DEVICES);
+	if (NUMBER_OF_DEVICES <= Dev->Minor)
+	{
+		mutex_unlock(&I2cFlashMinorLock);
+		kfree(Dev);
+		return -ENOSPC;
+	}
+	set_bit(Dev->Minor,I2cFlashMinors);
+	mutex_unlock(&I2cFlashMinorLock);
+	/* Copy the respective device name */
+	if (0 == Dev->Minor)
+	{
+		sprintf(Dev->name,DEVICE_NAME);
+	}
+	else
+	{
+		sprintf(Dev->name,DEVICE_NAME "%u",Dev->Minor);
+	}
+	Dev->Client = ReceivedClient;
+	i2c_set_clientdata(ReceivedClient,Dev);
+	/* geometry of the part, from the device tree or from the device id */
+	Dev->Geometry = (const I2cFlashGeometryType*)of_device_get_match_data(&ReceivedClient->dev);
+	if (NULL == Dev->Geometry)
+	{
+		Dev->Geometry = &I2cFlashGeometries[(NULL != ReceivedDeviceIdInfo) ? ReceivedDeviceIdInfo->driver_data : PART_24FC256];
+	}
+	Dev->PageShift = Dev->Geometry->PageShift;
+	Dev->PageSize = 1U << Dev->Geometry->PageShift;
+	Dev->Size = 1U << Dev->Geometry->SizeShift;
+	Dev->PageCount = 1U << (Dev->Geometry->SizeShift - Dev->Geometry->PageShift);
+	Dev->BlockShift = Dev->Geometry->AddressBytes * 8;
+	if (0 != I2cFlashPersistManifest)
+	{
+		/* the manifest takes the last pages, the device node ends before them */
+		Dev->ManifestPages = DIV_ROUND_UP((sizeof(I2cFlashManifestHeaderType) + (Dev->PageCount * sizeof(u32))),Dev->PageSize);
+		if ((Dev->ManifestPages * 4) > Dev->PageCount)
+		{
+			printk(KERN_WARNING "\n i2c_flash: a %s is too small to keep a manifest\n",Dev->Geometry->Name);
+			Dev->ManifestPages = 0;
+		}
+		Dev->PageCount -= Dev->ManifestPages;
+		Dev->ManifestPage = Dev->PageCount;
+		Dev->Size = Dev->PageCount << Dev->PageShift;
+	}
+	if (ReceivedClient->addr & (((1U << Dev->Geometry->BlockSelectBits) - 1) << Dev->Geometry->BlockSelectShift))
+	{
+		/* the block select bits of the address belong to the chip itself */
+		printk(KERN_ERR "\n i2c_flash: address 0x%02x is not the first block of a %s\n",ReceivedClient->addr,Dev->Geometry->Name);
+		I2cFlashFreeDev(Dev);
+		return -EINVAL;
+	}
+	/* Allocate the ring buffer of the request queue */
+	Dev->Queue.I2cFlashReadOrWrite = NONE;
+	Dev->Queue.I2cFlashRequestRing = kzalloc((sizeof(I2cFlashRequestType*) * I2cFlashQueueDepth), GFP_KERNEL);
+	Dev->Queue.I2cFlashPriorityRing = kzalloc((sizeof(I2cFlashRequestType*) * I2cFlashQueueDepth), GFP_KERNEL);
+	if ((NULL == Dev->Queue.I2cFlashRequestRing) || (NULL == Dev->Queue.I2cFlashPriorityRing))
+	{
+		printk("Request queue could not be allocated ! \n");
+		I2cFlashFreeDev(Dev);
+		return -ENOMEM;
+	}
+	Dev->Queue.I2cFlashRingDepth = I2cFlashQueueDepth;
+	/* counters and histograms, updated from the first transfer on */
+	Dev->PcpuStats = alloc_percpu(I2cFlashPcpuStatsType);
+	if (NULL == Dev->PcpuStats)
+	{
+		I2cFlashFreeDev(Dev);
+		return -ENOMEM;
+	}
+	spin_lock_init(&Dev->Queue.I2cFlashRingLock);
+	init_waitqueue_head(&Dev->Queue.I2cFlashWaitQueue);
+	INIT_LIST_HEAD(&Dev->Files);
+	mutex_init(&Dev->BusLock);
+	/* descriptors and page frames of the write path, so that a write allocates nothing */
+	spin_lock_init(&Dev->PoolLock);
+	Dev->PoolRequests = kcalloc(I2cFlashQueueDepth,sizeof(I2cFlashRequestType),GFP_KERNEL);
+	Dev->PoolFree = kcalloc(I2cFlashQueueDepth,sizeof(I2cFlashRequestType*),GFP_KERNEL);
+	if ((NULL == Dev->PoolRequests) || (NULL == Dev->PoolFree))
+	{
+		I2cFlashFreeDev(Dev);
+		return -ENOMEM;
+	}
+	for (Dev->PoolFreeCount = 0; Dev->PoolFreeCount < I2cFlashQueueDepth; Dev->PoolFreeCount++)
+	{
+		Dev->PoolFree[Dev->PoolFreeCount] = &Dev->PoolRequests[Dev->PoolFreeCount];
+	}
+	if (0 != I2cFlashPoolFrames)
+	{
+		Dev->PoolFrames = vmalloc(I2cFlashPoolFrames * FRAMESIZE(Dev));
+		Dev->PoolFrameMap = bitmap_zalloc(I2cFlashPoolFrames,GFP_KERNEL);
+		if ((NULL == Dev->PoolFrames) || (NULL == Dev->PoolFrameMap))
+		{
+			I2cFlashFreeDev(Dev);
+			return -ENOMEM;
+		}
+		Dev->PoolFrameCount = I2cFlashPoolFrames;
+	}
+	memset(Dev->BlankFrame,0xFF,sizeof(Dev->BlankFrame));
+	Dev->BlankCrc = I2cFlashPageCrc(Dev,(char *)&Dev->BlankFrame[FRAME_HEADER]);
+	/* shadow image of the EEPROM, filled by the blank check below */
+	Dev->Shadow = vmalloc(Dev->Size);
+	Dev->ShadowEnable = ((NULL != Dev->Shadow) && (0 != I2cFlashCacheEnable));
+	/* image for mmap, allocated on the first mmap */
+	mutex_init(&Dev->MmapLock);
+	/* one worker per chip, chips on other adapters run in parallel and chips
+	   sharing a bus use it while the others are in their write cycle */
+	Dev->WorkQueue = create_singlethread_workqueue(Dev->name);
+	if (NULL == Dev->WorkQueue)
+	{
+		I2cFlashFreeDev(Dev);
+		return -ENOMEM;
+	}
+	INIT_WORK(&Dev->Work,I2cFlashWorkFunction);
+	/* find out which pages are already blank, used by erase, from the stored manifest if it can be trusted */
+	if (!I2cFlashManifestLoad(Dev))
+	{
+		I2cFlashScanBlankPages(Dev);
+	}
+	/* Connect the file operations with the cdev */
+	cdev_init(&Dev->cdev,&I2cFlashFops);
+	Dev->cdev.owner = THIS_MODULE;
+	/* Connect the major/minor number to the cdev */
+	Ret = cdev_add(&Dev->cdev,MKDEV(MAJOR(I2cFlashDevNumber),Dev->Minor),1);
+	if (Ret)
+	{
+		printk("Bad cdev\n");
+		I2cFlashFreeDev(Dev);
+		return Ret;
+	}
+	Dev->Device = device_create(I2cFlashDevClass,&ReceivedClient->dev,MKDEV(MAJOR(I2cFlashDevNumber),Dev->Minor),Dev,Dev->name);
+	/* bus statistics, "cat /sys/class/i2c_flash/i2c_flash/stats" */
+	device_create_file(Dev->Device,&dev_attr_stats);
+	/* counters and latency histograms, "cat /sys/kernel/debug/i2c_flash/i2c_flash/histograms" */
+	Dev->DebugDir = debugfs_create_dir(Dev->name,I2cFlashDebugRoot);
+	debugfs_create_file("counters",S_IRUGO,Dev->DebugDir,Dev,&I2cFlashDebugCountersFops);
+	debugfs_create_file("histograms",S_IRUGO,Dev->DebugDir,Dev,&I2cFlashDebugHistogramsFops);
+	debugfs_create_file("reset",S_IWUSR,Dev->DebugDir,Dev,&I2cFlashDebugResetFops);
+	printk(KERN_INFO "\n %s : %s at address 0x%02x, %u pages of %u bytes\n",Dev->name,Dev->Geometry->Name,
+	       ReceivedClient->addr,Dev->PageCount,Dev->PageSize);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashRemove
+ * CALLED BY:        i2c-core
+ * DESCRIPTION:      this is called if i2c core finds a device is 
+ *                   is unregistered. Removes the device node of the chip
+ *                   and frees its data once the queue is drained.
+ * INPUT PARAMETERS: Client pointer:pointer to the client of the chip
+ * RETURN VALUES:    None
+ ***********************************************************************/
+void I2cFlashRemove(struct i2c_client *ReceivedClient)
+{
+	I2cFlashDevType *Dev = (I2cFlashDevType*)i2c_get_clientdata(ReceivedClient);
 #ifdef DEBUG
-		      printk("\nWrite status = %i",Status);
-#endif
-	       }while((PAGESIZE +2) != Status);
-	   }
-#ifndef LED_DYNAMIC
-       gpio_set_value_cansleep(26,0);
+	printk(KERN_INFO "\n I2cFlash client is being deleted \n");
 #endif
-	   /* freeup the memory just allocated for erase purpose */
-	   kfree(I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr);
-       I2cFlashWorkQueuePrivate.I2cFlashReadOrWrite = NONE;
+	device_remove_file(Dev->Device,&dev_attr_stats);
+	device_destroy(I2cFlashDevClass,MKDEV(MAJOR(I2cFlashDevNumber),Dev->Minor));
+	cdev_del(&Dev->cdev);
+	if (0 != Dev->ManifestPages)
+	{
+		/* the CRCs are stored once the last queued write is done */
+		flush_workqueue(Dev->WorkQueue);
+		I2cFlashManifestStore(Dev);
+	}
+	I2cFlashFreeDev(Dev);
+}
+
+/* This is the driver that will be inserted */
+static struct i2c_driver I2cFlashDriver = {
+	.id_table   = my_device_id,
+	.driver     = {
+	                .owner = THIS_MODULE,
+	                .name		= "i2c_flash",
+	                .of_match_table = of_match_ptr(I2cFlashOfMatch)
+	             },
+	.probe = &I2cFlashProbe,
+	.remove = &I2cFlashRemove,
+	.detect = &I2cFlashDetect
+};
+
+/* *********************************************************************
+ * NAME:             I2cFlashStripeSplit
+ * CALLED BY:        read and write of the striped device
+ * DESCRIPTION:      creates one request per chip for a byte range of the
+ *                   striped device. Consecutive pages of a chip are
+ *                   consecutive in the striped device once every Width
+ *                   pages, so the bytes of each chip form one range and
+ *                   its work function can write them back to back. A
+ *                   write comes from the pool of its chip, with page
+ *                   frames, like a write to a chip.
+ * INPUT PARAMETERS: Stripe : striped device
+ *                   Address : first byte in the striped device
+ *                   Length : number of bytes
+ *                   State : I2CFLASHREAD or I2CFLASHWRITE
+ *                   Requests : filled with the request of each chip,
+ *                              NULL for a chip without bytes
+ * RETURN VALUES:    int : 0 if created, -ENOMEM otherwise
+ ***********************************************************************/
+static int I2cFlashStripeSplit(I2cFlashStripeType *Stripe, unsigned int Address, unsigned int Length,
+                               I2cFlashReadOrWriteType State, I2cFlashRequestType **Requests)
+{
+	I2cFlashDevType *Dev = Stripe->Chips[0]; /* the chips share one geometry */
+	unsigned int ChipAddress[NUMBER_OF_DEVICES]; /* first byte of the part of every chip */
+	unsigned int ChipLength[NUMBER_OF_DEVICES] = {0}; /* bytes of the part of every chip */
+	unsigned int Offset = 0; /* bytes handled so far */
+	unsigned int Part = 0; /* bytes within one page */
+	unsigned int PageNumber = 0; /* page of the striped device */
+	unsigned int Chip = 0; /* column the page belongs to */
+	memset(Requests,0,(sizeof(I2cFlashRequestType*) * NUMBER_OF_DEVICES));
+	for (Offset = 0; Offset < Length; Offset += Part)
+	{
+		PageNumber = PAGENO(Dev,Address + Offset);
+		Part = Dev->PageSize - OFFSET(Dev,Address + Offset);
+		if (Part > (Length - Offset))
+		{
+			Part = Length - Offset;
+		}
+		Chip = PageNumber % Stripe->Width;
+		if (0 == ChipLength[Chip])
+		{
+			ChipAddress[Chip] = JOIN(Dev,(PageNumber / Stripe->Width),OFFSET(Dev,Address + Offset));
+		}
+		ChipLength[Chip] += Part;
+	}
+	for (Chip = 0; Chip < Stripe->Width; Chip++)
+	{
+		if (0 == ChipLength[Chip])
+		{
+			continue;
+		}
+		if (I2CFLASHWRITE == State)
+		{
+			Requests[Chip] = I2cFlashAllocRequest(Stripe->Chips[Chip],ChipAddress[Chip],ChipLength[Chip],1);
+		}
+		else
+		{
+			Requests[Chip] = kzalloc(sizeof(I2cFlashRequestType),GFP_KERNEL);
+			if (NULL != Requests[Chip])
+			{
+				Requests[Chip]->I2cFlashRequestBufferPtr = (char*)kzalloc(ChipLength[Chip],GFP_KERNEL);
+				if (NULL == Requests[Chip]->I2cFlashRequestBufferPtr)
+				{
+					kfree(Requests[Chip]);
+					Requests[Chip] = NULL;
+				}
+			}
+		}
+		if (NULL == Requests[Chip])
+		{
+			return -ENOMEM;
+		}
+		Requests[Chip]->I2cFlashRequestState = State;
+		Requests[Chip]->I2cFlashRequestAddress = ChipAddress[Chip];
+		Requests[Chip]->I2cFlashRequestLength = ChipLength[Chip];
+	}
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashStripeFill
+ * CALLED BY:        write of the striped device
+ * DESCRIPTION:      copies the user data of a striped range straight to
+ *                   the page frames of the write requests of the chips
+ * INPUT PARAMETERS: Stripe : striped device
+ *                   Address : first byte in the striped device
+ *                   Length : number of bytes
+ *                   buf : user data in the order of the striped device
+ *                   Requests : write requests made by I2cFlashStripeSplit
+ * RETURN VALUES:    int : 0 if copied, -EFAULT otherwise
+ ***********************************************************************/
+static int I2cFlashStripeFill(I2cFlashStripeType *Stripe, unsigned int Address, unsigned int Length,
+                              const char *buf, I2cFlashRequestType **Requests)
+{
+	I2cFlashDevType *Dev = Stripe->Chips[0]; /* the chips share one geometry */
+	unsigned int Offset = 0; /* bytes handled so far */
+	unsigned int Part = 0; /* bytes within one page */
+	unsigned int PageNumber = 0; /* page of the striped device */
+	unsigned int Chip = 0; /* column the page belongs to */
+	I2cFlashRequestType *Request = NULL; /* request of the chip holding the page */
+	for (Offset = 0; Offset < Length; Offset += Part)
+	{
+		PageNumber = PAGENO(Dev,Address + Offset);
+		Part = Dev->PageSize - OFFSET(Dev,Address + Offset);
+		if (Part > (Length - Offset))
+		{
+			Part = Length - Offset;
+		}
+		Chip = PageNumber % Stripe->Width;
+		Request = Requests[Chip];
+		if (copy_from_user(I2cFlashRequestData(Stripe->Chips[Chip],Request,
+		                                       (JOIN(Dev,(PageNumber / Stripe->Width),OFFSET(Dev,Address + Offset)) - Request->I2cFlashRequestAddress)),
+		                   (buf + Offset),Part))
+		{
+			return -EFAULT;
+		}
+		this_cpu_add(Stripe->Chips[Chip]->PcpuStats->BytesCopied,Part);
+	}
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashStripeCopy
+ * CALLED BY:        read of the striped device
+ * DESCRIPTION:      copies the bytes of a striped range from the buffers
+ *                   of the read requests of the chips to a linear buffer
+ * INPUT PARAMETERS: Stripe : striped device
+ *                   Address : first byte in the striped device
+ *                   Length : number of bytes
+ *                   Linear : filled in the order of the striped device
+ *                   Requests : requests made by I2cFlashStripeSplit
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashStripeCopy(I2cFlashStripeType *Stripe, unsigned int Address, unsigned int Length,
+                               char *Linear, I2cFlashRequestType **Requests)
+{
+	I2cFlashDevType *Dev = Stripe->Chips[0]; /* the chips share one geometry */
+	unsigned int Offset = 0; /* bytes handled so far */
+	unsigned int Part = 0; /* bytes within one page */
+	unsigned int PageNumber = 0; /* page of the striped device */
+	I2cFlashRequestType *Request = NULL; /* request of the chip holding the page */
+	char *ChipData = NULL; /* bytes of the page in the request */
+	for (Offset = 0; Offset < Length; Offset += Part)
+	{
+		PageNumber = PAGENO(Dev,Address + Offset);
+		Part = Dev->PageSize - OFFSET(Dev,Address + Offset);
+		if (Part > (Length - Offset))
+		{
+			Part = Length - Offset;
+		}
+		Request = Requests[PageNumber % Stripe->Width];
+		ChipData = Request->I2cFlashRequestBufferPtr +
+		           (JOIN(Dev,(PageNumber / Stripe->Width),OFFSET(Dev,Address + Offset)) - Request->I2cFlashRequestAddress);
+		memcpy((Linear + Offset),ChipData,Part);
+	}
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashStripeQueue
+ * CALLED BY:        read, write and ioctl of the striped device
+ * DESCRIPTION:      queues the part of every chip, or none of them. A
+ *                   slot is set aside on every chip first, in the order
+ *                   of the chips, sleeping while a queue is full unless
+ *                   the file is non blocking. Once all are held the
+ *                   parts are submitted, which can not fail any more, so
+ *                   a full queue or a signal never leaves a part of a
+ *                   striped request queued without the others.
+ * INPUT PARAMETERS: Stripe : striped device
+ *                   Requests : part of every chip, NULL for a chip
+ *                              without bytes
+ *                   ChipFiles : per chip file data remembering the
+ *                               request ids
+ *                   Blocking : 0 for a file opened with O_NONBLOCK
+ * RETURN VALUES:    int : 0 if all the parts are queued, -EBUSY if a
+ *                         queue is full (non blocking only), -ERESTARTSYS
+ *                         on a signal, then none is and the caller still
+ *                         owns the requests
+ ***********************************************************************/
+static int I2cFlashStripeQueue(I2cFlashStripeType *Stripe, I2cFlashRequestType **Requests, I2cFlashFileType *ChipFiles,
+                               unsigned char Blocking)
+{
+	unsigned int Chip = 0;
+	unsigned int Held = 0; /* chips with a slot set aside */
+	int RetValue = 0;
+	for (Held = 0; Held < Stripe->Width; Held++)
+	{
+		if (NULL != Requests[Held])
+		{
+			RetValue = I2cFlashReserveSlot(Stripe->Chips[Held],Blocking);
+			if (RetValue)
+			{
+				break;
+			}
+		}
+	}
+	if (RetValue)
+	{
+		for (Chip = 0; Chip < Held; Chip++)
+		{
+			if (NULL != Requests[Chip])
+			{
+				I2cFlashUnreserveSlot(Stripe->Chips[Chip]);
+			}
+		}
+		return RetValue;
+	}
+	for (Chip = 0; Chip < Stripe->Width; Chip++)
+	{
+		if (NULL != Requests[Chip])
+		{
+			Requests[Chip]->I2cFlashRequestReserved = 1;
+			I2cFlashSubmitRequest(Stripe->Chips[Chip],Requests[Chip],&ChipFiles[Chip]);
+		}
+	}
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashStripeDone
+ * CALLED BY:        read and blocking write of the striped device
+ * DESCRIPTION:      turns the bytes each chip got done of its part into
+ *                   the bytes of the striped range done from its start,
+ *                   which end at the first byte a chip did not do
+ * INPUT PARAMETERS: Stripe : striped device
+ *                   Address : first byte in the striped device
+ *                   Length : number of bytes
+ *                   ChipDone : bytes done from the start of the part of
+ *                              every chip
+ * RETURN VALUES:    unsigned int : bytes done from Address on
+ ***********************************************************************/
+static unsigned int I2cFlashStripeDone(I2cFlashStripeType *Stripe, unsigned int Address, unsigned int Length,
+                                       const unsigned int *ChipDone)
+{
+	I2cFlashDevType *Dev = Stripe->Chips[0]; /* the chips share one geometry */
+	unsigned int Used[NUMBER_OF_DEVICES] = {0}; /* bytes of the part of every chip passed so far */
+	unsigned int Offset = 0; /* bytes handled so far */
+	unsigned int Part = 0; /* bytes within one page */
+	unsigned int Chip = 0; /* column the page belongs to */
+	for (Offset = 0; Offset < Length; Offset += Part)
+	{
+		Part = Dev->PageSize - OFFSET(Dev,Address + Offset);
+		if (Part > (Length - Offset))
+		{
+			Part = Length - Offset;
+		}
+		Chip = PAGENO(Dev,Address + Offset) % Stripe->Width;
+		if ((Used[Chip] + Part) > ChipDone[Chip])
+		{
+			return Offset + (ChipDone[Chip] - Used[Chip]);
+		}
+		Used[Chip] += Part;
+	}
+	return Length;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashStripeDropRead
+ * CALLED BY:        read and release of the striped device
+ * DESCRIPTION:      detaches the parts of the pending read of the file
+ *                   from it, those still queued are freed by the work
+ *                   functions of their chips
+ * INPUT PARAMETERS: StripeFile : per file data
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashStripeDropRead(I2cFlashStripeFileType *StripeFile)
+{
+	unsigned int Chip = 0;
+	for (Chip = 0; Chip < StripeFile->Stripe->Width; Chip++)
+	{
+		I2cFlashDropReadRequest(&StripeFile->ChipFile[Chip]);
+	}
+	StripeFile->PendingCount = 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashStripeOpen
+ * CALLED BY:        User App through kernel
+ * DESCRIPTION:      allocates the per file data of the striped device
+ * INPUT PARAMETERS: inode pointer:pointer to the inode of the caller
+ *                   filept:file pointer used by this inode
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+int I2cFlashStripeOpen(struct inode *inode, struct file *filept)
+{
+	I2cFlashStripeType *Stripe = container_of(inode->i_cdev, I2cFlashStripeType, cdev);
+	I2cFlashStripeFileType *StripeFile = NULL; /* per file data */
+	unsigned int Chip = 0;
+	StripeFile = kzalloc(sizeof(I2cFlashStripeFileType),GFP_KERNEL);
+	if (NULL == StripeFile)
+	{
+		return -ENOMEM;
 	}
-	else
+	StripeFile->Stripe = Stripe;
+	for (Chip = 0; Chip < Stripe->Width; Chip++)
 	{
-		/* Work function need not to do anything in I2CFLASHDATAREADY or NONE */
+		StripeFile->ChipFile[Chip].I2cFlashFileDev = Stripe->Chips[Chip];
+		StripeFile->ChipFile[Chip].I2cFlashFileDeadlineMs = I2cFlashDeadlineMs;
+		StripeFile->ChipFile[Chip].I2cFlashFileRetries = I2cFlashRetryBudget;
 	}
+	filept->private_data = StripeFile;
+	return 0;
 }
+
 /* *********************************************************************
- * NAME:             I2cFlashDriverWrite
+ * NAME:             I2cFlashStripeRelease
+ * CALLED BY:        User App through kernel
+ * DESCRIPTION:      frees the per file data of the striped device along
+ *                   with its pending read
+ * INPUT PARAMETERS: inode pointer:pointer to the inode of the caller
+ *                   filept:file pointer used by this inode
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+int I2cFlashStripeRelease(struct inode *inode, struct file *filept)
+{
+	I2cFlashStripeFileType *StripeFile = (I2cFlashStripeFileType*)(filept->private_data);
+	unsigned int Chip = 0;
+	I2cFlashStripeDropRead(StripeFile);
+	for (Chip = 0; Chip < StripeFile->Stripe->Width; Chip++)
+	{
+		I2cFlashForgetFile(StripeFile->Stripe->Chips[Chip],&StripeFile->ChipFile[Chip]);
+	}
+	kfree(StripeFile);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashStripeWrite
  * CALLED BY:        User App through kernel
- * DESCRIPTION:      writes chunk of data to the message buffer
+ * DESCRIPTION:      splits the data on page boundaries and queues the
+ *                   part of every chip to its own request queue. The
+ *                   workers of the chips write their pages at the same
+ *                   time, so the write cycles of the chips overlap. A
+ *                   file opened with O_NONBLOCK returns once the parts
+ *                   are queued, otherwise the caller sleeps until every
+ *                   chip has written its part, like a write to a chip.
  * INPUT PARAMETERS: filept:file pointer used by this inode
  *                   buf : pointer to the user data
- *                   count : no of bytes to be copied to the msg buffer
- *                   offp: offset from which the string to be written
- *                         (not used)
- * RETURN VALUES:    ssize_t : remaining number of bytes that are to be
- *                             written. EBUSY if EEPROM is busy
+ *                   count : no of bytes to be written
+ *                   offp: byte offset in the striped device
+ * RETURN VALUES:    ssize_t : number of bytes queued, or written for a
+ *                             blocking file, fewer if a chip stopped
+ *                             part way. EBUSY if a request queue is full
+ *                             (O_NONBLOCK only), ENOSPC at the end of
+ *                             the device, ETIMEDOUT, ECANCELED or the
+ *                             bus error if it failed (blocking only)
  ***********************************************************************/
-ssize_t I2cFlashDriverWrite(struct file *filept, const char *buf,size_t count, loff_t *offp)
+ssize_t I2cFlashStripeWrite(struct file *filept, const char *buf,size_t count, loff_t *offp)
 {
-	ssize_t RetValue =  0; /* Error code sent when the buffer is full */
-    /* If no read-write operation is going on , invoke new write operation */
-    if (NONE == I2cFlashWorkQueuePrivate.I2cFlashReadOrWrite)
-    {
-		/* allocate the memory and copy the entire data sent by the user */
-		I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr = (unsigned char*)kzalloc((PAGESIZE * count),GFP_KERNEL);
-	    if (copy_from_user(I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr,buf,(PAGESIZE * count)))
-	    {
-		    printk(" \nError copying from user space");
-		    return 0;
-	    }
-	    else
-	    {
-#ifdef DEBUG
-	        printk(" Driver received data from main \n started to write to EEPROM !! \n ");
-#endif
-        }
-		/* No Read/Write operation is going on */
-        I2cFlashWorkQueuePrivate.I2cFlashReadOrWrite = I2CFLASHWRITE;
-        I2cFlashWorkQueuePrivate.I2cFlashWorkQueuePageCount = count;
-#ifdef NON_BLOCKING
-        /* Submit to work queue */
-        queue_work(I2cFlashWorkQueue,&I2cFlashWork);
-#else
-         /* Call the function directly in the user's context itself */
-        I2cFlashWorkFunction(&I2cFlashWork);
-#endif
-	    RetValue = 0;
+	I2cFlashStripeFileType *StripeFile = (I2cFlashStripeFileType*)(filept->private_data);
+	I2cFlashStripeType *Stripe = StripeFile->Stripe;
+	I2cFlashDevType *Dev = Stripe->Chips[0]; /* the chips share one geometry */
+	unsigned int Size = Stripe->Width * Dev->Size; /* bytes of the striped device */
+	I2cFlashRequestType *Requests[NUMBER_OF_DEVICES]; /* part of every chip */
+	unsigned int ChipDone[NUMBER_OF_DEVICES] = {0}; /* bytes of every part, then bytes written of it */
+	unsigned char Blocking = !(filept->f_flags & O_NONBLOCK); /* looked at on every call, like a chip file */
+	unsigned int Chip = 0;
+	ssize_t Result = 0; /* outcome of the part of one chip */
+	ssize_t RetValue = 0;
+	if (0 == count)
+	{
+		return 0;
 	}
-	else
+	if ((*offp < 0) || (*offp >= Size))
 	{
-		/* The previous read/write operation is still going on so return -1 with EBUSY */
-		RetValue = -EBUSY;
+		return -ENOSPC;
 	}
-    return RetValue;
+	if (count > (Size - *offp))
+	{
+		count = Size - *offp;
+	}
+	/* the user data goes straight to the page frames of the parts */
+	RetValue = I2cFlashStripeSplit(Stripe,*offp,count,I2CFLASHWRITE,Requests);
+	if (0 == RetValue)
+	{
+		RetValue = I2cFlashStripeFill(Stripe,*offp,count,buf,Requests);
+	}
+	if (0 == RetValue)
+	{
+		for (Chip = 0; Chip < Stripe->Width; Chip++)
+		{
+			ChipDone[Chip] = (NULL != Requests[Chip]) ? Requests[Chip]->I2cFlashRequestLength : 0;
+		}
+		/* Work functions of the chips free the requests after writing them */
+		RetValue = I2cFlashStripeQueue(Stripe,Requests,StripeFile->ChipFile,Blocking);
+	}
+	if (RetValue)
+	{
+		/* nothing is queued, a restarted call writes the whole range */
+		for (Chip = 0; Chip < Stripe->Width; Chip++)
+		{
+			if (NULL != Requests[Chip])
+			{
+				I2cFlashFreeRequest(Requests[Chip]);
+			}
+		}
+		return RetValue;
+	}
+	if (Blocking)
+	{
+		/* the chips write in parallel, wait for every part and report the bytes written from the start */
+		for (Chip = 0; Chip < Stripe->Width; Chip++)
+		{
+			if (0 == ChipDone[Chip])
+			{
+				continue;
+			}
+			Result = I2cFlashWaitResult(&StripeFile->ChipFile[Chip],ChipDone[Chip]);
+			if (Result < 0)
+			{
+				if (0 == RetValue)
+				{
+					RetValue = Result;
+				}
+				Result = 0;
+			}
+			ChipDone[Chip] = Result;
+		}
+		count = I2cFlashStripeDone(Stripe,*offp,count,ChipDone);
+		if (0 == count)
+		{
+			return RetValue;
+		}
+	}
+	*offp += count;
+	return count;
 }
 
 /* *********************************************************************
- * NAME:             I2cFlashDriverRead
+ * NAME:             I2cFlashStripeRead
  * CALLED BY:        User App through kernel
- * DESCRIPTION:      reads chunk of data from the message buffer
+ * DESCRIPTION:      queues the part of every chip to its own request
+ *                   queue and copies the data to the user once all the
+ *                   chips have read their part. Like a read of a chip, a
+ *                   file opened with O_NONBLOCK gets -EAGAIN until then
+ *                   and picks the data up with the same read later,
+ *                   otherwise the caller sleeps for it.
  * INPUT PARAMETERS: filept:file pointer used by this inode
  *                   buf : pointer to the user data
  *                   count : no of bytes to be copied to the user buffer
- *                   offp: offset from which the string to be read
- *                         (not used)
- * RETURN VALUES:    ssize_t : number of bytes written to the user space
- *                  -EAGAIN, if the request is submitted to the workqueue
- *                  -EBUSY, if the EEPROM is busy with read or write oprtn 
+ *                   offp: byte offset in the striped device
+ * RETURN VALUES:    ssize_t : number of bytes written to the user space,
+ *                             fewer if a chip stopped part way
+ *                  -EAGAIN, if the parts are queued or still in the
+ *                           queues (O_NONBLOCK only)
+ *                  -EBUSY, if a request queue is full (O_NONBLOCK only)
+ *                  -ETIMEDOUT, -ECANCELED or the bus error if the read
+ *                           failed before its first byte
  ***********************************************************************/
-ssize_t I2cFlashDriverRead(struct file *filept, char *buf,size_t count, loff_t *offp)
+ssize_t I2cFlashStripeRead(struct file *filept, char *buf,size_t count, loff_t *offp)
 {
-	ssize_t RetValue = -1;
+	I2cFlashStripeFileType *StripeFile = (I2cFlashStripeFileType*)(filept->private_data);
+	I2cFlashStripeType *Stripe = StripeFile->Stripe;
+	I2cFlashDevType *Dev = Stripe->Chips[0]; /* the chips share one geometry */
+	unsigned int Size = Stripe->Width * Dev->Size; /* bytes of the striped device */
+	I2cFlashRequestType *Requests[NUMBER_OF_DEVICES]; /* part of every chip */
+	unsigned int ChipDone[NUMBER_OF_DEVICES] = {0}; /* bytes read of the part of every chip */
+	unsigned char Blocking = !(filept->f_flags & O_NONBLOCK); /* looked at on every call, like a chip file */
+	I2cFlashDevType *ChipDev = NULL; /* chip of one part */
+	unsigned int Chip = 0;
+	char *Data = NULL; /* data in the order of the striped device */
+	ssize_t RetValue = 0;
+	if ((0 == count) || (*offp < 0) || (*offp >= Size))
+	{
+		/* end of the device */
+		return 0;
+	}
+	if (count > (Size - *offp))
+	{
+		count = Size - *offp;
+	}
+	if ((0 != StripeFile->PendingCount) && ((StripeFile->PendingOffset != *offp) || (StripeFile->PendingCount != count)))
+	{
+		/* the pending read was for some other range, it is not wanted anymore */
+		I2cFlashStripeDropRead(StripeFile);
+	}
+	if (0 == StripeFile->PendingCount)
+	{
+		RetValue = I2cFlashStripeSplit(Stripe,*offp,count,I2CFLASHREAD,Requests);
+		for (Chip = 0; (0 == RetValue) && (Chip < Stripe->Width); Chip++)
+		{
+			if (NULL != Requests[Chip])
+			{
+				/* the work function of the chip keeps the data for this file */
+				Requests[Chip]->I2cFlashRequestOwner = &StripeFile->ChipFile[Chip];
+				StripeFile->ChipFile[Chip].I2cFlashFileReadRequest = Requests[Chip];
+			}
+		}
+		if (0 == RetValue)
+		{
+			RetValue = I2cFlashStripeQueue(Stripe,Requests,StripeFile->ChipFile,Blocking);
+		}
+		if (RetValue)
+		{
+			for (Chip = 0; Chip < Stripe->Width; Chip++)
+			{
+				StripeFile->ChipFile[Chip].I2cFlashFileReadRequest = NULL;
+				if (NULL != Requests[Chip])
+				{
+					I2cFlashFreeRequest(Requests[Chip]);
+				}
+			}
+			return RetValue;
+		}
+		StripeFile->PendingOffset = *offp;
+		StripeFile->PendingCount = count;
+	}
+	/* the chips read in parallel, every part must be in before the data goes out */
+	for (Chip = 0; Chip < Stripe->Width; Chip++)
+	{
+		ChipDev = Stripe->Chips[Chip];
+		Requests[Chip] = StripeFile->ChipFile[Chip].I2cFlashFileReadRequest;
+		if (NULL == Requests[Chip])
+		{
+			continue;
+		}
+		if (!Blocking && (I2CFLASHDATAREADY != READ_ONCE(Requests[Chip]->I2cFlashRequestState)))
+		{
+			/* a part is still in the queue of its chip */
+			return -EAGAIN;
+		}
+		if (Blocking && wait_event_interruptible(ChipDev->Queue.I2cFlashWaitQueue,
+		                                         (I2CFLASHDATAREADY == READ_ONCE(Requests[Chip]->I2cFlashRequestState))))
+		{
+			/* the parts stay pending, the restarted read picks them up */
+			return -ERESTARTSYS;
+		}
+	}
+	RetValue = 0;
+	for (Chip = 0; Chip < Stripe->Width; Chip++)
+	{
+		ChipDev = Stripe->Chips[Chip];
+		spin_lock(&ChipDev->Queue.I2cFlashRingLock);
+		StripeFile->ChipFile[Chip].I2cFlashFileReadRequest = NULL;
+		spin_unlock(&ChipDev->Queue.I2cFlashRingLock);
+		if (NULL == Requests[Chip])
+		{
+			continue;
+		}
+		/* a part which stopped part way gives the bytes it got, or why it got none */
+		ChipDone[Chip] = (0 == Requests[Chip]->I2cFlashRequestStatus) ? Requests[Chip]->I2cFlashRequestLength :
+		                 Requests[Chip]->I2cFlashRequestProgress;
+		if ((0 == RetValue) && (0 != Requests[Chip]->I2cFlashRequestStatus))
+		{
+			RetValue = Requests[Chip]->I2cFlashRequestStatus;
+		}
+	}
+	StripeFile->PendingCount = 0;
+	count = I2cFlashStripeDone(Stripe,*offp,count,ChipDone);
+	if (0 != count)
+	{
+		Data = kmalloc(count,GFP_KERNEL);
+		if (NULL == Data)
+		{
+			RetValue = -ENOMEM;
+		}
+		else
+		{
+			I2cFlashStripeCopy(Stripe,*offp,count,Data,Requests);
+			if (copy_to_user(buf,Data,count))
+			{
+				RetValue = -EFAULT;
+			}
+			else
+			{
+				*offp += count;
+				RetValue = count;
+			}
+			kfree(Data);
+		}
+	}
+	for (Chip = 0; Chip < Stripe->Width; Chip++)
+	{
+		if (NULL != Requests[Chip])
+		{
+			I2cFlashFreeRequest(Requests[Chip]);
+		}
+	}
+	return RetValue;
+}
 
-    if (I2CFLASHDATAREADY == I2cFlashWorkQueuePrivate.I2cFlashReadOrWrite)
-    {
-		/* The data for previous Read request is ready so copy to the user space */
-        /* Copy to the user space*/
-        if(copy_to_user(buf, (I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr),(PAGESIZE * I2cFlashWorkQueuePrivate.I2cFlashWorkQueuePageCount)))
-        {
-#ifdef DEBUGMODE
-            printk("\n Buffer writing failed ");
-#endif
-	    }
-	    else
-	    {
-	     	RetValue = count;
-	    }
-	    /* No the read buffer can be freed and set other information */
-	    kfree(I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr);
-	    I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr = NULL;
-	    I2cFlashWorkQueuePrivate.I2cFlashWorkQueuePageCount = 0;
-	    RetValue = 0;
-	    /* be the last statement */
-	    I2cFlashWorkQueuePrivate.I2cFlashReadOrWrite = NONE;
-	}
-	else if(NONE == I2cFlashWorkQueuePrivate.I2cFlashReadOrWrite)
-	{
-		/* No Read/Write operation is going on */
-        I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr = (unsigned char*)kzalloc((PAGESIZE * count),GFP_KERNEL);
-        I2cFlashWorkQueuePrivate.I2cFlashReadOrWrite = I2CFLASHREAD;
-        I2cFlashWorkQueuePrivate.I2cFlashWorkQueuePageCount = count;
-#ifdef NON_BLOCKING
-        /* submit the new read request to the work queue */
-        queue_work(I2cFlashWorkQueue,&I2cFlashWork);
-	    RetValue = -EAGAIN;
-#else
-         /* Call the function in the user's context itself */
-        I2cFlashWorkFunction(&I2cFlashWork);
-        /* Since this is a blocking call , the data will be ready immediately */
-        /* Copy to the user space*/
-        if(copy_to_user(buf, (I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr),(PAGESIZE * I2cFlashWorkQueuePrivate.I2cFlashWorkQueuePageCount)))
-        {
-            printk("\n Buffer writing failed ");
-	    }
-	    kfree(I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr);
-	    I2cFlashWorkQueuePrivate.I2cFlashWorkQueueBufferPtr = NULL;
-	    I2cFlashWorkQueuePrivate.I2cFlashReadOrWrite = NONE;
-	    I2cFlashWorkQueuePrivate.I2cFlashWorkQueuePageCount = 0;
-	    RetValue = 0;
-#endif
+/* *********************************************************************
+ * NAME:             I2cFlashStripePoll
+ * CALLED BY:        User App through kernel (poll, select, epoll)
+ * DESCRIPTION:      reports POLLIN when every part of the pending read
+ *                   of this file is in and POLLOUT when the request
+ *                   queues of all the chips can take a new part
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   wait : poll table of the caller
+ * RETURN VALUES:    unsigned int : poll mask
+ ***********************************************************************/
+unsigned int I2cFlashStripePoll(struct file *filept, poll_table *wait)
+{
+	I2cFlashStripeFileType *StripeFile = (I2cFlashStripeFileType*)(filept->private_data);
+	I2cFlashStripeType *Stripe = StripeFile->Stripe;
+	I2cFlashRequestType *Request = NULL; /* pending read part of one chip */
+	unsigned int Mask = POLLOUT | POLLWRNORM; /* events ready */
+	unsigned int Chip = 0;
+	if (0 != StripeFile->PendingCount)
+	{
+		Mask |= POLLIN | POLLRDNORM;
 	}
-    else
+	for (Chip = 0; Chip < Stripe->Width; Chip++)
 	{
-		/* The previous read/write operation is still going on so return -1 with EBUSY */
-		RetValue = -EBUSY;
+		poll_wait(filept,&Stripe->Chips[Chip]->Queue.I2cFlashWaitQueue,wait);
+		spin_lock(&Stripe->Chips[Chip]->Queue.I2cFlashRingLock);
+		Request = StripeFile->ChipFile[Chip].I2cFlashFileReadRequest;
+		if ((NULL != Request) && (I2CFLASHDATAREADY != Request->I2cFlashRequestState))
+		{
+			Mask &= ~(POLLIN | POLLRDNORM);
+		}
+		spin_unlock(&Stripe->Chips[Chip]->Queue.I2cFlashRingLock);
+		if (!I2cFlashRingHasRoom(Stripe->Chips[Chip]))
+		{
+			Mask &= ~(POLLOUT | POLLWRNORM);
+		}
 	}
-    return RetValue;
+	return Mask;
 }
 
 /* *********************************************************************
- * NAME:             I2cFlashDriverIoctl
+ * NAME:             I2cFlashStripeLlseek
  * CALLED BY:        User App through kernel
- * DESCRIPTION:      Does Iocntrl like setting the pointer,status,erase
+ * DESCRIPTION:      moves the byte offset of the file within the striped
+ *                   device
  * INPUT PARAMETERS: filept:file pointer used by this inode
- *                   pagepostion : used in case the command is FLASHSETP
- *                   Request : request/command by user
+ *                   offset : new offset, relative to whence
+ *                   whence : SEEK_SET, SEEK_CUR or SEEK_END
+ * RETURN VALUES:    loff_t : new offset, -EINVAL if out of the device
+ ***********************************************************************/
+loff_t I2cFlashStripeLlseek(struct file *filept, loff_t offset, int whence)
+{
+	I2cFlashStripeType *Stripe = ((I2cFlashStripeFileType*)(filept->private_data))->Stripe;
+	I2cFlashDevType *Dev = Stripe->Chips[0]; /* the chips share one geometry */
+	return I2cFlashSeek(filept,offset,whence,(Stripe->Width * Dev->Size));
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashStripeIoctl
+ * CALLED BY:        User App through kernel
+ * DESCRIPTION:      status, page pointer, erase and wait of the striped
+ *                   device, each command is applied to all the chips
+ * INPUT PARAMETERS: filept:file pointer used by this inode
+ *                   pagepostion : used in case the command is FLASHSETP,
+ *                                 FLASHWAIT or FLASHPAGESIZE otherwise
+ *                   Request : FLASHGETS, FLASHGETP, FLASHSETP or
+ *                             FLASHERASE
  * RETURN VALUES:    long : error codes / return success
  ***********************************************************************/
-long I2cFlashDriverIoctl(struct file *filept,unsigned int pageposition, unsigned long Request)
+long I2cFlashStripeIoctl(struct file *filept,unsigned int pageposition, unsigned long Request)
 {
-	int RetValue =  -1; /* Error code by default */
-	/* is the request for get status */
+	I2cFlashStripeFileType *StripeFile = (I2cFlashStripeFileType*)(filept->private_data);
+	I2cFlashStripeType *Stripe = StripeFile->Stripe;
+	I2cFlashDevType *Dev = Stripe->Chips[0]; /* the chips share one geometry */
+	I2cFlashRequestType *EraseRequests[NUMBER_OF_DEVICES]; /* erase of every chip */
+	unsigned int Chip = 0;
+	ssize_t Result = 0; /* outcome of the erase of one chip */
+	long RetValue = 0;
+	I2cFlashIoctlOrder(&pageposition,&Request);
 	if (FLASHGETS == Request)
 	{
-		if (NONE == I2cFlashWorkQueuePrivate.I2cFlashReadOrWrite)
-		{
-			RetValue = 0;
-		}
-		else
+		for (Chip = 0; Chip < Stripe->Width; Chip++)
 		{
-			RetValue = -EBUSY;
+			if (NONE != Stripe->Chips[Chip]->Queue.I2cFlashReadOrWrite)
+			{
+				RetValue = -EBUSY;
+			}
 		}
 	}
 	else if (FLASHGETP == Request)
 	{
-		/* is the request for getting page pointer */
-		RetValue = PAGENO(I2cFlashEepromPtr);
+		RetValue = PAGENO(Dev,filept->f_pos);
 	}
 	else if (FLASHSETP == Request)
 	{
-		/* is the request for setting the page pointer */
-		if (pageposition < PAGECOUNT)
-		{
-			I2cFlashEepromPtr = JOIN(pageposition,0x00);
-			RetValue = 0;
-		}
-		else
+		if (pageposition >= (Stripe->Width * Dev->PageCount))
 		{
-			RetValue = -1;
+			return -EINVAL;
 		}
+		filept->f_pos = JOIN(Dev,pageposition,0x00);
 	}
 	else if (FLASHERASE == Request)
 	{
-		/* is the request for erase */
-		/* check if the EEPROM is free */
-        if (NONE == I2cFlashWorkQueuePrivate.I2cFlashReadOrWrite)
-        {
-			/* change the state to ERASE */
-			I2cFlashWorkQueuePrivate.I2cFlashReadOrWrite = I2CFLASHERASE;
-#ifdef NON_BLOCKING
-            /* submit it to the work queue */
-            queue_work(I2cFlashWorkQueue,&I2cFlashWork);
-#else
-            /* Call the function in the user's context itself */
-            I2cFlashWorkFunction(&I2cFlashWork);
-#endif
-            RetValue = 0;
+		/* the chips erase in parallel, all of them or none */
+		memset(EraseRequests,0,sizeof(EraseRequests));
+		for (Chip = 0; (Chip < Stripe->Width); Chip++)
+		{
+			EraseRequests[Chip] = I2cFlashAllocRequest(Stripe->Chips[Chip],0,0,0);
+			if (NULL == EraseRequests[Chip])
+			{
+				RetValue = -ENOMEM;
+				break;
+			}
+			EraseRequests[Chip]->I2cFlashRequestState = I2CFLASHERASE;
+			EraseRequests[Chip]->I2cFlashRequestAddress = 0;
+			EraseRequests[Chip]->I2cFlashRequestLength = Dev->Size;
 		}
-		else
+		if (0 == RetValue)
 		{
-			RetValue = -EBUSY;
+			RetValue = I2cFlashStripeQueue(Stripe,EraseRequests,StripeFile->ChipFile,!(filept->f_flags & O_NONBLOCK));
+		}
+		if (RetValue)
+		{
+			for (Chip = 0; Chip < Stripe->Width; Chip++)
+			{
+				if (NULL != EraseRequests[Chip])
+				{
+					I2cFlashFreeRequest(EraseRequests[Chip]);
+				}
+			}
+			return RetValue;
+		}
+		filept->f_pos = 0;
+		for (Chip = 0; !(filept->f_flags & O_NONBLOCK) && (Chip < Stripe->Width); Chip++)
+		{
+			/* a blocking erase returns once every chip is erased, with the first failure */
+			Result = I2cFlashWaitResult(&StripeFile->ChipFile[Chip],0);
+			if ((0 == RetValue) && (Result < 0))
+			{
+				RetValue = Result;
+			}
+		}
+	}
+	else if (FLASHWAIT == Request)
+	{
+		/* sleep until the last request of this file is executed on every chip */
+		for (Chip = 0; (0 == RetValue) && (Chip < Stripe->Width); Chip++)
+		{
+			RetValue = I2cFlashWaitRequest(Stripe->Chips[Chip],StripeFile->ChipFile[Chip].I2cFlashFileLastRequestId);
+			if (0 == RetValue)
+			{
+				/* a part of a write or erase which failed on this chip */
+				RetValue = I2cFlashTakeError(&StripeFile->ChipFile[Chip]);
+			}
 		}
 	}
+	else if (FLASHPAGESIZE == Request)
+	{
+		/* a page of the striped device is a page of one chip */
+		RetValue = Dev->PageSize;
+	}
 	else
 	{
-		/* do nothing */
-		RetValue = 0;
+		RetValue = -EINVAL;
 	}
 	return RetValue;
 }
 
-/* Assigning operations to file operation structure */
-static struct file_operations I2cFlashFops = {
+/* Operations of the striped device */
+static struct file_operations I2cFlashStripeFops = {
     .owner = THIS_MODULE, /* Owner */
-    .open = I2cFlashDriverOpen, /* Open method */
-    .release = I2cFlashDriverRelease, /* Release method */
-    .write = I2cFlashDriverWrite, /* Write method */
-    .read = I2cFlashDriverRead, /* Read method */
-    .unlocked_ioctl = I2cFlashDriverIoctl,
+    .llseek = I2cFlashStripeLlseek, /* Seek method, used by pread/pwrite too */
+    .open = I2cFlashStripeOpen, /* Open method */
+    .release = I2cFlashStripeRelease, /* Release method */
+    .write = I2cFlashStripeWrite, /* Write method */
+    .read = I2cFlashStripeRead, /* Read method */
+    .poll = I2cFlashStripePoll, /* Poll method */
+    .unlocked_ioctl = I2cFlashStripeIoctl,
 };
 
+/* *********************************************************************
+ * NAME:             I2cFlashStripeCreate
+ * CALLED BY:        I2cFlashDriverInit once the chips are probed
+ * DESCRIPTION:      creates /dev/i2c_flash_stripe over the first chips
+ *                   given by the chips parameter
+ * INPUT PARAMETERS: Width : number of chips to interleave
+ * RETURN VALUES:    int : status - Fail/Pass(0)
+ ***********************************************************************/
+static int I2cFlashStripeCreate(unsigned int Width)
+{
+	I2cFlashStripeType *Stripe = NULL;
+	unsigned int Chip = 0; /* chip of the chips parameter */
+	int Ret = 0;
+	if (Width > NUMBER_OF_DEVICES)
+	{
+		return -EINVAL;
+	}
+	Stripe = kzalloc(sizeof(I2cFlashStripeType),GFP_KERNEL);
+	if (NULL == Stripe)
+	{
+		return -ENOMEM;
+	}
+	for (Chip = 0; (Chip < NUMBER_OF_DEVICES) && (Stripe->Width < Width); Chip++)
+	{
+		/* probe stores the chip data as client data, chips which failed are left out */
+		if ((NULL != I2cFlashClientDeviceInit[Chip]) && (NULL != i2c_get_clientdata(I2cFlashClientDeviceInit[Chip])))
+		{
+			Stripe->Chips[Stripe->Width++] = (I2cFlashDevType*)i2c_get_clientdata(I2cFlashClientDeviceInit[Chip]);
+		}
+	}
+	if (Stripe->Width < Width)
+	{
+		printk(KERN_ERR "\n i2c_flash: only %u chips found for a stripe of %u\n",Stripe->Width,Width);
+		kfree(Stripe);
+		return -ENODEV;
+	}
+	/* a page of the striped device is a page of one chip, the parts must match */
+	for (Chip = 1; Chip < Stripe->Width; Chip++)
+	{
+		if (Stripe->Chips[Chip]->Geometry != Stripe->Chips[0]->Geometry)
+		{
+			printk(KERN_ERR "\n i2c_flash: chips of a stripe must be the same part\n");
+			kfree(Stripe);
+			return -EINVAL;
+		}
+	}
+	sprintf(Stripe->name,STRIPE_NAME);
+	cdev_init(&Stripe->cdev,&I2cFlashStripeFops);
+	Stripe->cdev.owner = THIS_MODULE;
+	Ret = cdev_add(&Stripe->cdev,MKDEV(MAJOR(I2cFlashDevNumber),STRIPE_MINOR),1);
+	if (Ret)
+	{
+		kfree(Stripe);
+		return Ret;
+	}
+	device_create(I2cFlashDevClass,NULL,MKDEV(MAJOR(I2cFlashDevNumber),STRIPE_MINOR),Stripe,Stripe->name);
+	I2cFlashStripe = Stripe;
+	printk(KERN_INFO "\n %s : %u chips, %u bytes\n",Stripe->name,Stripe->Width,(Stripe->Width * Stripe->Chips[0]->Size));
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashStripeDestroy
+ * CALLED BY:        I2cFlashDriverExit before the chips are removed
+ * DESCRIPTION:      removes the striped device, if created
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashStripeDestroy(void)
+{
+	if (NULL == I2cFlashStripe)
+	{
+		return;
+	}
+	device_destroy(I2cFlashDevClass,MKDEV(MAJOR(I2cFlashDevNumber),STRIPE_MINOR));
+	cdev_del(&I2cFlashStripe->cdev);
+	kfree(I2cFlashStripe);
+	I2cFlashStripe = NULL;
+}
+
 /* *********************************************************************
  * NAME:             I2cFlashDriverInit
  * CALLED BY:        By system when the driver is installed
- * DESCRIPTION:      Initializes the driver and creates the 4 devices
+ * DESCRIPTION:      Initializes the driver and creates the chips given by
+ *                   the chips and adapters parameters
  * INPUT PARAMETERS: None
  * RETURN VALUES:    int : initialization status
  ***********************************************************************/
 int __init I2cFlashDriverInit(void)
 {
 	int Ret = -1; /* return variable */
+	int Chip = 0; /* chip being created */
+	int Created = 0; /* chips created */
     struct i2c_adapter *I2cFlashAdapterPtr;
-    struct i2c_board_info I2cFlashBoardInfo[] = {{I2C_BOARD_INFO("i2c_flash", CHIP_ADDRESS)}};
+    struct i2c_board_info I2cFlashBoardInfo = {I2C_BOARD_INFO("i2c_flash", CHIP_ADDRESS)};
 
-	/* Allocate device major number dynamically */
-	if (alloc_chrdev_region(&I2cFlashDevNumber, 0, NUMBER_OF_DEVICES, DEVICE_NAME) < 0)
+	if (0 == I2cFlashQueueDepth)
+	{
+		I2cFlashQueueDepth = QUEUE_DEPTH;
+	}
+	/* Allocate device major number dynamically, one minor per chip and one for the striped device */
+	if (alloc_chrdev_region(&I2cFlashDevNumber, 0, (NUMBER_OF_DEVICES + 1), DEVICE_NAME) < 0)
 	{
          printk("Device could not acquire a major number ! \n");
          return -1;
 	}
 	
 	/* Populate sysfs entries */
-	I2cFlashDevClass = class_create(THIS_MODULE, DEVICE_NAME);
-   
-    /* Allocate memory for all the devices */
-    I2cFlashDevMem = (I2cFlashDevType*)kmalloc(((sizeof(I2cFlashDevType)) * NUMBER_OF_DEVICES), GFP_KERNEL);
-    
-    /* Check if memory was allocated properly */
-   	if (NULL == I2cFlashDevMem)
-	{
-       printk("Kmalloc Fail \n");
-
-	   /* Remove the device class that was created earlier */
-	   class_destroy(I2cFlashDevClass);
-       /* Unregister devices */
-	   unregister_chrdev_region(MKDEV(MAJOR(I2cFlashDevNumber), 0), NUMBER_OF_DEVICES);
-       return -ENOMEM;
-	} 
-
-    /* Device Creation */ 
-    /* Copy the respective device name */
-    sprintf(I2cFlashDevMem->name,DEVICE_NAME);
-    /* clear the memory */
-    memset(I2cFlashDevMem->Page,0,PAGESIZE);
-    /* Connect the file operations with the cdev */
-    cdev_init(&I2cFlashDevMem->cdev,&I2cFlashFops);
-    I2cFlashDevMem->cdev.owner = THIS_MODULE;
-    /* Connect the major/minor number to the cdev */
-    Ret = cdev_add(&I2cFlashDevMem->cdev,I2cFlashDevNumber,1);
-	if (Ret)
+	I2cFlashDevClass = class_create(DEVICE_NAME);
+	if (IS_ERR(I2cFlashDevClass))
 	{
-	    printk("Bad cdev\n");
-	    return Ret;
+		unregister_chrdev_region(I2cFlashDevNumber, (NUMBER_OF_DEVICES + 1));
+		return PTR_ERR(I2cFlashDevClass);
 	}
-
-	I2cFlashDevName = device_create(I2cFlashDevClass,NULL,I2cFlashDevNumber,NULL,DEVICE_NAME);
+	/* debugfs directory of the chips, probe adds one per chip */
+	I2cFlashDebugRoot = debugfs_create_dir(DEVICE_NAME,NULL);
 
 	/* Enable scl and sda */
     gpio_request_one(29,GPIOF_OUT_INIT_LOW,"I2cEnable");
@@ -763,86 +5939,94 @@ int __init I2cFlashDriverInit(void)
 	if (Ret)
 	{
 		printk(KERN_ERR "i2c_flash.ko: Driver registration failed, module not inserted.\n");
-       /* Destroy the devices first */
-	   device_destroy(I2cFlashDevClass,I2cFlashDevNumber);
-
-	   /* Delete each of the cdevs */
-	   cdev_del(&(I2cFlashDevMem->cdev));
-
-	   /* Free up the allocated memory for all of the device */
-	   kfree(I2cFlashDevMem);
-
 	   /* Remove the device class that was created earlier */
 	   class_destroy(I2cFlashDevClass);
-	
+	   debugfs_remove_recursive(I2cFlashDebugRoot);
 	   /* Unregister devices */
-	   unregister_chrdev_region(I2cFlashDevNumber, NUMBER_OF_DEVICES);
-
+	   unregister_chrdev_region(I2cFlashDevNumber, (NUMBER_OF_DEVICES + 1));
 	   return Ret;
 	}
-    /* Get the adapter pointer */
-    I2cFlashAdapterPtr = i2c_get_adapter(ADAPTER_MINOR_NUMBER);
-    /* create a new device */
-	I2cFlashClientDeviceInit = i2c_new_device(I2cFlashAdapterPtr,I2cFlashBoardInfo);
-#ifdef DEBUG
-	printk("\n Added Device");
-	if (NULL != I2cFlashClientDeviceInit)
+	/* create the chips, probe sets up each of them */
+	for (Chip = 0; (Chip < I2cFlashChipCount) && (Chip < NUMBER_OF_DEVICES); Chip++)
 	{
-	   printk(KERN_INFO "\n Init client found : \n chip adddress = %d \n client.name = %s \n ",
-	          I2cFlashClientDeviceInit->addr,I2cFlashClientDeviceInit->name);
-    }
-    else
-    {
-		printk(KERN_INFO "\nI2cFlash client init not allocated\n");
-		return -ENOMEM;
-	}
-#endif
-
+		/* Get the adapter pointer */
+		I2cFlashAdapterPtr = i2c_get_adapter((Chip < I2cFlashChipAdapterCount) ? I2cFlashChipAdapter[Chip] : ADAPTER_MINOR_NUMBER);
+		if (NULL == I2cFlashAdapterPtr)
+		{
+			printk(KERN_ERR "\n i2c_flash: adapter of chip %d not found\n",Chip);
+			continue;
+		}
+		I2cFlashBoardInfo.addr = I2cFlashChipAddress[Chip];
+		/* the part is the device id, probe takes the geometry from it */
+		strscpy(I2cFlashBoardInfo.type,((Chip < I2cFlashChipPartCount) ? I2cFlashChipPart[Chip] : "i2c_flash"),I2C_NAME_SIZE);
+		I2cFlashClientDeviceInit[Chip] = i2c_new_client_device(I2cFlashAdapterPtr,&I2cFlashBoardInfo);
+		i2c_put_adapter(I2cFlashAdapterPtr);
+		if (IS_ERR(I2cFlashClientDeviceInit[Chip]))
+		{
+			/* exit unregisters only the chips created */
+			I2cFlashClientDeviceInit[Chip] = NULL;
+		}
+		else
+		{
+			Created++;
+		}
 #ifdef DEBUG
-	printk("\n client reference ptr = %d ",I2cFlashClient);
-	printk("\n Init  client reference ptr = %d ",I2cFlashClientDeviceInit);
-#endif
-#ifdef NON_BLOCKING
-    /* create workqueue for non-blocking implementation */
-    I2cFlashWorkQueue = create_singlethread_workqueue("i2c_flash");
-    INIT_WORK(&I2cFlashWork,I2cFlashWorkFunction);
+		if (NULL != I2cFlashClientDeviceInit[Chip])
+		{
+		   printk(KERN_INFO "\n Init client found : \n chip adddress = %d \n client.name = %s \n ",
+		          I2cFlashClientDeviceInit[Chip]->addr,I2cFlashClientDeviceInit[Chip]->name);
+		}
+		else
+		{
+			printk(KERN_INFO "\nI2cFlash client init not allocated\n");
+		}
 #endif
+	}
+	if (0 == Created)
+	{
+		printk(KERN_ERR "i2c_flash.ko: none of the chips could be created, module not inserted.\n");
+		i2c_del_driver(&I2cFlashDriver);
+		class_destroy(I2cFlashDevClass);
+		debugfs_remove_recursive(I2cFlashDebugRoot);
+		unregister_chrdev_region(I2cFlashDevNumber, (NUMBER_OF_DEVICES + 1));
+		return -ENODEV;
+	}
+	/* striped view over the chips, the chips stay usable on their own */
+	if ((1 < I2cFlashStripeWidth) && (I2cFlashStripeCreate(I2cFlashStripeWidth) < 0))
+	{
+		printk(KERN_ERR "\n i2c_flash: striped device not created\n");
+	}
 	printk("\n I2C_flash Driver is initialized \n");
 	
-	return Ret;
+	return 0;
 }
 /*
  * Driver Deinitialization
  */
 void __exit I2cFlashDriverExit(void)
 {
-    /* Destroy the devices first */
-	device_destroy(I2cFlashDevClass,I2cFlashDevNumber);
-
-	/* Delete each of the cdevs */
-	cdev_del(&(I2cFlashDevMem->cdev));
+	int Chip = 0; /* chip being removed */
+	/* the striped device goes first, it uses the chips */
+	I2cFlashStripeDestroy();
+    /* unregister the i2c devices, remove drains the queue of each chip */
+	for (Chip = 0; Chip < NUMBER_OF_DEVICES; Chip++)
+	{
+		if (NULL != I2cFlashClientDeviceInit[Chip])
+		{
+			i2c_unregister_device(I2cFlashClientDeviceInit[Chip]);
+		}
+	}
 
-	/* Free up the allocated memory for all of the device */
-	 kfree(I2cFlashDevMem);
+	/* Delete the driver */
+	i2c_del_driver(&I2cFlashDriver);
 
 	/* Remove the device class that was created earlier */
 	class_destroy(I2cFlashDevClass);
+	debugfs_remove_recursive(I2cFlashDebugRoot);
 	
 	/* Unregister char devices */
-	unregister_chrdev_region(I2cFlashDevNumber, NUMBER_OF_DEVICES);
-
-    /* unregister the i2c device*/
-    i2c_unregister_device(I2cFlashClientDeviceInit);
+	unregister_chrdev_region(I2cFlashDevNumber, (NUMBER_OF_DEVICES + 1));
 
-	/* Delete the driver */
-	i2c_del_driver(&I2cFlashDriver);
-
-#ifdef NON_BLOCKING
-    /* check if any if the work in queue is pending */
-    if (!cancel_work_sync(&I2cFlashWork )) flush_workqueue(I2cFlashWorkQueue);
-    /* destroy the workqueue */
-    destroy_workqueue(I2cFlashWorkQueue);
-#endif
 	printk("\n I2C-Flash device and driver are removed ! \n ");
 }
 
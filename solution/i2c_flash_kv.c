@@ -0,0 +1,593 @@
+/* *********************************************************************
+ *
+ * Log structured key/value store on the 24FC256 EEPROM of i2c_flash
+ *
+ * Program Name:        i2c_flash_kv
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ *
+ * Every put or delete appends one record of one page to a circular log
+ * running over all the pages of the EEPROM, so the writes are spread
+ * evenly instead of hitting the page of a hot key again and again. The
+ * store is read with one bulk read at open, gets are served from RAM
+ * through a hash index. A background thread moves the tail of the log,
+ * copying the records which are still live to the head.
+ **********************************************************************/
+
+/* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include "i2c_flash_kv.h"
+
+/* ***************** PREPROCESSOR DIRECTIVES **************************/
+/*
+ * Macros required to identify requests in ioctl
+ */
+#define FLASHWAIT   _IO('F',6)
+/*
+ * Marks a page holding a record
+ */
+#define KV_MAGIC   0x4B56
+/*
+ * Flags of a record
+ */
+#define KV_DELETED   0x01
+/*
+ * Free page left for copying a live record while the log is full
+ */
+#define KV_RESERVE   1
+/*
+ * The compaction thread starts below KV_LOW_WATER free pages and stops
+ * once KV_HIGH_WATER pages are free. It is not started if there are not
+ * enough dead records to get there, copying live records in circles
+ * only wears the EEPROM.
+ */
+#define KV_LOW_WATER    64
+#define KV_HIGH_WATER   128
+
+/* *********************************************************************
+ * NAME:             KvCrc
+ * CALLED BY:        record writing and the scan at open
+ * DESCRIPTION:      CRC32 of a record with its Crc field taken as zero
+ * INPUT PARAMETERS: Record : record to be checked
+ * RETURN VALUES:    unsigned int : CRC32
+ ***********************************************************************/
+static unsigned int KvCrc(const I2cFlashKvRecordType *Record)
+{
+	I2cFlashKvRecordType Copy = *Record;
+	const unsigned char *Byte = (const unsigned char *)&Copy;
+	unsigned int Crc = 0xFFFFFFFF;
+	unsigned int Index, Bit;
+	Copy.Crc = 0;
+	for (Index = 0; Index < sizeof(Copy); Index++)
+	{
+		Crc ^= Byte[Index];
+		for (Bit = 0; Bit < 8; Bit++)
+		{
+			Crc = (Crc >> 1) ^ (0xEDB88320 & (0 - (Crc & 1)));
+		}
+	}
+	return ~Crc;
+}
+
+/* *********************************************************************
+ * NAME:             KvHash
+ * DESCRIPTION:      FNV-1a hash of a key reduced to an index slot
+ ***********************************************************************/
+static unsigned int KvHash(const void *Key, unsigned int KeyLength)
+{
+	const unsigned char *Byte = (const unsigned char *)Key;
+	unsigned int Hash = 2166136261u;
+	while (KeyLength--)
+	{
+		Hash = (Hash ^ *Byte++) * 16777619u;
+	}
+	return Hash & (KV_INDEX_SIZE - 1);
+}
+
+/* *********************************************************************
+ * NAME:             KvFind
+ * DESCRIPTION:      linear probing in the index for the key
+ * RETURN VALUES:    unsigned int : slot holding the key or the empty
+ *                                  slot where it would go
+ ***********************************************************************/
+static unsigned int KvFind(I2cFlashKvType *Kv, const void *Key, unsigned int KeyLength)
+{
+	unsigned int Slot = KvHash(Key,KeyLength);
+	I2cFlashKvRecordType *Record;
+	while (-1 != Kv->Index[Slot])
+	{
+		Record = &Kv->Image[Kv->Index[Slot]];
+		if ((Record->KeyLength == KeyLength) && (0 == memcmp(Record->Data,Key,KeyLength)))
+		{
+			break;
+		}
+		Slot = (Slot + 1) & (KV_INDEX_SIZE - 1);
+	}
+	return Slot;
+}
+
+/* *********************************************************************
+ * NAME:             KvIndexRemove
+ * DESCRIPTION:      empties a slot of the index, the following entries
+ *                   of the probe run are shifted back so that no
+ *                   deleted markers are needed
+ ***********************************************************************/
+static void KvIndexRemove(I2cFlashKvType *Kv, unsigned int Slot)
+{
+	unsigned int Next = Slot; /* entry being checked */
+	unsigned int Home; /* slot an entry hashes to */
+	I2cFlashKvRecordType *Record;
+	while (1)
+	{
+		Kv->Index[Slot] = -1;
+		do
+		{
+			Next = (Next + 1) & (KV_INDEX_SIZE - 1);
+			if (-1 == Kv->Index[Next])
+			{
+				return;
+			}
+			Record = &Kv->Image[Kv->Index[Next]];
+			Home = KvHash(Record->Data,Record->KeyLength);
+			/* the entry stays if its home lies cyclically in (Slot, Next] */
+		}while (((Next - Home) & (KV_INDEX_SIZE - 1)) < ((Next - Slot) & (KV_INDEX_SIZE - 1)));
+		Kv->Index[Slot] = Kv->Index[Next];
+		Slot = Next;
+	}
+}
+
+/* *********************************************************************
+ * NAME:             KvWritePage
+ * DESCRIPTION:      queues the write of one page to the driver, waits
+ *                   for a free slot while its request queue is full
+ * RETURN VALUES:    int : 0 or -errno
+ ***********************************************************************/
+static int KvWritePage(I2cFlashKvType *Kv, unsigned int Page)
+{
+	struct pollfd PollFd;
+	ssize_t res;
+	while (1)
+	{
+		res = pwrite(Kv->Fd,&Kv->Image[Page],KV_PAGESIZE,(off_t)Page * KV_PAGESIZE);
+		if (KV_PAGESIZE == res)
+		{
+			Kv->PageWrites[Page]++;
+			return 0;
+		}
+		if ((res >= 0) || (EBUSY != errno))
+		{
+			return (res < 0) ? -errno : -EIO;
+		}
+		/* request queue of the driver is full, POLLOUT once a request is done */
+		PollFd.fd = Kv->Fd;
+		PollFd.events = POLLOUT;
+		poll(&PollFd,1,-1);
+	}
+}
+
+/* *********************************************************************
+ * NAME:             KvAppend
+ * DESCRIPTION:      writes a record at the head of the log. The caller
+ *                   has made sure that a page is free.
+ * INPUT PARAMETERS: Record : record without sequence numbers and CRC
+ * RETURN VALUES:    int : page of the record or -errno
+ ***********************************************************************/
+static int KvAppend(I2cFlashKvType *Kv, const I2cFlashKvRecordType *Record)
+{
+	unsigned int Page = Kv->Head;
+	int res;
+	Kv->Image[Page] = *Record;
+	Kv->Image[Page].Magic = KV_MAGIC;
+	Kv->Image[Page].Reserved = 0;
+	Kv->Image[Page].Sequence = Kv->NextSequence;
+	Kv->Image[Page].TailSequence = (0 == Kv->Used) ? Kv->NextSequence : Kv->Image[Kv->Tail].Sequence;
+	Kv->Image[Page].Crc = KvCrc(&Kv->Image[Page]);
+	res = KvWritePage(Kv,Page);
+	if (res < 0)
+	{
+		return res;
+	}
+	if (0 == Kv->Used)
+	{
+		Kv->Tail = Page;
+	}
+	Kv->NextSequence++;
+	Kv->Head = (Kv->Head + 1) % KV_PAGECOUNT;
+	Kv->Used++;
+	return Page;
+}
+
+/* *********************************************************************
+ * NAME:             KvCompactStep
+ * DESCRIPTION:      moves the tail of the log by one page. A record which
+ *                   is still the latest of its key is copied to the head
+ *                   first. Delete records are dropped at the tail, all
+ *                   older records of their key are gone already.
+ * RETURN VALUES:    int : 1 if a page became free, 0 if the record was
+ *                         copied, -errno on error
+ ***********************************************************************/
+static int KvCompactStep(I2cFlashKvType *Kv)
+{
+	I2cFlashKvRecordType *Record = &Kv->Image[Kv->Tail];
+	unsigned int Slot;
+	int Page;
+	if (0 == Kv->Used)
+	{
+		return 0;
+	}
+	Slot = KvFind(Kv,Record->Data,Record->KeyLength);
+	if (!(Record->Flags & KV_DELETED) && (Kv->Index[Slot] == (short)Kv->Tail))
+	{
+		/* live, copy it to the head. Both copies are valid until the tail moves. */
+		Page = KvAppend(Kv,Record);
+		if (Page < 0)
+		{
+			return Page;
+		}
+		Kv->Index[Slot] = Page;
+		Kv->Relocations++;
+		Kv->Tail = (Kv->Tail + 1) % KV_PAGECOUNT;
+		Kv->Used--;
+		return 0;
+	}
+	Kv->Tail = (Kv->Tail + 1) % KV_PAGECOUNT;
+	Kv->Used--;
+	return 1;
+}
+
+/* *********************************************************************
+ * NAME:             KvMakeRoom
+ * DESCRIPTION:      compacts in the caller's context until a page is
+ *                   free besides the reserve, used when the background
+ *                   thread did not keep up
+ * RETURN VALUES:    int : 0 or -errno
+ ***********************************************************************/
+static int KvMakeRoom(I2cFlashKvType *Kv)
+{
+	int res;
+	while ((KV_PAGECOUNT - Kv->Used) <= KV_RESERVE)
+	{
+		res = KvCompactStep(Kv);
+		if (res < 0)
+		{
+			return res;
+		}
+	}
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             KvCompactNeeded
+ * DESCRIPTION:      tells whether the background compaction has work
+ ***********************************************************************/
+static int KvCompactNeeded(I2cFlashKvType *Kv)
+{
+	unsigned int Free = KV_PAGECOUNT - Kv->Used; /* pages outside the log */
+	unsigned int Dead = Kv->Used - Kv->LiveKeys; /* records replaced, deleted or delete records */
+	return (Free < KV_LOW_WATER) && ((Free + Dead) >= KV_HIGH_WATER);
+}
+
+/* *********************************************************************
+ * NAME:             KvCompactThread
+ * DESCRIPTION:      background compaction, one step per lock hold so that
+ *                   gets and puts are not held up. A round ends when
+ *                   enough pages are free or the whole log was walked.
+ ***********************************************************************/
+static void *KvCompactThread(void *Arg)
+{
+	I2cFlashKvType *Kv = (I2cFlashKvType *)Arg;
+	unsigned int Steps;
+	pthread_mutex_lock(&Kv->Lock);
+	while (!Kv->Stop)
+	{
+		if (!KvCompactNeeded(Kv))
+		{
+			pthread_cond_wait(&Kv->CompactWake,&Kv->Lock);
+			continue;
+		}
+		for (Steps = Kv->Used; (Steps > 0) && !Kv->Stop && ((KV_PAGECOUNT - Kv->Used) < KV_HIGH_WATER); Steps--)
+		{
+			if (KvCompactStep(Kv) < 0)
+			{
+				break;
+			}
+			pthread_mutex_unlock(&Kv->Lock);
+			pthread_mutex_lock(&Kv->Lock);
+		}
+		if (KvCompactNeeded(Kv))
+		{
+			/* write error, retry after the next put */
+			pthread_cond_wait(&Kv->CompactWake,&Kv->Lock);
+		}
+	}
+	pthread_mutex_unlock(&Kv->Lock);
+	return NULL;
+}
+
+/* *********************************************************************
+ * NAME:             KvScan
+ * DESCRIPTION:      rebuilds the log position and the index from the
+ *                   image read at open. The newest record tells where
+ *                   the log starts, older records are left overs of
+ *                   pages the tail has passed. Sequence numbers are not
+ *                   expected to wrap, the EEPROM wears out long before.
+ ***********************************************************************/
+static void KvScan(I2cFlashKvType *Kv)
+{
+	unsigned int Page, Slot, Index;
+	int Newest = -1; /* page of the record with the highest sequence */
+	unsigned int Order[KV_PAGECOUNT]; /* pages of the log ordered by sequence */
+	unsigned int Count = 0;
+	I2cFlashKvRecordType *Record;
+	for (Page = 0; Page < KV_PAGECOUNT; Page++)
+	{
+		Record = &Kv->Image[Page];
+		if ((KV_MAGIC != Record->Magic) || (Record->Crc != KvCrc(Record)) ||
+		    ((Record->KeyLength + Record->ValueLength) > KV_DATA_SIZE))
+		{
+			/* free or torn page */
+			Record->Magic = 0;
+			continue;
+		}
+		if ((-1 == Newest) || (Record->Sequence > Kv->Image[Newest].Sequence))
+		{
+			Newest = Page;
+		}
+	}
+	Kv->Head = 0;
+	Kv->Tail = 0;
+	Kv->Used = 0;
+	Kv->NextSequence = 1;
+	if (-1 == Newest)
+	{
+		/* empty store */
+		return;
+	}
+	/* the log runs backwards from the newest record down to its tail sequence */
+	for (Index = 0; Index < KV_PAGECOUNT; Index++)
+	{
+		Page = (Newest + KV_PAGECOUNT - Index) % KV_PAGECOUNT;
+		Record = &Kv->Image[Page];
+		if ((KV_MAGIC != Record->Magic) || (Record->Sequence < Kv->Image[Newest].TailSequence) ||
+		    (Record->Sequence > Kv->Image[Newest].Sequence))
+		{
+			break;
+		}
+		Order[Count++] = Page;
+	}
+	Kv->Head = (Newest + 1) % KV_PAGECOUNT;
+	Kv->Tail = Order[Count - 1];
+	Kv->Used = Count;
+	Kv->NextSequence = Kv->Image[Newest].Sequence + 1;
+	/* replay from the oldest record, later records replace earlier ones */
+	while (Count--)
+	{
+		Page = Order[Count];
+		Record = &Kv->Image[Page];
+		Slot = KvFind(Kv,Record->Data,Record->KeyLength);
+		if (Record->Flags & KV_DELETED)
+		{
+			if (-1 != Kv->Index[Slot])
+			{
+				KvIndexRemove(Kv,Slot);
+				Kv->LiveKeys--;
+			}
+		}
+		else
+		{
+			if (-1 == Kv->Index[Slot])
+			{
+				Kv->LiveKeys++;
+			}
+			Kv->Index[Slot] = Page;
+		}
+	}
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashKvOpen
+ * DESCRIPTION:      opens the device, reads the complete EEPROM with one
+ *                   read, rebuilds the index and starts the compaction
+ * INPUT PARAMETERS: Kv : handle to be initialized
+ *                   DevicePath : usually /dev/i2c_flash
+ * RETURN VALUES:    int : 0 or -errno
+ ***********************************************************************/
+int I2cFlashKvOpen(I2cFlashKvType *Kv, const char *DevicePath)
+{
+	struct iovec Iov;
+	ssize_t res;
+	memset(Kv,0,sizeof(*Kv));
+	memset(Kv->Index,0xFF,sizeof(Kv->Index));
+	/* writes are only queued, I2cFlashKvSync waits for them */
+	Kv->Fd = open(DevicePath,(O_RDWR | O_NONBLOCK));
+	if (Kv->Fd < 0)
+	{
+		return -errno;
+	}
+	/* preadv sleeps until the data is there, a plain read would return EAGAIN first */
+	Iov.iov_base = Kv->Image;
+	Iov.iov_len = sizeof(Kv->Image);
+	res = preadv(Kv->Fd,&Iov,1,0);
+	if (sizeof(Kv->Image) != res)
+	{
+		res = (res < 0) ? -errno : -EIO;
+		close(Kv->Fd);
+		return res;
+	}
+	KvScan(Kv);
+	pthread_mutex_init(&Kv->Lock,NULL);
+	pthread_cond_init(&Kv->CompactWake,NULL);
+	if (0 != pthread_create(&Kv->CompactThread,NULL,KvCompactThread,Kv))
+	{
+		close(Kv->Fd);
+		return -EAGAIN;
+	}
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashKvGet
+ * DESCRIPTION:      copies the value of a key, served from RAM
+ * INPUT PARAMETERS: Value : buffer of *ValueLength bytes, set to the
+ *                           length of the value
+ * RETURN VALUES:    int : 0, -ENOENT if the key is not stored, -ENOSPC
+ *                         if the buffer is too small
+ ***********************************************************************/
+int I2cFlashKvGet(I2cFlashKvType *Kv, const void *Key, unsigned int KeyLength, void *Value, unsigned int *ValueLength)
+{
+	I2cFlashKvRecordType *Record;
+	unsigned int Slot;
+	int RetValue = 0;
+	pthread_mutex_lock(&Kv->Lock);
+	Slot = KvFind(Kv,Key,KeyLength);
+	if (-1 == Kv->Index[Slot])
+	{
+		RetValue = -ENOENT;
+	}
+	else
+	{
+		Record = &Kv->Image[Kv->Index[Slot]];
+		if (*ValueLength < Record->ValueLength)
+		{
+			RetValue = -ENOSPC;
+		}
+		else
+		{
+			memcpy(Value,(Record->Data + Record->KeyLength),Record->ValueLength);
+		}
+		*ValueLength = Record->ValueLength;
+	}
+	pthread_mutex_unlock(&Kv->Lock);
+	return RetValue;
+}
+
+/* *********************************************************************
+ * NAME:             KvUpdate
+ * DESCRIPTION:      appends a put or delete record and updates the index
+ * RETURN VALUES:    int : 0 or -errno
+ ***********************************************************************/
+static int KvUpdate(I2cFlashKvType *Kv, const void *Key, unsigned int KeyLength, const void *Value, unsigned int ValueLength,
+                    unsigned char Flags)
+{
+	I2cFlashKvRecordType Record;
+	unsigned int Slot;
+	int Page;
+	if ((0 == KeyLength) || ((KeyLength + ValueLength) > KV_DATA_SIZE))
+	{
+		return -EINVAL;
+	}
+	memset(&Record,0xFF,sizeof(Record));
+	Record.Flags = Flags;
+	Record.KeyLength = KeyLength;
+	Record.ValueLength = ValueLength;
+	memcpy(Record.Data,Key,KeyLength);
+	memcpy((Record.Data + KeyLength),Value,ValueLength);
+	pthread_mutex_lock(&Kv->Lock);
+	Slot = KvFind(Kv,Key,KeyLength);
+	if (Flags & KV_DELETED)
+	{
+		if (-1 == Kv->Index[Slot])
+		{
+			pthread_mutex_unlock(&Kv->Lock);
+			return -ENOENT;
+		}
+	}
+	else if ((-1 == Kv->Index[Slot]) && (Kv->LiveKeys >= (KV_PAGECOUNT - KV_RESERVE - 1)))
+	{
+		/* compaction always needs a dead page to make progress */
+		pthread_mutex_unlock(&Kv->Lock);
+		return -ENOSPC;
+	}
+	Page = KvMakeRoom(Kv);
+	if (0 == Page)
+	{
+		Page = KvAppend(Kv,&Record);
+	}
+	if (Page >= 0)
+	{
+		/* compaction may have moved the entries of the index */
+		Slot = KvFind(Kv,Key,KeyLength);
+		if (Flags & KV_DELETED)
+		{
+			KvIndexRemove(Kv,Slot);
+			Kv->LiveKeys--;
+		}
+		else
+		{
+			if (-1 == Kv->Index[Slot])
+			{
+				Kv->LiveKeys++;
+			}
+			Kv->Index[Slot] = Page;
+		}
+		if (KvCompactNeeded(Kv))
+		{
+			pthread_cond_signal(&Kv->CompactWake);
+		}
+	}
+	pthread_mutex_unlock(&Kv->Lock);
+	return (Page < 0) ? Page : 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashKvPut
+ * DESCRIPTION:      stores a value for a key with one page write, the
+ *                   key and the value together take up to KV_DATA_SIZE
+ *                   bytes
+ * RETURN VALUES:    int : 0 or -errno
+ ***********************************************************************/
+int I2cFlashKvPut(I2cFlashKvType *Kv, const void *Key, unsigned int KeyLength, const void *Value, unsigned int ValueLength)
+{
+	return KvUpdate(Kv,Key,KeyLength,Value,ValueLength,0);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashKvDelete
+ * DESCRIPTION:      removes a key, one page write
+ * RETURN VALUES:    int : 0, -ENOENT if the key is not stored
+ ***********************************************************************/
+int I2cFlashKvDelete(I2cFlashKvType *Kv, const void *Key, unsigned int KeyLength)
+{
+	return KvUpdate(Kv,Key,KeyLength,NULL,0,KV_DELETED);
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashKvSync
+ * DESCRIPTION:      waits until the driver has written every record
+ *                   queued through this handle
+ * RETURN VALUES:    int : 0 or -errno
+ ***********************************************************************/
+int I2cFlashKvSync(I2cFlashKvType *Kv)
+{
+	return (ioctl(Kv->Fd,FLASHWAIT,0) < 0) ? -errno : 0;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashKvClose
+ * DESCRIPTION:      stops the compaction, waits for the queued writes
+ *                   and closes the device
+ ***********************************************************************/
+void I2cFlashKvClose(I2cFlashKvType *Kv)
+{
+	pthread_mutex_lock(&Kv->Lock);
+	Kv->Stop = 1;
+	pthread_cond_signal(&Kv->CompactWake);
+	pthread_mutex_unlock(&Kv->Lock);
+	pthread_join(Kv->CompactThread,NULL);
+	I2cFlashKvSync(Kv);
+	close(Kv->Fd);
+	pthread_mutex_destroy(&Kv->Lock);
+	pthread_cond_destroy(&Kv->CompactWake);
+}
@@ -0,0 +1,78 @@
+/* *********************************************************************
+ *
+ * Log structured key/value store on the 24FC256 EEPROM of i2c_flash
+ *
+ * Program Name:        i2c_flash_kv
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+#ifndef I2C_FLASH_KV_H
+#define I2C_FLASH_KV_H
+
+#include <pthread.h>
+
+/* ***************** PREPROCESSOR DIRECTIVES **************************/
+/*
+ * Geometry of the EEPROM, every record takes one page
+ */
+#define KV_PAGECOUNT   512
+#define KV_PAGESIZE    64
+/*
+ * Bytes of a record left for the key and the value
+ */
+#define KV_DATA_SIZE   (KV_PAGESIZE - 18)
+/*
+ * Slots of the in RAM hash index, a power of two above the page count
+ */
+#define KV_INDEX_SIZE  1024
+
+/*
+ * One record of the log as stored in a page of the EEPROM
+ */
+typedef struct I2cFlashKvRecordTag
+{
+	unsigned short Magic; /* KV_MAGIC, anything else is a free page */
+	unsigned char Flags; /* KV_DELETED for a delete record */
+	unsigned char KeyLength; /* bytes of the key at the start of Data */
+	unsigned char ValueLength; /* bytes of the value following the key */
+	unsigned char Reserved;
+	unsigned int Sequence; /* position of the record in the log, grows with every append */
+	unsigned int TailSequence; /* sequence of the oldest record of the log when this one was written */
+	unsigned int Crc; /* CRC32 of the page with this field zero */
+	unsigned char Data[KV_DATA_SIZE]; /* key followed by the value */
+}__attribute__((packed)) I2cFlashKvRecordType;
+
+/*
+ * Handle of an open store
+ */
+typedef struct I2cFlashKvTag
+{
+	int Fd; /* open /dev/i2c_flash */
+	I2cFlashKvRecordType Image[KV_PAGECOUNT]; /* copy of the EEPROM, values are served from here */
+	short Index[KV_INDEX_SIZE]; /* hash of the key to the page of its latest record, -1 if empty */
+	unsigned int Head; /* page the next record is appended to */
+	unsigned int Tail; /* page of the oldest record of the log */
+	unsigned int Used; /* pages between the tail and the head */
+	unsigned int LiveKeys; /* keys in the index */
+	unsigned int NextSequence; /* sequence of the next record */
+	unsigned long PageWrites[KV_PAGECOUNT]; /* pages written through this handle, for wear statistics */
+	unsigned long Relocations; /* live records copied to the head by compaction */
+	pthread_mutex_t Lock; /* protects everything above */
+	pthread_cond_t CompactWake; /* signalled when the compaction thread has work or has to stop */
+	pthread_t CompactThread; /* background compaction */
+	int Stop; /* set by close */
+}I2cFlashKvType;
+
+/* ************************* FUNCTIONS ********************************/
+int I2cFlashKvOpen(I2cFlashKvType *Kv, const char *DevicePath);
+int I2cFlashKvGet(I2cFlashKvType *Kv, const void *Key, unsigned int KeyLength, void *Value, unsigned int *ValueLength);
+int I2cFlashKvPut(I2cFlashKvType *Kv, const void *Key, unsigned int KeyLength, const void *Value, unsigned int ValueLength);
+int I2cFlashKvDelete(I2cFlashKvType *Kv, const void *Key, unsigned int KeyLength);
+int I2cFlashKvSync(I2cFlashKvType *Kv);
+void I2cFlashKvClose(I2cFlashKvType *Kv);
+
+#endif
@@ -0,0 +1,392 @@
+/* *********************************************************************
+ *
+ * Simulated I2C bus with 24FC256 EEPROMs on it, for running the
+ * i2c_flash driver without the hardware
+ *
+ * Program Name:        i2c_flash_sim
+ * Target:              any x86 Linux box
+ * Architecture:		x86
+ * Compiler:            gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ *
+ * The module registers an I2C adapter whose transfers are answered by
+ * a model of the EEPROM: the two address bytes set the address pointer,
+ * the data of a write wraps around within its page, a read continues
+ * from the address pointer over the whole array, and the chip does not
+ * acknowledge its address for tWR after a page write. The transfers
+ * take the time of the bytes at the given bus speed, and NACKs and bus
+ * errors can be injected at a given rate from a seeded generator.
+ *
+ *   insmod i2c_flash_sim.ko chips=2 bus=7 twr_us=5000 bus_khz=400
+ *   insmod i2c_flash.ko chips=0x54,0x55 adapters=7,7
+ **********************************************************************/
+
+ /* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/i2c.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/moduleparam.h>
+#include <asm/errno.h>
+/* ***************** PREPROCESSOR DIRECTIVES **************************/
+
+/*
+ * Most chips on the simulated bus, like the three address pins allow
+ */
+#define SIM_MAX_CHIPS   8
+
+/*
+ * Geometry of the 24FC256
+ */
+#define SIM_PAGESIZE    64
+#define SIM_SIZE        32768
+
+/*
+ * Bits on the bus for a byte (8 data bits and the acknowledge) and for
+ * the start and stop conditions of a transfer
+ */
+#define SIM_BITS_PER_BYTE   9
+#define SIM_BITS_START_STOP 2
+
+/*
+ * State of one simulated chip
+ */
+typedef struct I2cFlashSimChipTag
+{
+	unsigned short Address; /* 7 bit chip address */
+	unsigned char *Memory; /* the EEPROM array */
+	unsigned int Pointer; /* internal address pointer */
+	ktime_t BusyUntil; /* end of the write cycle in progress */
+	unsigned long PageWrites; /* write transactions accepted */
+	unsigned long BytesRead; /* bytes sent to the master */
+	unsigned long BusyNacks; /* addresses not acknowledged during a write cycle */
+	unsigned long Wraps; /* writes which wrapped around within their page */
+	unsigned long InjectedNacks; /* NACKs injected */
+	unsigned long InjectedErrors; /* bus errors injected */
+}I2cFlashSimChipType;
+
+/*
+ * Chips on the simulated bus
+ */
+static I2cFlashSimChipType I2cFlashSimChips[SIM_MAX_CHIPS];
+
+/*
+ * State of the error generator, xorshift32
+ */
+static u32 I2cFlashSimRandom;
+
+/*
+ * Parameters of the simulation
+ */
+static unsigned int I2cFlashSimChipCount = 1;
+module_param_named(chips, I2cFlashSimChipCount, uint, S_IRUGO);
+MODULE_PARM_DESC(chips, "Number of EEPROMs on the bus, at consecutive addresses from address (default 1)");
+static unsigned short I2cFlashSimBaseAddress = 0x54;
+module_param_named(address, I2cFlashSimBaseAddress, ushort, S_IRUGO);
+MODULE_PARM_DESC(address, "Address of the first EEPROM (default 0x54)");
+static int I2cFlashSimBus = -1;
+module_param_named(bus, I2cFlashSimBus, int, S_IRUGO);
+MODULE_PARM_DESC(bus, "Adapter number of the simulated bus, -1 for the next free one (default -1)");
+static unsigned int I2cFlashSimPageSize = SIM_PAGESIZE;
+module_param_named(page_size, I2cFlashSimPageSize, uint, S_IRUGO);
+MODULE_PARM_DESC(page_size, "Bytes of a page, a power of two (default 64)");
+static unsigned int I2cFlashSimSize = SIM_SIZE;
+module_param_named(size, I2cFlashSimSize, uint, S_IRUGO);
+MODULE_PARM_DESC(size, "Bytes of each EEPROM, a power of two up to 64K (default 32768)");
+static unsigned int I2cFlashSimWriteCycleUs = 5000;
+module_param_named(twr_us, I2cFlashSimWriteCycleUs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(twr_us, "Write cycle time, the EEPROM does not acknowledge its address meanwhile (default 5000)");
+static unsigned int I2cFlashSimBusKhz = 400;
+module_param_named(bus_khz, I2cFlashSimBusKhz, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(bus_khz, "Bus clock, transfers take the time of their bits, 0 for no delay (default 400)");
+static unsigned int I2cFlashSimNackPpm = 0;
+module_param_named(nack_ppm, I2cFlashSimNackPpm, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(nack_ppm, "Transfers not acknowledged, per million (default 0)");
+static unsigned int I2cFlashSimErrorPpm = 0;
+module_param_named(error_ppm, I2cFlashSimErrorPpm, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(error_ppm, "Transfers failing with a bus error, per million (default 0)");
+static unsigned int I2cFlashSimSeed = 1;
+module_param_named(seed, I2cFlashSimSeed, uint, S_IRUGO);
+MODULE_PARM_DESC(seed, "Seed of the injected NACKs and errors, the same seed gives the same sequence (default 1)");
+
+/* *********************************************************************
+ * NAME:             I2cFlashSimRoll
+ * CALLED BY:        I2cFlashSimTransfer
+ * DESCRIPTION:      draws the next number of the error generator
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    unsigned int : 0 to 999999
+ ***********************************************************************/
+static unsigned int I2cFlashSimRoll(void)
+{
+	I2cFlashSimRandom ^= I2cFlashSimRandom << 13;
+	I2cFlashSimRandom ^= I2cFlashSimRandom >> 17;
+	I2cFlashSimRandom ^= I2cFlashSimRandom << 5;
+	return I2cFlashSimRandom % 1000000;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashSimFindChip
+ * CALLED BY:        I2cFlashSimTransfer
+ * DESCRIPTION:      gives the chip answering to an address
+ * INPUT PARAMETERS: Address : 7 bit address of the message
+ * RETURN VALUES:    I2cFlashSimChipType * : NULL if no chip has it
+ ***********************************************************************/
+static I2cFlashSimChipType *I2cFlashSimFindChip(unsigned short Address)
+{
+	unsigned int Chip = 0;
+	for (Chip = 0; Chip < I2cFlashSimChipCount; Chip++)
+	{
+		if (Address == I2cFlashSimChips[Chip].Address)
+		{
+			return &I2cFlashSimChips[Chip];
+		}
+	}
+	return NULL;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashSimWrite
+ * CALLED BY:        I2cFlashSimTransfer
+ * DESCRIPTION:      executes a write message: the first two bytes set
+ *                   the address pointer, the data bytes go to the page
+ *                   of the pointer and wrap around at its end like the
+ *                   EEPROM does
+ * INPUT PARAMETERS: SimChip : addressed chip
+ *                   Msg : write message
+ * RETURN VALUES:    int : 1 if data was written and a write cycle starts
+ ***********************************************************************/
+static int I2cFlashSimWrite(I2cFlashSimChipType *SimChip, struct i2c_msg *Msg)
+{
+	unsigned int PageBase = 0; /* first byte of the page being written */
+	unsigned int Index = 0; /* data byte of the message */
+	if (Msg->len < 2)
+	{
+		/* ACK poll or only the high address byte, nothing is stored */
+		return 0;
+	}
+	SimChip->Pointer = ((Msg->buf[0] << 8) | Msg->buf[1]) & (I2cFlashSimSize - 1);
+	if (2 == Msg->len)
+	{
+		/* dummy write of a random read */
+		return 0;
+	}
+	PageBase = SimChip->Pointer & ~(I2cFlashSimPageSize - 1);
+	if ((SimChip->Pointer - PageBase + Msg->len - 2) > I2cFlashSimPageSize)
+	{
+		SimChip->Wraps++;
+		printk(KERN_WARNING "\n i2c_flash_sim: write of %u bytes at 0x%04x wraps around its page\n",(Msg->len - 2),SimChip->Pointer);
+	}
+	for (Index = 2; Index < Msg->len; Index++)
+	{
+		SimChip->Memory[SimChip->Pointer] = Msg->buf[Index];
+		SimChip->Pointer = PageBase | ((SimChip->Pointer + 1) & (I2cFlashSimPageSize - 1));
+	}
+	SimChip->PageWrites++;
+	return 1;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashSimRead
+ * CALLED BY:        I2cFlashSimTransfer
+ * DESCRIPTION:      executes a read message, a sequential read from the
+ *                   address pointer which rolls over at the end of the
+ *                   array
+ * INPUT PARAMETERS: SimChip : addressed chip
+ *                   Msg : read message
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashSimRead(I2cFlashSimChipType *SimChip, struct i2c_msg *Msg)
+{
+	unsigned int Index = 0; /* byte of the message */
+	for (Index = 0; Index < Msg->len; Index++)
+	{
+		Msg->buf[Index] = SimChip->Memory[SimChip->Pointer];
+		SimChip->Pointer = (SimChip->Pointer + 1) & (I2cFlashSimSize - 1);
+	}
+	SimChip->BytesRead += Msg->len;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashSimTransfer
+ * CALLED BY:        i2c core, with the bus lock of the adapter held
+ * DESCRIPTION:      executes the messages of one transfer against the
+ *                   simulated chips and takes the time the bytes need
+ *                   on the bus. A write cycle starts at the stop
+ *                   condition of a transfer which wrote data.
+ * INPUT PARAMETERS: Adapter : the simulated adapter
+ *                   Msgs : messages of the transfer
+ *                   Num : number of messages
+ * RETURN VALUES:    int : Num if every message was acknowledged,
+ *                         -ENXIO on a NACK, -EIO on a bus error
+ ***********************************************************************/
+static int I2cFlashSimTransfer(struct i2c_adapter *Adapter, struct i2c_msg *Msgs, int Num)
+{
+	I2cFlashSimChipType *SimChip = NULL; /* chip of the message */
+	I2cFlashSimChipType *Written = NULL; /* chip entering a write cycle */
+	unsigned long Bits = SIM_BITS_START_STOP; /* bits sent on the bus */
+	unsigned int Roll = 0; /* draw of the error generator */
+	int Status = Num;
+	int Index = 0;
+	for (Index = 0; Index < Num; Index++)
+	{
+		/* the address byte is on the bus even if nobody acknowledges it */
+		Bits += SIM_BITS_PER_BYTE;
+		SimChip = I2cFlashSimFindChip(Msgs[Index].addr);
+		if (NULL == SimChip)
+		{
+			Status = -ENXIO;
+			break;
+		}
+		if ((0 != I2cFlashSimNackPpm) || (0 != I2cFlashSimErrorPpm))
+		{
+			Roll = I2cFlashSimRoll();
+			if (Roll < I2cFlashSimNackPpm)
+			{
+				SimChip->InjectedNacks++;
+				Status = -ENXIO;
+				break;
+			}
+			if (Roll < (I2cFlashSimNackPpm + I2cFlashSimErrorPpm))
+			{
+				SimChip->InjectedErrors++;
+				Status = -EIO;
+				break;
+			}
+		}
+		if (ktime_before(ktime_get(),SimChip->BusyUntil))
+		{
+			/* in its write cycle the EEPROM does not acknowledge its address */
+			SimChip->BusyNacks++;
+			Status = -ENXIO;
+			break;
+		}
+		Bits += (unsigned long)Msgs[Index].len * SIM_BITS_PER_BYTE;
+		if (Msgs[Index].flags & I2C_M_RD)
+		{
+			I2cFlashSimRead(SimChip,&Msgs[Index]);
+		}
+		else if (I2cFlashSimWrite(SimChip,&Msgs[Index]))
+		{
+			Written = SimChip;
+		}
+	}
+	if (0 != I2cFlashSimBusKhz)
+	{
+		/* time of the bits at the bus clock */
+		usleep_range((Bits * 1000) / I2cFlashSimBusKhz,((Bits * 1000) / I2cFlashSimBusKhz) + 1);
+	}
+	if (NULL != Written)
+	{
+		Written->BusyUntil = ktime_add_us(ktime_get(),I2cFlashSimWriteCycleUs);
+	}
+	return Status;
+}
+
+/* *********************************************************************
+ * NAME:             I2cFlashSimFunctionality
+ * CALLED BY:        i2c core
+ * DESCRIPTION:      plain I2C transfers are supported
+ * INPUT PARAMETERS: Adapter : the simulated adapter
+ * RETURN VALUES:    u32 : functionality bits
+ ***********************************************************************/
+static u32 I2cFlashSimFunctionality(struct i2c_adapter *Adapter)
+{
+	return I2C_FUNC_I2C;
+}
+
+static const struct i2c_algorithm I2cFlashSimAlgorithm = {
+	.master_xfer = I2cFlashSimTransfer,
+	.functionality = I2cFlashSimFunctionality,
+};
+
+static struct i2c_adapter I2cFlashSimAdapter = {
+	.owner = THIS_MODULE,
+	.algo = &I2cFlashSimAlgorithm,
+	.name = "i2c_flash_sim",
+};
+
+/* *********************************************************************
+ * NAME:             I2cFlashSimFree
+ * CALLED BY:        I2cFlashSimInit, I2cFlashSimExit
+ * DESCRIPTION:      frees the arrays of the chips
+ * INPUT PARAMETERS: None
+ * RETURN VALUES:    None
+ ***********************************************************************/
+static void I2cFlashSimFree(void)
+{
+	unsigned int Chip = 0;
+	for (Chip = 0; Chip < SIM_MAX_CHIPS; Chip++)
+	{
+		vfree(I2cFlashSimChips[Chip].Memory);
+		I2cFlashSimChips[Chip].Memory = NULL;
+	}
+}
+
+/*
+ * Module Initialization
+ */
+int __init I2cFlashSimInit(void)
+{
+	unsigned int Chip = 0; /* chip being set up */
+	int Ret = 0;
+	if ((0 == I2cFlashSimChipCount) || (SIM_MAX_CHIPS < I2cFlashSimChipCount) ||
+	    ((I2cFlashSimBaseAddress + I2cFlashSimChipCount) > 0x78) ||
+	    (0 != (I2cFlashSimPageSize & (I2cFlashSimPageSize - 1))) || (0 == I2cFlashSimPageSize) ||
+	    (0 != (I2cFlashSimSize & (I2cFlashSimSize - 1))) || (I2cFlashSimSize < I2cFlashSimPageSize) ||
+	    (0x10000 < I2cFlashSimSize))
+	{
+		printk(KERN_ERR "i2c_flash_sim: bad parameters\n");
+		return -EINVAL;
+	}
+	for (Chip = 0; Chip < I2cFlashSimChipCount; Chip++)
+	{
+		I2cFlashSimChips[Chip].Address = I2cFlashSimBaseAddress + Chip;
+		/* delivered erased */
+		I2cFlashSimChips[Chip].Memory = vmalloc(I2cFlashSimSize);
+		if (NULL == I2cFlashSimChips[Chip].Memory)
+		{
+			I2cFlashSimFree();
+			return -ENOMEM;
+		}
+		memset(I2cFlashSimChips[Chip].Memory,0xFF,I2cFlashSimSize);
+	}
+	I2cFlashSimRandom = (0 != I2cFlashSimSeed) ? I2cFlashSimSeed : 1;
+	I2cFlashSimAdapter.nr = I2cFlashSimBus;
+	Ret = (I2cFlashSimBus < 0) ? i2c_add_adapter(&I2cFlashSimAdapter) : i2c_add_numbered_adapter(&I2cFlashSimAdapter);
+	if (Ret)
+	{
+		I2cFlashSimFree();
+		return Ret;
+	}
+	printk(KERN_INFO "\n i2c_flash_sim: bus %d, %u chips from 0x%02x, %u pages of %u bytes, tWR %u us, %u kHz\n",
+	       I2cFlashSimAdapter.nr,I2cFlashSimChipCount,I2cFlashSimBaseAddress,(I2cFlashSimSize / I2cFlashSimPageSize),
+	       I2cFlashSimPageSize,I2cFlashSimWriteCycleUs,I2cFlashSimBusKhz);
+	return 0;
+}
+
+/*
+ * Module Deinitialization, prints what each chip has seen
+ */
+void __exit I2cFlashSimExit(void)
+{
+	unsigned int Chip = 0;
+	i2c_del_adapter(&I2cFlashSimAdapter);
+	for (Chip = 0; Chip < I2cFlashSimChipCount; Chip++)
+	{
+		printk(KERN_INFO "\n i2c_flash_sim: 0x%02x page writes %lu bytes read %lu busy nacks %lu wraps %lu injected nacks %lu errors %lu\n",
+		       I2cFlashSimChips[Chip].Address,I2cFlashSimChips[Chip].PageWrites,I2cFlashSimChips[Chip].BytesRead,
+		       I2cFlashSimChips[Chip].BusyNacks,I2cFlashSimChips[Chip].Wraps,I2cFlashSimChips[Chip].InjectedNacks,
+		       I2cFlashSimChips[Chip].InjectedErrors);
+	}
+	I2cFlashSimFree();
+}
+
+module_init(I2cFlashSimInit);
+module_exit(I2cFlashSimExit);
+MODULE_LICENSE("GPL");
@@ -0,0 +1,169 @@
+/* *********************************************************************
+ *
+ * Tracepoints of the request lifecycle of the i2c_flash driver
+ *
+ * Program Name:        i2c_flash
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ *
+ * Enable with
+ *   echo 1 > /sys/kernel/debug/tracing/events/i2c_flash/enable
+ * or record with perf record -e 'i2c_flash:*'. Every event carries the
+ * chip, the request id, the page, the byte count and a status so that
+ * the timeline of each request can be rebuilt from the trace. A
+ * disabled tracepoint costs a not taken branch.
+ **********************************************************************/
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM i2c_flash
+
+#if !defined(I2C_FLASH_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define I2C_FLASH_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/version.h>
+
+/*
+ * __assign_str takes only the field from Linux 6.10 on
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,10,0)
+#define I2C_FLASH_ASSIGN_STR(field, src) __assign_str(field)
+#else
+#define I2C_FLASH_ASSIGN_STR(field, src) __assign_str(field, src)
+#endif
+
+/*
+ * Operation of a request, values of I2cFlashReadOrWriteType. The enum
+ * values are exported so that perf and trace-cmd can print the names.
+ */
+TRACE_DEFINE_ENUM(I2CFLASHREAD);
+TRACE_DEFINE_ENUM(I2CFLASHWRITE);
+TRACE_DEFINE_ENUM(I2CFLASHDATAREADY);
+TRACE_DEFINE_ENUM(I2CFLASHERASE);
+TRACE_DEFINE_ENUM(NONE);
+
+#define I2C_FLASH_TRACE_OP(op) __print_symbolic(op, \
+		{ I2CFLASHREAD, "read" }, \
+		{ I2CFLASHWRITE, "write" }, \
+		{ I2CFLASHDATAREADY, "dataready" }, \
+		{ I2CFLASHERASE, "erase" }, \
+		{ NONE, "none" })
+
+/*
+ * Request level events: queued, taken by the work function, done
+ */
+DECLARE_EVENT_CLASS(i2c_flash_request,
+	TP_PROTO(const char *name, unsigned long id, int op, unsigned int page, unsigned int bytes, int status),
+	TP_ARGS(name, id, op, page, bytes, status),
+	TP_STRUCT__entry(
+		__string(name, name)
+		__field(unsigned long, id)
+		__field(int, op)
+		__field(unsigned int, page)
+		__field(unsigned int, bytes)
+		__field(int, status)
+	),
+	TP_fast_assign(
+		I2C_FLASH_ASSIGN_STR(name, name);
+		__entry->id = id;
+		__entry->op = op;
+		__entry->page = page;
+		__entry->bytes = bytes;
+		__entry->status = status;
+	),
+	TP_printk("%s id=%lu op=%s page=%u bytes=%u status=%d", __get_str(name), __entry->id,
+		  I2C_FLASH_TRACE_OP(__entry->op), __entry->page, __entry->bytes, __entry->status)
+);
+
+/* status is the depth of the queue once the request is in */
+DEFINE_EVENT(i2c_flash_request, i2c_flash_submit,
+	TP_PROTO(const char *name, unsigned long id, int op, unsigned int page, unsigned int bytes, int status),
+	TP_ARGS(name, id, op, page, bytes, status));
+
+/* status is the depth of the queue left behind */
+DEFINE_EVENT(i2c_flash_request, i2c_flash_dequeue,
+	TP_PROTO(const char *name, unsigned long id, int op, unsigned int page, unsigned int bytes, int status),
+	TP_ARGS(name, id, op, page, bytes, status));
+
+/* status is 0, or the error code of a request which stopped part way */
+DEFINE_EVENT(i2c_flash_request, i2c_flash_complete,
+	TP_PROTO(const char *name, unsigned long id, int op, unsigned int page, unsigned int bytes, int status),
+	TP_ARGS(name, id, op, page, bytes, status));
+
+/*
+ * Transfer level events: one read chunk or one page write on the bus
+ */
+DECLARE_EVENT_CLASS(i2c_flash_xfer,
+	TP_PROTO(const char *name, unsigned long id, unsigned int page, unsigned int bytes, int status),
+	TP_ARGS(name, id, page, bytes, status),
+	TP_STRUCT__entry(
+		__string(name, name)
+		__field(unsigned long, id)
+		__field(unsigned int, page)
+		__field(unsigned int, bytes)
+		__field(int, status)
+	),
+	TP_fast_assign(
+		I2C_FLASH_ASSIGN_STR(name, name);
+		__entry->id = id;
+		__entry->page = page;
+		__entry->bytes = bytes;
+		__entry->status = status;
+	),
+	TP_printk("%s id=%lu page=%u bytes=%u status=%d", __get_str(name), __entry->id,
+		  __entry->page, __entry->bytes, __entry->status)
+);
+
+/* status is 0 */
+DEFINE_EVENT(i2c_flash_xfer, i2c_flash_xfer_start,
+	TP_PROTO(const char *name, unsigned long id, unsigned int page, unsigned int bytes, int status),
+	TP_ARGS(name, id, page, bytes, status));
+
+/* status is the byte count transferred or the error code */
+DEFINE_EVENT(i2c_flash_xfer, i2c_flash_xfer_end,
+	TP_PROTO(const char *name, unsigned long id, unsigned int page, unsigned int bytes, int status),
+	TP_ARGS(name, id, page, bytes, status));
+
+/* status is the error code of the failed transfer being repeated */
+DEFINE_EVENT(i2c_flash_xfer, i2c_flash_retry,
+	TP_PROTO(const char *name, unsigned long id, unsigned int page, unsigned int bytes, int status),
+	TP_ARGS(name, id, page, bytes, status));
+
+/*
+ * Wait for the EEPROM to finish the write cycle of a page, before the
+ * next transfer. status is 0 or -ETIMEDOUT.
+ */
+TRACE_EVENT(i2c_flash_write_cycle,
+	TP_PROTO(const char *name, unsigned long id, unsigned int page, unsigned int wait_us, unsigned int polls, int status),
+	TP_ARGS(name, id, page, wait_us, polls, status),
+	TP_STRUCT__entry(
+		__string(name, name)
+		__field(unsigned long, id)
+		__field(unsigned int, page)
+		__field(unsigned int, wait_us)
+		__field(unsigned int, polls)
+		__field(int, status)
+	),
+	TP_fast_assign(
+		I2C_FLASH_ASSIGN_STR(name, name);
+		__entry->id = id;
+		__entry->page = page;
+		__entry->wait_us = wait_us;
+		__entry->polls = polls;
+		__entry->status = status;
+	),
+	TP_printk("%s id=%lu page=%u wait_us=%u polls=%u status=%d", __get_str(name), __entry->id,
+		  __entry->page, __entry->wait_us, __entry->polls, __entry->status)
+);
+
+#endif /* I2C_FLASH_TRACE_H */
+
+/* This part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE i2c_flash_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,192 @@
+/* *********************************************************************
+ *
+ * Benchmark of the key/value store against writing every key to a
+ * fixed page of the EEPROM
+ *
+ * Program Name:        I2cFlashKvBench
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+
+/* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "i2c_flash_kv.h"
+
+/* ***************** PREPROCESSOR DIRECTIVES **************************/
+/*
+ * Macros required to identify requests in ioctl
+ */
+#define FLASHERASE  3
+#define FLASHWAIT   _IO('F',6)
+
+/* *********************************************************************
+ * NAME:             Now
+ * DESCRIPTION:      monotonic time in seconds
+ ***********************************************************************/
+static double Now(void)
+{
+	struct timespec Ts;
+	clock_gettime(CLOCK_MONOTONIC,&Ts);
+	return Ts.tv_sec + (Ts.tv_nsec / 1e9);
+}
+
+/* *********************************************************************
+ * NAME:             MaxWrites
+ * DESCRIPTION:      highest write count of a page
+ ***********************************************************************/
+static unsigned long MaxWrites(const unsigned long *PageWrites)
+{
+	unsigned long Max = 0;
+	unsigned int Page;
+	for (Page = 0; Page < KV_PAGECOUNT; Page++)
+	{
+		if (PageWrites[Page] > Max)
+		{
+			Max = PageWrites[Page];
+		}
+	}
+	return Max;
+}
+
+/* *********************************************************************
+ * NAME:             RunFixed
+ * DESCRIPTION:      the naive way, key n is a counter in page n. Every
+ *                   put rewrites the page of its key.
+ ***********************************************************************/
+static int RunFixed(unsigned int Puts, unsigned int Keys, unsigned long *PageWrites, double *Seconds)
+{
+	char Page[KV_PAGESIZE];
+	unsigned int Put, Key;
+	struct pollfd PollFd;
+	double Start;
+	ssize_t res;
+	/* queued like the writes of the key/value store */
+	int Fd = open("/dev/i2c_flash",(O_RDWR | O_NONBLOCK));
+	if (Fd < 0)
+	{
+		perror("open /dev/i2c_flash");
+		return -1;
+	}
+	PollFd.fd = Fd;
+	PollFd.events = POLLOUT;
+	Start = Now();
+	for (Put = 0; Put < Puts; Put++)
+	{
+		/* a few hot keys take most of the updates */
+		Key = (rand() % 4) ? (unsigned int)(rand() % 2) : (rand() % Keys);
+		memset(Page,0xFF,sizeof(Page));
+		snprintf(Page,sizeof(Page),"counter%u=%u",Key,Put);
+		while ((res = pwrite(Fd,Page,KV_PAGESIZE,(off_t)Key * KV_PAGESIZE)) < 0)
+		{
+			if (EBUSY != errno)
+			{
+				perror("pwrite");
+				close(Fd);
+				return -1;
+			}
+			poll(&PollFd,1,-1);
+		}
+		PageWrites[Key]++;
+	}
+	ioctl(Fd,FLASHWAIT,0);
+	*Seconds = Now() - Start;
+	close(Fd);
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             RunKv
+ * DESCRIPTION:      the same updates through the key/value store
+ ***********************************************************************/
+static int RunKv(unsigned int Puts, unsigned int Keys, I2cFlashKvType *Kv, double *Seconds)
+{
+	char Key[16], Value[16];
+	unsigned int Put, Length;
+	double Start;
+	int res = I2cFlashKvOpen(Kv,"/dev/i2c_flash");
+	if (res < 0)
+	{
+		fprintf(stderr,"I2cFlashKvOpen: %s\n",strerror(-res));
+		return -1;
+	}
+	Start = Now();
+	for (Put = 0; Put < Puts; Put++)
+	{
+		Length = snprintf(Key,sizeof(Key),"counter%u",(rand() % 4) ? (unsigned int)(rand() % 2) : (rand() % Keys));
+		snprintf(Value,sizeof(Value),"%u",Put);
+		res = I2cFlashKvPut(Kv,Key,Length,Value,strlen(Value));
+		if (res < 0)
+		{
+			fprintf(stderr,"I2cFlashKvPut: %s\n",strerror(-res));
+			return -1;
+		}
+	}
+	I2cFlashKvSync(Kv);
+	*Seconds = Now() - Start;
+	/* the last value must come back */
+	Length = sizeof(Value);
+	if ((0 != I2cFlashKvGet(Kv,Key,strlen(Key),Value,&Length)) || (Length != strlen(Value)))
+	{
+		fprintf(stderr,"I2cFlashKvGet returned a wrong value\n");
+		return -1;
+	}
+	I2cFlashKvClose(Kv);
+	return 0;
+}
+
+/* *********************************************************************
+ * Usage: I2cFlashKvBench [puts] [keys]
+ * The EEPROM is erased before each run, its contents are lost.
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	unsigned int Puts = (argc > 1) ? strtoul(argv[1],NULL,0) : 2000;
+	unsigned int Keys = (argc > 2) ? strtoul(argv[2],NULL,0) : 32;
+	static unsigned long FixedWrites[KV_PAGECOUNT];
+	static I2cFlashKvType Kv;
+	double FixedSeconds, KvSeconds;
+	int Fd;
+	if ((0 == Puts) || (Keys < 2) || (Keys > KV_PAGECOUNT))
+	{
+		fprintf(stderr,"usage: %s [puts] [keys 2..%d]\n",argv[0],KV_PAGECOUNT);
+		return 1;
+	}
+	Fd = open("/dev/i2c_flash",O_RDWR);
+	if (Fd < 0)
+	{
+		perror("open /dev/i2c_flash");
+		return 1;
+	}
+	ioctl(Fd,0,FLASHERASE);
+	ioctl(Fd,FLASHWAIT,0);
+	srand(1);
+	if (RunFixed(Puts,Keys,FixedWrites,&FixedSeconds) < 0)
+	{
+		return 1;
+	}
+	ioctl(Fd,0,FLASHERASE);
+	ioctl(Fd,FLASHWAIT,0);
+	close(Fd);
+	srand(1);
+	if (RunKv(Puts,Keys,&Kv,&KvSeconds) < 0)
+	{
+		return 1;
+	}
+	printf("%u puts over %u keys\n",Puts,Keys);
+	printf("fixed  %10.1f puts/s  max writes of a page %lu\n",Puts / FixedSeconds,MaxWrites(FixedWrites));
+	printf("kv     %10.1f puts/s  max writes of a page %lu  (%lu records moved by compaction)\n",
+	       Puts / KvSeconds,MaxWrites(Kv.PageWrites),Kv.Relocations);
+	return 0;
+}
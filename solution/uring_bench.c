@@ -0,0 +1,230 @@
+/* *********************************************************************
+ *
+ * Benchmark of the io_uring path of the i2c_flash driver against the
+ * read, -EAGAIN, read again protocol of the non blocking read
+ *
+ * Program Name:        I2cFlashUringBench
+ * Target:              Intel Galileo Gen1
+ * Architecture:		x86
+ * Compiler:            i586-poky-linux-gcc
+ * File version:        v1.0.0
+ * Author:              Brahmesh S D Jain
+ * Email Id:            Brahmesh.Jain@asu.edu
+ **********************************************************************/
+
+/* *************** INCLUDE DIRECTIVES FOR STANDARD HEADERS ************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <liburing.h>
+
+/* ***************** PREPROCESSOR DIRECTIVES **************************/
+/*
+ * Macros required to identify requests in ioctl
+ */
+#define FLASHCACHE  _IO('F',5)
+#define CACHEDISABLE      0
+#define CACHEENABLE       1
+/*
+ * Geometry of the EEPROM
+ */
+#define PAGECOUNT 512
+#define PAGESIZE  64
+/*
+ * Most requests kept in flight by the io_uring run
+ */
+#define MAX_DEPTH  16
+
+/*
+ * Results of one run
+ */
+typedef struct BenchResultTag
+{
+	double Seconds; /* wall clock time of the run */
+	double CpuSeconds; /* user + system time of this process */
+	unsigned long Syscalls; /* read or io_uring_enter calls made */
+}BenchResultType;
+
+/* *********************************************************************
+ * NAME:             Now
+ * DESCRIPTION:      monotonic time in seconds
+ ***********************************************************************/
+static double Now(void)
+{
+	struct timespec Ts;
+	clock_gettime(CLOCK_MONOTONIC,&Ts);
+	return Ts.tv_sec + (Ts.tv_nsec / 1e9);
+}
+
+/* *********************************************************************
+ * NAME:             CpuTime
+ * DESCRIPTION:      user + system time consumed by this process in seconds
+ ***********************************************************************/
+static double CpuTime(void)
+{
+	struct rusage Usage;
+	getrusage(RUSAGE_SELF,&Usage);
+	return Usage.ru_utime.tv_sec + (Usage.ru_utime.tv_usec / 1e6) +
+	       Usage.ru_stime.tv_sec + (Usage.ru_stime.tv_usec / 1e6);
+}
+
+/* *********************************************************************
+ * NAME:             RunEagain
+ * DESCRIPTION:      reads Ops requests of Size bytes one after the other,
+ *                   repeating pread until the driver stops returning
+ *                   -EAGAIN
+ ***********************************************************************/
+static int RunEagain(int Fd, unsigned int Ops, unsigned int Size, BenchResultType *Result)
+{
+	char Buffer[PAGECOUNT * PAGESIZE];
+	unsigned int Index;
+	ssize_t res;
+	double Start = Now(), CpuStart = CpuTime();
+	Result->Syscalls = 0;
+	for (Index = 0; Index < Ops; Index++)
+	{
+		off_t Offset = ((off_t)rand() % (PAGECOUNT - (Size / PAGESIZE))) * PAGESIZE;
+		do
+		{
+			res = pread(Fd,Buffer,Size,Offset);
+			Result->Syscalls++;
+		}while ((res < 0) && (EAGAIN == errno));
+		if (res != (ssize_t)Size)
+		{
+			perror("pread");
+			return -1;
+		}
+	}
+	Result->Seconds = Now() - Start;
+	Result->CpuSeconds = CpuTime() - CpuStart;
+	return 0;
+}
+
+/* *********************************************************************
+ * NAME:             RunUring
+ * DESCRIPTION:      reads Ops requests of Size bytes keeping Depth of
+ *                   them queued in io_uring, completions are reaped in
+ *                   batches
+ ***********************************************************************/
+static int RunUring(int Fd, unsigned int Ops, unsigned int Size, unsigned int Depth, BenchResultType *Result)
+{
+	static char Buffers[MAX_DEPTH][PAGECOUNT * PAGESIZE];
+	struct io_uring Ring;
+	struct io_uring_sqe *Sqe;
+	struct io_uring_cqe *Cqe;
+	unsigned int Submitted = 0, Completed = 0, InFlight = 0, Head, Reaped;
+	unsigned long Slot;
+	double Start, CpuStart;
+	int res;
+	if (io_uring_queue_init(Depth,&Ring,0) < 0)
+	{
+		perror("io_uring_queue_init");
+		return -1;
+	}
+	Result->Syscalls = 0;
+	Start = Now();
+	CpuStart = CpuTime();
+	while (Completed < Ops)
+	{
+		/* top up the ring, one buffer per slot in flight */
+		while ((InFlight < Depth) && (Submitted < Ops))
+		{
+			off_t Offset = ((off_t)rand() % (PAGECOUNT - (Size / PAGESIZE))) * PAGESIZE;
+			Sqe = io_uring_get_sqe(&Ring);
+			Slot = Submitted % Depth;
+			io_uring_prep_read(Sqe,Fd,Buffers[Slot],Size,Offset);
+			io_uring_sqe_set_data(Sqe,(void*)Slot);
+			Submitted++;
+			InFlight++;
+		}
+		/* one system call submits the new reads and waits for at least one completion */
+		res = io_uring_submit_and_wait(&Ring,1);
+		Result->Syscalls++;
+		if (res < 0)
+		{
+			fprintf(stderr,"io_uring_submit_and_wait: %s\n",strerror(-res));
+			break;
+		}
+		Reaped = 0;
+		io_uring_for_each_cqe(&Ring,Head,Cqe)
+		{
+			if (Cqe->res != (int)Size)
+			{
+				fprintf(stderr,"read failed: %s\n",strerror(-Cqe->res));
+				res = -1;
+			}
+			Reaped++;
+		}
+		io_uring_cq_advance(&Ring,Reaped);
+		InFlight -= Reaped;
+		Completed += Reaped;
+		if (res < 0)
+		{
+			break;
+		}
+	}
+	Result->Seconds = Now() - Start;
+	Result->CpuSeconds = CpuTime() - CpuStart;
+	io_uring_queue_exit(&Ring);
+	return (Completed < Ops) ? -1 : 0;
+}
+
+/* *********************************************************************
+ * NAME:             PrintResult
+ * DESCRIPTION:      prints ops/s, cpu time and system calls per operation
+ ***********************************************************************/
+static void PrintResult(const char *Name, unsigned int Ops, BenchResultType *Result)
+{
+	printf("%-8s %10.1f ops/s %10.1f us cpu/op %8.2f syscalls/op\n",Name,
+	       Ops / Result->Seconds,(Result->CpuSeconds * 1e6) / Ops,(double)Result->Syscalls / Ops);
+}
+
+/* *********************************************************************
+ * Usage: I2cFlashUringBench [ops] [bytes per read] [io_uring depth]
+ * The shadow image is switched off during the runs so that every read
+ * goes to the EEPROM.
+ ***********************************************************************/
+int main(int argc, char *argv[])
+{
+	unsigned int Ops = (argc > 1) ? strtoul(argv[1],NULL,0) : 1000;
+	unsigned int Size = (argc > 2) ? strtoul(argv[2],NULL,0) : PAGESIZE;
+	unsigned int Depth = (argc > 3) ? strtoul(argv[3],NULL,0) : 8;
+	BenchResultType Eagain, Uring;
+	int Fd;
+	if ((0 == Ops) || (0 == Size) || (0 != (Size % PAGESIZE)) || (Size >= (PAGECOUNT * PAGESIZE)) ||
+	    (0 == Depth) || (Depth > MAX_DEPTH))
+	{
+		fprintf(stderr,"usage: %s [ops] [bytes per read, multiple of %d] [depth 1..%d]\n",argv[0],PAGESIZE,MAX_DEPTH);
+		return 1;
+	}
+	/* the EAGAIN protocol needs a non blocking file, io_uring does not care */
+	Fd = open("/dev/i2c_flash",(O_RDWR | O_NONBLOCK));
+	if (Fd < 0)
+	{
+		perror("open /dev/i2c_flash");
+		return 1;
+	}
+	ioctl(Fd,FLASHCACHE,CACHEDISABLE);
+	srand(1);
+	if (RunEagain(Fd,Ops,Size,&Eagain) < 0)
+	{
+		return 1;
+	}
+	srand(1);
+	if (RunUring(Fd,Ops,Size,Depth,&Uring) < 0)
+	{
+		return 1;
+	}
+	ioctl(Fd,FLASHCACHE,CACHEENABLE);
+	printf("%u reads of %u bytes, io_uring depth %u\n",Ops,Size,Depth);
+	PrintResult("eagain",Ops,&Eagain);
+	PrintResult("io_uring",Ops,&Uring);
+	close(Fd);
+	return 0;
+}